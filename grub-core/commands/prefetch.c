@@ -0,0 +1,598 @@
+/* prefetch.c - record and replay the disk reads of a boot.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2013  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/file.h>
+#include <grub/disk.h>
+#include <grub/misc.h>
+#include <grub/env.h>
+#include <grub/partition.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define PREFETCH_DEFAULT_FILE	"prefetch"
+
+/* At most this many disk cache units are recorded, which keeps a replay
+   well within the disk cache.  */
+#define PREFETCH_MAX_CHUNKS	256
+#define PREFETCH_HASH_SIZE	1024
+#define PREFETCH_MAX_DISKS	16
+
+/* Reads larger than this are bulk sequential transfers (kernels,
+   initrds) which gain nothing from being prefetched.  */
+#define PREFETCH_MAX_READ	(256 << 10)
+
+/* Largest single read issued while replaying, in disk cache units.  */
+#define PREFETCH_MAX_RANGE	32
+
+/* Profiles larger than this are not read.  */
+#define PREFETCH_MAX_FILE	(64 << 10)
+
+static const struct grub_arg_option options[] =
+  {
+    {"record", 'r', 0, N_("Start recording disk reads."), 0, 0},
+    {"save", 's', 0, N_("Stop recording and save the reads to the profile."),
+     0, 0},
+    /* TRANSLATORS: This option is used to override default filename
+       for loading and storing the prefetch profile.  */
+    {"file", 'f', 0, N_("Specify filename."), 0, ARG_TYPE_PATHNAME},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+/* A recorded disk cache unit.  DISK is an index into disk_names plus
+   one, zero marks a free slot.  */
+struct prefetch_chunk
+{
+  unsigned disk;
+  grub_disk_addr_t chunk;
+};
+
+static struct prefetch_chunk *chunks;
+static unsigned num_chunks;
+static char *disk_names[PREFETCH_MAX_DISKS];
+static unsigned num_disks;
+
+static void
+free_recording (void)
+{
+  unsigned i;
+
+  grub_free (chunks);
+  chunks = NULL;
+  num_chunks = 0;
+  for (i = 0; i < num_disks; i++)
+    grub_free (disk_names[i]);
+  num_disks = 0;
+}
+
+/* Return the index plus one of NAME in disk_names, adding it if needed,
+   or 0 if the table is full.  */
+static unsigned
+disk_index (const char *name)
+{
+  unsigned i;
+
+  for (i = 0; i < num_disks; i++)
+    if (grub_strcmp (disk_names[i], name) == 0)
+      return i + 1;
+
+  if (num_disks == PREFETCH_MAX_DISKS)
+    return 0;
+  disk_names[num_disks] = grub_strdup (name);
+  if (!disk_names[num_disks])
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  return ++num_disks;
+}
+
+static void
+record_chunk (unsigned disk, grub_disk_addr_t chunk)
+{
+  unsigned h;
+
+  h = (((unsigned) chunk * 2654435761U) ^ disk) % PREFETCH_HASH_SIZE;
+  while (chunks[h].disk)
+    {
+      if (chunks[h].disk == disk && chunks[h].chunk == chunk)
+	return;
+      h = (h + 1) % PREFETCH_HASH_SIZE;
+    }
+
+  chunks[h].disk = disk;
+  chunks[h].chunk = chunk;
+  num_chunks++;
+}
+
+static void
+record_read (grub_disk_t disk, grub_disk_addr_t sector, grub_off_t offset,
+	     grub_size_t size)
+{
+  grub_disk_addr_t first, last;
+  unsigned idx;
+
+  if (size == 0 || size > PREFETCH_MAX_READ
+      || num_chunks >= PREFETCH_MAX_CHUNKS)
+    return;
+
+  /* Only firmware and hardware disks are worth it; the rest either are
+     in memory or end up reading one of those.  */
+  switch (disk->dev->id)
+    {
+    case GRUB_DISK_DEVICE_LOOPBACK_ID:
+    case GRUB_DISK_DEVICE_DISKFILTER_ID:
+    case GRUB_DISK_DEVICE_HOST_ID:
+    case GRUB_DISK_DEVICE_MEMDISK_ID:
+    case GRUB_DISK_DEVICE_CRYPTODISK_ID:
+    case GRUB_DISK_DEVICE_PROCFS_ID:
+      return;
+    default:
+      break;
+    }
+
+  idx = disk_index (disk->name);
+  if (!idx)
+    return;
+
+  first = sector >> GRUB_DISK_CACHE_BITS;
+  last = ((sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+		     >> GRUB_DISK_SECTOR_BITS) - 1)
+	  >> GRUB_DISK_CACHE_BITS);
+  for (; first <= last && num_chunks < PREFETCH_MAX_CHUNKS; first++)
+    record_chunk (idx, first);
+}
+
+static grub_file_t
+open_profile (const char *filename)
+{
+  grub_file_t file;
+  const char *prefix;
+  char *path;
+
+  grub_file_filter_disable_compression ();
+  if (filename)
+    return grub_file_open (filename);
+
+  prefix = grub_env_get ("prefix");
+  if (!prefix)
+    {
+      grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"),
+		  "prefix");
+      return 0;
+    }
+
+  path = grub_xasprintf ("%s/" PREFETCH_DEFAULT_FILE, prefix);
+  if (!path)
+    return 0;
+  file = grub_file_open (path);
+  grub_free (path);
+  return file;
+}
+
+static char *
+read_profile (grub_file_t file)
+{
+  char *buf;
+
+  if (grub_file_size (file) > PREFETCH_MAX_FILE)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "prefetch profile too large");
+      return NULL;
+    }
+
+  buf = grub_malloc (grub_file_size (file) + 1);
+  if (!buf)
+    return NULL;
+
+  if (grub_file_read (file, buf, grub_file_size (file))
+      != (grub_ssize_t) grub_file_size (file))
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, "premature end of file");
+      grub_free (buf);
+      return NULL;
+    }
+  buf[grub_file_size (file)] = 0;
+  return buf;
+}
+
+/* Read the sectors listed on one profile line into the disk cache.  */
+static void
+replay_line (char *line, char *buf)
+{
+  grub_disk_t disk;
+  char *name, *ptr;
+
+  for (ptr = line; *ptr && *ptr != ' '; ptr++);
+  if (*ptr)
+    *ptr++ = 0;
+  name = line;
+  if (!*name)
+    return;
+
+  disk = grub_disk_open (name);
+  if (!disk)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  while (*ptr)
+    {
+      grub_disk_addr_t sector, count, n;
+
+      while (*ptr == ' ')
+	ptr++;
+      if (!*ptr)
+	break;
+      sector = grub_strtoull (ptr, &ptr, 0);
+      if (grub_errno || *ptr != '+')
+	break;
+      count = grub_strtoull (ptr + 1, &ptr, 0);
+      if (grub_errno)
+	break;
+
+      for (; count; sector += n, count -= n)
+	{
+	  n = count;
+	  if (n > PREFETCH_MAX_RANGE << GRUB_DISK_CACHE_BITS)
+	    n = PREFETCH_MAX_RANGE << GRUB_DISK_CACHE_BITS;
+	  /* Nothing to do about failures; the data is read again when
+	     needed.  */
+	  if (grub_disk_read (disk, sector, 0, n << GRUB_DISK_SECTOR_BITS,
+			      buf))
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      break;
+	    }
+	}
+    }
+
+  grub_errno = GRUB_ERR_NONE;
+  grub_disk_close (disk);
+}
+
+static grub_err_t
+replay_profile (const char *filename)
+{
+  grub_disk_read_record_hook_t hook;
+  grub_file_t file;
+  char *profile, *line, *next, *buf;
+
+  file = open_profile (filename);
+  if (!file)
+    return grub_errno;
+  profile = read_profile (file);
+  grub_file_close (file);
+  if (!profile)
+    return grub_errno;
+
+  buf = grub_malloc (PREFETCH_MAX_RANGE
+		     << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+  if (!buf)
+    {
+      grub_free (profile);
+      return grub_errno;
+    }
+
+  /* Our own reads aren't part of the boot.  */
+  hook = grub_disk_read_record_hook;
+  grub_disk_read_record_hook = 0;
+
+  for (line = profile; *line; line = next)
+    {
+      for (next = line; *next && *next != '\n'; next++);
+      if (*next)
+	*next++ = 0;
+      if (*line != '#')
+	replay_line (line, buf);
+    }
+
+  grub_disk_read_record_hook = hook;
+  grub_free (buf);
+  grub_free (profile);
+  return GRUB_ERR_NONE;
+}
+
+/* Append LINE of LEN bytes and a newline to OUT of SIZE bytes, USED of
+   which are taken.  Return 0 if it doesn't fit.  */
+static int
+append_line (char *out, grub_size_t size, grub_size_t *used,
+	     const char *line, grub_size_t len)
+{
+  if (*used + len + 1 > size)
+    return 0;
+  grub_memcpy (out + *used, line, len);
+  out[*used + len] = '\n';
+  *used += len + 1;
+  return 1;
+}
+
+/* Format the recorded chunks, sorted and coalesced, into OUT of SIZE
+   bytes.  Lines which don't fit are dropped.  */
+static void
+format_profile (char *out, grub_size_t size)
+{
+  struct prefetch_chunk *sorted;
+  grub_size_t used = 0;
+  unsigned n = 0, i, j;
+
+  grub_memset (out, 0, size);
+
+  sorted = grub_malloc (num_chunks * sizeof (sorted[0]));
+  if (!sorted)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < PREFETCH_HASH_SIZE; i++)
+    {
+      struct prefetch_chunk c = chunks[i];
+
+      if (!c.disk)
+	continue;
+      for (j = n; j > 0 && (sorted[j - 1].disk > c.disk
+			    || (sorted[j - 1].disk == c.disk
+				&& sorted[j - 1].chunk > c.chunk)); j--)
+	sorted[j] = sorted[j - 1];
+      sorted[j] = c;
+      n++;
+    }
+
+  for (i = 0; i < n; )
+    {
+      char line[512];
+      grub_size_t len, namelen;
+
+      namelen = len = grub_snprintf (line, sizeof (line), "%s",
+				     disk_names[sorted[i].disk - 1]);
+      for (j = i; j < n && sorted[j].disk == sorted[i].disk; )
+	{
+	  grub_disk_addr_t start = sorted[j].chunk, count = 0;
+	  char range[48];
+	  grub_size_t rlen;
+
+	  for (; j < n && sorted[j].disk == sorted[i].disk
+		 && sorted[j].chunk == start + count; j++)
+	    count++;
+	  rlen = grub_snprintf (range, sizeof (range), " %llu+%llu",
+				(unsigned long long) (start
+						      << GRUB_DISK_CACHE_BITS),
+				(unsigned long long) (count
+						      << GRUB_DISK_CACHE_BITS));
+	  /* Continue on a new line for the same disk.  */
+	  if (len + rlen >= sizeof (line) && len > namelen)
+	    {
+	      if (!append_line (out, size, &used, line, len))
+		goto out;
+	      len = namelen;
+	    }
+	  if (len + rlen < sizeof (line))
+	    {
+	      grub_memcpy (line + len, range, rlen);
+	      len += rlen;
+	    }
+	}
+      i = j;
+      if (!append_line (out, size, &used, line, len))
+	break;
+    }
+
+ out:
+  grub_free (sorted);
+}
+
+/* Where a piece of the profile file lives on disk.  */
+struct profile_block
+{
+  grub_disk_addr_t sector;
+  unsigned offset;
+  unsigned length;
+};
+
+/* Context for save_profile.  */
+struct save_ctx
+{
+  struct profile_block *blocks;
+  unsigned num, alloc;
+  int failed;
+};
+
+/* Helper for save_profile.  */
+static void
+save_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
+		void *data)
+{
+  struct save_ctx *ctx = data;
+
+  if (ctx->failed)
+    return;
+
+  if (ctx->num && ctx->blocks[ctx->num - 1].sector == sector)
+    {
+      ctx->failed = 1;
+      return;
+    }
+
+  if (ctx->num == ctx->alloc)
+    {
+      struct profile_block *n;
+
+      n = grub_realloc (ctx->blocks, 2 * ctx->alloc * sizeof (*n));
+      if (!n)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  ctx->failed = 1;
+	  return;
+	}
+      ctx->blocks = n;
+      ctx->alloc *= 2;
+    }
+  ctx->blocks[ctx->num].sector = sector;
+  ctx->blocks[ctx->num].offset = offset;
+  ctx->blocks[ctx->num].length = length;
+  ctx->num++;
+}
+
+/* Write the recording over the contents of the existing profile file,
+   in place, like save_env does with the environment block.  */
+static grub_err_t
+save_profile (const char *filename)
+{
+  struct save_ctx ctx = { .num = 0, .alloc = 8, .failed = 0 };
+  grub_disk_addr_t part_start;
+  grub_file_t file;
+  grub_disk_t disk;
+  char *old = NULL, *new = NULL;
+  grub_size_t index, size;
+  unsigned i;
+
+  file = open_profile (filename);
+  if (!file)
+    return grub_errno;
+
+  disk = file->device->disk;
+  if (!disk)
+    {
+      grub_file_close (file);
+      return grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
+    }
+
+  ctx.blocks = grub_malloc (ctx.alloc * sizeof (ctx.blocks[0]));
+  if (!ctx.blocks)
+    goto out;
+
+  file->read_hook = save_read_hook;
+  file->read_hook_data = &ctx;
+  old = read_profile (file);
+  file->read_hook = 0;
+  if (!old)
+    goto out;
+
+  size = grub_file_size (file);
+  for (i = 0, index = 0; i < ctx.num; i++)
+    index += ctx.blocks[i].length;
+  if (ctx.failed || index != size)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		  "prefetch profile must be a plain, preallocated file");
+      goto out;
+    }
+
+  new = grub_malloc (size);
+  if (!new)
+    goto out;
+  format_profile (new, size);
+
+  /* Spare the disk a write when nothing changed.  */
+  if (grub_memcmp (old, new, size) == 0)
+    goto out;
+
+  part_start = grub_partition_get_start (disk->partition);
+
+  /* Make sure the blocks really are the file before overwriting them.  */
+  for (i = 0, index = 0; i < ctx.num; index += ctx.blocks[i].length, i++)
+    {
+      char blockbuf[GRUB_DISK_SECTOR_SIZE];
+
+      if (grub_disk_read (disk, ctx.blocks[i].sector - part_start,
+			  ctx.blocks[i].offset, ctx.blocks[i].length,
+			  blockbuf))
+	goto out;
+      if (grub_memcmp (old + index, blockbuf, ctx.blocks[i].length) != 0)
+	{
+	  grub_error (GRUB_ERR_FILE_READ_ERROR, "invalid blocklist");
+	  goto out;
+	}
+    }
+
+  for (i = 0, index = 0; i < ctx.num; index += ctx.blocks[i].length, i++)
+    if (grub_disk_write (disk, ctx.blocks[i].sector - part_start,
+			 ctx.blocks[i].offset, ctx.blocks[i].length,
+			 new + index))
+      break;
+
+ out:
+  grub_free (new);
+  grub_free (old);
+  grub_free (ctx.blocks);
+  grub_file_close (file);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_cmd_prefetch (grub_extcmd_context_t ctxt,
+		   int argc __attribute__ ((unused)),
+		   char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  const char *filename = state[2].set ? state[2].arg : NULL;
+  grub_err_t err;
+
+  if (state[0].set && state[1].set)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       "--record and --save are mutually exclusive");
+
+  if (state[0].set)
+    {
+      grub_disk_read_record_hook = 0;
+      free_recording ();
+      chunks = grub_zalloc (PREFETCH_HASH_SIZE * sizeof (chunks[0]));
+      if (!chunks)
+	return grub_errno;
+      grub_disk_read_record_hook = record_read;
+      return GRUB_ERR_NONE;
+    }
+
+  if (state[1].set)
+    {
+      if (grub_disk_read_record_hook != record_read)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "not recording");
+      grub_disk_read_record_hook = 0;
+      err = save_profile (filename);
+      free_recording ();
+      return err;
+    }
+
+  return replay_profile (filename);
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(prefetch)
+{
+  cmd = grub_register_extcmd ("prefetch", grub_cmd_prefetch, 0,
+			      N_("[-r|-s] [-f FILE]"),
+			      N_("Prefetch the disk reads recorded in a profile,"
+				 " or record a new one."),
+			      options);
+}
+
+GRUB_MOD_FINI(prefetch)
+{
+  if (grub_disk_read_record_hook == record_read)
+    grub_disk_read_record_hook = 0;
+  free_recording ();
+  grub_unregister_extcmd (cmd);
+}
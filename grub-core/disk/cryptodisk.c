@@ -59,21 +59,19 @@ static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
 static grub_cryptodisk_t cryptodisk_list = NULL;
 static grub_uint8_t n = 0;
 
+/* G is a little-endian 128-bit number: double it as two 64-bit words.  */
 static void
 gf_mul_x (grub_uint8_t *g)
 {
-  int over = 0, over2 = 0;
-  unsigned j;
-
-  for (j = 0; j < GRUB_CRYPTODISK_GF_BYTES; j++)
-    {
-      over2 = !!(g[j] & 0x80);
-      g[j] <<= 1;
-      g[j] |= over;
-      over = over2;
-    }
-  if (over)
-    g[0] ^= GF_POLYNOM;
+  grub_uint64_t lo, hi, over;
+
+  lo = grub_le_to_cpu64 (grub_get_unaligned64 (g));
+  hi = grub_le_to_cpu64 (grub_get_unaligned64 (g + 8));
+  over = hi >> 63;
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (GF_POLYNOM & -over);
+  grub_set_unaligned64 (g, grub_cpu_to_le64 (lo));
+  grub_set_unaligned64 (g + 8, grub_cpu_to_le64 (hi));
 }
 
 
@@ -216,6 +214,186 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+/* Decrypt the CBC chain in DATA in place.  Going from the last block
+   to the first leaves the previous ciphertext block intact, so nothing
+   needs to be copied.  */
+static gcry_err_code_t
+cbc_decrypt_inplace (grub_crypto_cipher_handle_t cipher,
+		     grub_uint8_t *data, grub_size_t size,
+		     const grub_uint8_t *iv)
+{
+  grub_size_t bs = cipher->cipher->blocksize;
+  grub_uint8_t *ptr;
+
+  if (!cipher->cipher->decrypt)
+    return GPG_ERR_NOT_SUPPORTED;
+  for (ptr = data + size - bs; ptr > data; ptr -= bs)
+    {
+      cipher->cipher->decrypt (cipher->ctx, ptr, ptr);
+      grub_crypto_xor (ptr, ptr, ptr - bs, bs);
+    }
+  cipher->cipher->decrypt (cipher->ctx, data, data);
+  grub_crypto_xor (data, data, iv, bs);
+  return GPG_ERR_NO_ERROR;
+}
+
+/* Sectors whose IVs are computed together.  */
+#define BATCH_SECTORS 32
+/* XTS tweaks generated at once.  */
+#define BATCH_TWEAKS 32
+
+/* Check whether DEV can use grub_cryptodisk_endecrypt_batch.  */
+static int
+can_batch (const struct grub_cryptodisk *dev, grub_size_t len)
+{
+  if (dev->rekey
+      || dev->cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES
+      || (len & ((1U << dev->log_sector_size) - 1)))
+    return 0;
+  if (dev->mode != GRUB_CRYPTODISK_MODE_CBC
+      && dev->mode != GRUB_CRYPTODISK_MODE_XTS)
+    return 0;
+  switch (dev->mode_iv)
+    {
+    case GRUB_CRYPTODISK_MODE_IV_NULL:
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN:
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
+    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
+      return 1;
+    case GRUB_CRYPTODISK_MODE_IV_ESSIV:
+      return (dev->essiv_cipher->cipher->blocksize
+	      == GRUB_CRYPTODISK_GF_BYTES);
+    default:
+      return 0;
+    }
+}
+
+/* CBC and XTS with 16-byte blocks, e.g. aes-cbc-essiv and
+   aes-xts-plain64.  The IVs of up to BATCH_SECTORS sectors are built and
+   encrypted in one go and each sector is passed to the cipher in one
+   call, instead of paying the per-sector setup of
+   grub_cryptodisk_endecrypt.  Ciphers with bulk CBC or XTS functions
+   get the whole sector, others go through ECB.  */
+static gcry_err_code_t
+grub_cryptodisk_endecrypt_batch (struct grub_cryptodisk *dev,
+				 grub_uint8_t *data, grub_size_t len,
+				 grub_disk_addr_t sector, int do_encrypt)
+{
+  grub_uint32_t ivs[BATCH_SECTORS * GRUB_CRYPTODISK_GF_BYTES
+		    / sizeof (grub_uint32_t)];
+  grub_uint8_t tweaks[BATCH_TWEAKS * GRUB_CRYPTODISK_GF_BYTES];
+  grub_size_t sector_size = 1U << dev->log_sector_size;
+  grub_size_t count, i, j, k, chunk;
+  gcry_err_code_t err;
+
+  while (len)
+    {
+      count = len >> dev->log_sector_size;
+      if (count > BATCH_SECTORS)
+	count = BATCH_SECTORS;
+
+      grub_memset (ivs, 0, count * GRUB_CRYPTODISK_GF_BYTES);
+      for (i = 0; i < count; i++)
+	{
+	  grub_uint32_t *iv = ivs + i * (GRUB_CRYPTODISK_GF_BYTES
+					 / sizeof (grub_uint32_t));
+	  grub_disk_addr_t s = sector + i;
+
+	  switch (dev->mode_iv)
+	    {
+	    case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
+	      iv[1] = grub_cpu_to_le32 (s >> 32);
+	    case GRUB_CRYPTODISK_MODE_IV_PLAIN:
+	    case GRUB_CRYPTODISK_MODE_IV_ESSIV:
+	      iv[0] = grub_cpu_to_le32 (s & 0xFFFFFFFF);
+	      break;
+	    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
+	      iv[1] = grub_cpu_to_le32 (s >> (32 - dev->log_sector_size));
+	      iv[0] = grub_cpu_to_le32 ((s << dev->log_sector_size)
+					& 0xFFFFFFFF);
+	      break;
+	    default:
+	      break;
+	    }
+	}
+
+      if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_ESSIV)
+	{
+	  err = grub_crypto_ecb_encrypt (dev->essiv_cipher, ivs, ivs,
+					 count * GRUB_CRYPTODISK_GF_BYTES);
+	  if (err)
+	    return err;
+	}
+      if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
+	{
+	  err = grub_crypto_ecb_encrypt (dev->secondary_cipher, ivs, ivs,
+					 count * GRUB_CRYPTODISK_GF_BYTES);
+	  if (err)
+	    return err;
+	}
+
+      for (i = 0; i < count; i++, data += sector_size)
+	{
+	  grub_uint8_t *iv = (grub_uint8_t *) ivs
+	    + i * GRUB_CRYPTODISK_GF_BYTES;
+
+	  if (dev->mode == GRUB_CRYPTODISK_MODE_CBC)
+	    {
+	      if (do_encrypt)
+		err = grub_crypto_cbc_encrypt (dev->cipher, data, data,
+					       sector_size, iv);
+	      else if (dev->cipher->cipher->cbc_decrypt)
+		err = grub_crypto_cbc_decrypt (dev->cipher, data, data,
+					       sector_size, iv);
+	      else
+		err = cbc_decrypt_inplace (dev->cipher, data, sector_size, iv);
+	      if (err)
+		return err;
+	      continue;
+	    }
+
+	  if (dev->cipher->cipher->xts_crypt)
+	    {
+	      if (do_encrypt)
+		err = grub_crypto_xts_encrypt (dev->cipher, data, data,
+					       sector_size, iv);
+	      else
+		err = grub_crypto_xts_decrypt (dev->cipher, data, data,
+					       sector_size, iv);
+	      if (err)
+		return err;
+	      continue;
+	    }
+
+	  for (j = 0; j < sector_size; j += chunk)
+	    {
+	      chunk = sector_size - j;
+	      if (chunk > sizeof (tweaks))
+		chunk = sizeof (tweaks);
+	      for (k = 0; k < chunk; k += GRUB_CRYPTODISK_GF_BYTES)
+		{
+		  grub_memcpy (tweaks + k, iv, GRUB_CRYPTODISK_GF_BYTES);
+		  gf_mul_x (iv);
+		}
+	      grub_crypto_xor (data + j, data + j, tweaks, chunk);
+	      if (do_encrypt)
+		err = grub_crypto_ecb_encrypt (dev->cipher, data + j,
+					       data + j, chunk);
+	      else
+		err = grub_crypto_ecb_decrypt (dev->cipher, data + j,
+					       data + j, chunk);
+	      if (err)
+		return err;
+	      grub_crypto_xor (data + j, data + j, tweaks, chunk);
+	    }
+	}
+
+      sector += count;
+      len -= count << dev->log_sector_size;
+    }
+  return GPG_ERR_NO_ERROR;
+}
+
 static gcry_err_code_t
 grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 			   grub_uint8_t * data, grub_size_t len,
@@ -229,6 +407,10 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
     return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
 	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
 
+  if (can_batch (dev, len))
+    return grub_cryptodisk_endecrypt_batch (dev, data, len, sector,
+					    do_encrypt);
+
   for (i = 0; i < len; i += (1U << dev->log_sector_size))
     {
       grub_size_t sz = ((dev->cipher->cipher->blocksize
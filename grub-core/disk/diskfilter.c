@@ -36,9 +36,47 @@ static struct grub_diskfilter_vg *array_list;
 grub_raid5_recover_func_t grub_raid5_recover_func;
 grub_raid6_recover_func_t grub_raid6_recover_func;
 grub_diskfilter_t grub_diskfilter_list;
+unsigned int grub_diskfilter_generation;
 static int inscnt = 0;
 static int lv_num = 0;
 
+/* Disks whose whole device and partitions every registered diskfilter
+   has already probed.  Rescans triggered by lookups skip them, so each
+   disk is probed once rather than on every miss, including the
+   GRUB_DISK_PULL_RESCAN pass every failed lookup goes through.  The set
+   is forgotten when grub_diskfilter_generation or grub_disk_generation
+   change, i.e. when a diskfilter, disk driver, partition map or
+   loopback device comes or goes.  */
+#define SCANNED_HASH_SIZE 64
+
+struct scanned_disk
+{
+  struct scanned_disk *next;
+  char *name;
+};
+
+static struct scanned_disk *scanned_disks[SCANNED_HASH_SIZE];
+static unsigned int scanned_generation;
+static unsigned int scanned_disk_generation;
+
+/* Chunks of a degraded RAID4/5/6 that had to be reconstructed.  Reading
+   a chunk back needs every other chunk of its stripe, so sequential
+   reads within one stripe are served from here instead.  */
+#define STRIPE_CACHE_SIZE 4
+/* Larger chunks are reconstructed for each request.  */
+#define STRIPE_CACHE_MAX_SECTORS 2048
+
+static struct stripe_cache_entry
+{
+  struct grub_diskfilter_segment *seg;
+  grub_uint64_t disknr;
+  grub_disk_addr_t sector;
+  unsigned int stamp;
+  grub_size_t alloc;
+  char *data;
+} stripe_cache[STRIPE_CACHE_SIZE];
+static unsigned int stripe_cache_stamp;
+
 static struct grub_diskfilter_lv *
 find_lv (const char *name);
 static int is_lv_readable (struct grub_diskfilter_lv *lv, int easily);
@@ -179,6 +217,74 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
   return 0;
 }
 
+static void
+scanned_disks_clear (void)
+{
+  unsigned int i;
+
+  for (i = 0; i < SCANNED_HASH_SIZE; i++)
+    while (scanned_disks[i])
+      {
+	struct scanned_disk *next = scanned_disks[i]->next;
+	grub_free (scanned_disks[i]->name);
+	grub_free (scanned_disks[i]);
+	scanned_disks[i] = next;
+      }
+}
+
+static struct scanned_disk **
+scanned_disks_bucket (const char *name)
+{
+  unsigned int h = 0;
+
+  for (; *name; name++)
+    h = h * 31 + (grub_uint8_t) *name;
+  return &scanned_disks[h % SCANNED_HASH_SIZE];
+}
+
+static int
+disk_scanned (const char *name)
+{
+  struct scanned_disk *d;
+
+  if (scanned_generation != grub_diskfilter_generation
+      || scanned_disk_generation != grub_disk_generation)
+    {
+      scanned_disks_clear ();
+      scanned_generation = grub_diskfilter_generation;
+      scanned_disk_generation = grub_disk_generation;
+      return 0;
+    }
+
+  for (d = *scanned_disks_bucket (name); d; d = d->next)
+    if (grub_strcmp (d->name, name) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+mark_disk_scanned (const char *name)
+{
+  struct scanned_disk *d, **bucket;
+
+  d = grub_malloc (sizeof (*d));
+  if (!d)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  d->name = grub_strdup (name);
+  if (!d->name)
+    {
+      grub_free (d);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  bucket = scanned_disks_bucket (name);
+  d->next = *bucket;
+  *bucket = d;
+}
+
 static int
 scan_disk (const char *name, int accept_diskfilter)
 {
@@ -191,6 +297,9 @@ scan_disk (const char *name, int accept_diskfilter)
   if (scan_depth > 100)
     return 0;
 
+  if (disk_scanned (name))
+    return 0;
+
   scan_depth++;
   disk = grub_disk_open (name);
   if (!disk)
@@ -202,6 +311,7 @@ scan_disk (const char *name, int accept_diskfilter)
   scan_disk_partition_iter (disk, 0, (void *) name);
   grub_partition_iterate (disk, scan_disk_partition_iter, (void *) name);
   grub_disk_close (disk);
+  mark_disk_scanned (name);
   scan_depth--;
   return 0;
 }
@@ -503,6 +613,142 @@ grub_diskfilter_read_node (const struct grub_diskfilter_node *node,
   return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "unknown node '%s'", node->name);
 }
 
+/* Pick the mirror to read SECTOR from.  A mirror whose previous read
+   ended right at SECTOR continues its stream, otherwise the one whose
+   last position is closest is taken.  Interleaved streams thus keep to
+   separate disks.  */
+static unsigned int
+choose_mirror (const struct grub_diskfilter_segment *seg,
+	       grub_disk_addr_t sector)
+{
+  unsigned int i, best = 0;
+  grub_disk_addr_t best_dist = ~(grub_disk_addr_t) 0;
+
+  for (i = 0; i < seg->node_count; i++)
+    {
+      const struct grub_diskfilter_node *node = &seg->nodes[i];
+      grub_disk_addr_t dist;
+
+      if (node->pv && !node->pv->disk)
+	continue;
+      if (node->next_read == sector)
+	return i;
+      dist = (node->next_read > sector) ? node->next_read - sector
+	: sector - node->next_read;
+      if (dist < best_dist)
+	{
+	  best = i;
+	  best_dist = dist;
+	}
+    }
+  return best;
+}
+
+static grub_err_t
+recover_chunk (struct grub_diskfilter_segment *seg, grub_uint64_t disknr,
+	       grub_uint64_t p, char *buf, grub_disk_addr_t sector,
+	       grub_size_t size)
+{
+  if (seg->type == GRUB_DISKFILTER_RAID6)
+    return ((grub_raid6_recover_func) ?
+	    (*grub_raid6_recover_func) (seg, disknr, p, buf, sector, size) :
+	    grub_error (GRUB_ERR_BAD_DEVICE,
+			N_("module `%s' isn't loaded"),
+			"raid6rec"));
+
+  return ((grub_raid5_recover_func) ?
+	  (*grub_raid5_recover_func) (seg, disknr, buf, sector, size) :
+	  grub_error (GRUB_ERR_BAD_DEVICE,
+		      N_("module `%s' isn't loaded"),
+		      "raid5rec"));
+}
+
+/* Copy sectors B to B + SIZE of the reconstructed chunk of DISKNR at
+   SECTOR into BUF if it is cached.  */
+static int
+stripe_cache_read (struct grub_diskfilter_segment *seg, grub_uint64_t disknr,
+		   grub_disk_addr_t sector, grub_uint64_t b, grub_size_t size,
+		   char *buf)
+{
+  unsigned int i;
+
+  for (i = 0; i < STRIPE_CACHE_SIZE; i++)
+    if (stripe_cache[i].seg == seg && stripe_cache[i].disknr == disknr
+	&& stripe_cache[i].sector == sector)
+      {
+	grub_memcpy (buf, stripe_cache[i].data + (b << GRUB_DISK_SECTOR_BITS),
+		     size << GRUB_DISK_SECTOR_BITS);
+	stripe_cache[i].stamp = ++stripe_cache_stamp;
+	return 1;
+      }
+  return 0;
+}
+
+/* Reconstruct the whole chunk of DISKNR at SECTOR into the cache and
+   copy the requested part to BUF.  */
+static grub_err_t
+stripe_cache_recover (struct grub_diskfilter_segment *seg,
+		      grub_uint64_t disknr, grub_uint64_t p,
+		      grub_disk_addr_t sector, grub_uint64_t b,
+		      grub_size_t size, char *buf)
+{
+  struct stripe_cache_entry *ent = &stripe_cache[0];
+  grub_size_t chunk = (grub_size_t) seg->stripe_size << GRUB_DISK_SECTOR_BITS;
+  unsigned int i;
+  grub_err_t err;
+
+  if (seg->stripe_size > STRIPE_CACHE_MAX_SECTORS)
+    return recover_chunk (seg, disknr, p, buf, sector + b, size);
+
+  for (i = 1; i < STRIPE_CACHE_SIZE; i++)
+    if (stripe_cache[i].stamp < ent->stamp)
+      ent = &stripe_cache[i];
+
+  ent->seg = NULL;
+  if (ent->alloc < chunk)
+    {
+      grub_free (ent->data);
+      ent->alloc = 0;
+      ent->data = grub_malloc (chunk);
+      if (!ent->data)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return recover_chunk (seg, disknr, p, buf, sector + b, size);
+	}
+      ent->alloc = chunk;
+    }
+
+  /* The last chunk of a member may be short.  */
+  err = recover_chunk (seg, disknr, p, ent->data, sector, seg->stripe_size);
+  if (err)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return recover_chunk (seg, disknr, p, buf, sector + b, size);
+    }
+
+  ent->seg = seg;
+  ent->disknr = disknr;
+  ent->sector = sector;
+  ent->stamp = ++stripe_cache_stamp;
+  grub_memcpy (buf, ent->data + (b << GRUB_DISK_SECTOR_BITS),
+	       size << GRUB_DISK_SECTOR_BITS);
+  return GRUB_ERR_NONE;
+}
+
+static void
+stripe_cache_free (void)
+{
+  unsigned int i;
+
+  for (i = 0; i < STRIPE_CACHE_SIZE; i++)
+    {
+      grub_free (stripe_cache[i].data);
+      stripe_cache[i].data = NULL;
+      stripe_cache[i].alloc = 0;
+      stripe_cache[i].seg = NULL;
+    }
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -514,7 +760,7 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
       if (seg->node_count == 1)
 	return grub_diskfilter_read_node (&seg->nodes[0],
 					  sector, size, buf);
-    case GRUB_DISKFILTER_MIRROR:
+      /* Fallthrough.  */
     case GRUB_DISKFILTER_RAID10:
       {
 	grub_disk_addr_t read_sector, far_ofs;
@@ -525,9 +771,7 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	far = ofs = near = 1;
 	far_ofs = 0;
 
-	if (seg->type == 1)
-	  near = seg->node_count;
-	else if (seg->type == 10)
+	if (seg->type == 10)
 	  {
 	    near = seg->layout & 0xFF;
 	    far = (seg->layout >> 8) & 0xFF;
@@ -615,6 +859,35 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	  }
       }
 
+    case GRUB_DISKFILTER_MIRROR:
+      {
+	unsigned int i, k;
+
+	k = choose_mirror (seg, sector);
+	err = GRUB_ERR_NONE;
+	for (i = 0; i < seg->node_count; i++)
+	  {
+	    if (grub_errno == GRUB_ERR_READ_ERROR
+		|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+	      grub_errno = GRUB_ERR_NONE;
+
+	    err = grub_diskfilter_read_node (&seg->nodes[k], sector,
+					     size, buf);
+	    if (! err)
+	      {
+		seg->nodes[k].next_read = sector + size;
+		return GRUB_ERR_NONE;
+	      }
+	    if (err != GRUB_ERR_READ_ERROR
+		&& err != GRUB_ERR_UNKNOWN_DEVICE)
+	      return err;
+	    k++;
+	    if (k == seg->node_count)
+	      k = 0;
+	  }
+	return err;
+      }
+
     case GRUB_DISKFILTER_RAID4:
     case GRUB_DISKFILTER_RAID5:
     case GRUB_DISKFILTER_RAID6:
@@ -676,10 +949,14 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 		|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
 	      grub_errno = GRUB_ERR_NONE;
 
-	    err = grub_diskfilter_read_node (&seg->nodes[disknr],
-					     read_sector + b,
-					     read_size,
-					     buf);
+	    if (stripe_cache_read (seg, disknr, read_sector, b, read_size,
+				   buf))
+	      err = GRUB_ERR_NONE;
+	    else
+	      err = grub_diskfilter_read_node (&seg->nodes[disknr],
+					       read_sector + b,
+					       read_size,
+					       buf);
 
 	    if ((err) && (err != GRUB_ERR_READ_ERROR
 			  && err != GRUB_ERR_UNKNOWN_DEVICE))
@@ -689,27 +966,8 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	    if (err)
 	      {
 		grub_errno = GRUB_ERR_NONE;
-		if (seg->type == GRUB_DISKFILTER_RAID6)
-		  {
-		    err = ((grub_raid6_recover_func) ?
-			   (*grub_raid6_recover_func) (seg, disknr, p,
-						       buf, read_sector + b,
-						       read_size) :
-			   grub_error (GRUB_ERR_BAD_DEVICE,
-				       N_("module `%s' isn't loaded"),
-				       "raid6rec"));
-		  }
-		else
-		  {
-		    err = ((grub_raid5_recover_func) ?
-			   (*grub_raid5_recover_func) (seg, disknr,
-						       buf, read_sector + b,
-						       read_size) :
-			   grub_error (GRUB_ERR_BAD_DEVICE,
-				       N_("module `%s' isn't loaded"),
-				       "raid5rec"));
-		  }
-
+		err = stripe_cache_recover (seg, disknr, p, read_sector, b,
+					    read_size, buf);
 		if (err)
 		  return err;
 	      }
@@ -1118,6 +1376,9 @@ insert_array (grub_disk_t disk, const struct grub_diskfilter_pv_id *id,
 static void
 free_array (void)
 {
+  stripe_cache_free ();
+  scanned_disks_clear ();
+
   while (array_list)
     {
       struct grub_diskfilter_vg *vg;
@@ -20,21 +20,39 @@
 #include <grub/dl.h>
 #include <grub/misc.h>
 #include <grub/file.h>
+#include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/mm.h>
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Upper bound on the number of extents remembered per device.  */
+#define LOOPBACK_MAX_EXTENTS	1024
+
+/* A run of file sectors stored contiguously on the disk holding the
+   file.  DISK_SECTOR is relative to the file's partition.  */
+struct grub_loopback_extent
+{
+  grub_disk_addr_t file_sector;
+  grub_disk_addr_t disk_sector;
+  grub_disk_addr_t count;
+};
+
 struct grub_loopback
 {
   char *devname;
   grub_file_t file;
+  unsigned long id;
+  struct grub_loopback_extent *extents;
+  unsigned num_extents;
   struct grub_loopback *next;
 };
 
 static struct grub_loopback *loopback_list;
+static unsigned long last_id = 0;
 
 static const struct grub_arg_option options[] =
   {
@@ -66,8 +84,12 @@ delete_loopback (const char *name)
 
   grub_free (dev->devname);
   grub_file_close (dev->file);
+  grub_free (dev->extents);
   grub_free (dev);
 
+  grub_fs_probe_invalidate ();
+  grub_disk_generation++;
+
   return 0;
 }
 
@@ -103,6 +125,14 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
     {
       grub_file_close (newdev->file);
       newdev->file = file;
+      /* A new disk as far as everything keyed on the disk id goes.  */
+      newdev->id = last_id++;
+      grub_free (newdev->extents);
+      newdev->extents = NULL;
+      newdev->num_extents = 0;
+
+      grub_fs_probe_invalidate ();
+      grub_disk_generation++;
 
       return 0;
     }
@@ -120,11 +150,17 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
     }
 
   newdev->file = file;
+  newdev->id = last_id++;
+  newdev->extents = NULL;
+  newdev->num_extents = 0;
 
   /* Add the new entry to the list.  */
   newdev->next = loopback_list;
   loopback_list = newdev;
 
+  grub_fs_probe_invalidate ();
+  grub_disk_generation++;
+
   return 0;
 
 fail:
@@ -167,23 +203,269 @@ grub_loopback_open (const char *name, grub_disk_t disk)
 			   / GRUB_DISK_SECTOR_SIZE);
   else
     disk->total_sectors = GRUB_DISK_SIZE_UNKNOWN;
-  disk->id = (unsigned long) dev;
+  disk->id = dev->id;
 
   disk->data = dev;
 
   return 0;
 }
 
+/* Return the extent of DEV containing file sector SECTOR, if any.  */
+static struct grub_loopback_extent *
+find_extent (struct grub_loopback *dev, grub_disk_addr_t sector)
+{
+  unsigned lo = 0, hi = dev->num_extents;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      struct grub_loopback_extent *e = &dev->extents[mid];
+
+      if (sector < e->file_sector)
+	hi = mid;
+      else if (sector >= e->file_sector + e->count)
+	lo = mid + 1;
+      else
+	return e;
+    }
+  return NULL;
+}
+
+/* Whether all of SIZE sectors from SECTOR are covered by known extents.  */
+static int
+extents_cover (struct grub_loopback *dev, grub_disk_addr_t sector,
+	       grub_size_t size)
+{
+  while (size)
+    {
+      struct grub_loopback_extent *e = find_extent (dev, sector);
+      grub_disk_addr_t n;
+
+      if (!e)
+	return 0;
+      n = e->file_sector + e->count - sector;
+      if (n >= size)
+	return 1;
+      sector += n;
+      size -= n;
+    }
+  return 1;
+}
+
+/* Remember that file sectors [FILE_SECTOR, FILE_SECTOR + COUNT) live at
+   DISK_SECTOR, merging with neighbouring extents where possible.  */
+static void
+add_extent (struct grub_loopback *dev, grub_disk_addr_t file_sector,
+	    grub_disk_addr_t disk_sector, grub_disk_addr_t count)
+{
+  struct grub_loopback_extent *e;
+  unsigned i, j;
+
+  if (!dev->extents)
+    {
+      dev->extents = grub_malloc (LOOPBACK_MAX_EXTENTS
+				  * sizeof (dev->extents[0]));
+      if (!dev->extents)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+    }
+
+  for (i = 0; i < dev->num_extents
+	 && dev->extents[i].file_sector < file_sector; i++);
+
+  /* Extend the previous extent.  */
+  if (i > 0)
+    {
+      e = &dev->extents[i - 1];
+      if (e->file_sector + e->count >= file_sector
+	  && e->disk_sector - e->file_sector == disk_sector - file_sector)
+	{
+	  if (e->file_sector + e->count < file_sector + count)
+	    e->count = file_sector + count - e->file_sector;
+	  i--;
+	  goto absorb;
+	}
+    }
+
+  if (dev->num_extents == LOOPBACK_MAX_EXTENTS)
+    return;
+  grub_memmove (&dev->extents[i + 1], &dev->extents[i],
+		(dev->num_extents - i) * sizeof (dev->extents[0]));
+  dev->num_extents++;
+  e = &dev->extents[i];
+  e->file_sector = file_sector;
+  e->disk_sector = disk_sector;
+  e->count = count;
+
+ absorb:
+  /* Swallow the following extents that the new one now reaches.  */
+  e = &dev->extents[i];
+  for (j = i + 1; j < dev->num_extents
+	 && dev->extents[j].file_sector <= e->file_sector + e->count
+	 && (dev->extents[j].disk_sector - dev->extents[j].file_sector
+	     == e->disk_sector - e->file_sector); j++)
+    if (e->file_sector + e->count
+	< dev->extents[j].file_sector + dev->extents[j].count)
+      e->count = (dev->extents[j].file_sector + dev->extents[j].count
+		  - e->file_sector);
+  if (j > i + 1)
+    {
+      grub_memmove (&dev->extents[i + 1], &dev->extents[j],
+		    (dev->num_extents - j) * sizeof (dev->extents[0]));
+      dev->num_extents -= j - i - 1;
+    }
+}
+
+#define LOOPBACK_MAX_RUNS	64
+
+/* Context for grub_loopback_read.  */
+struct learn_ctx
+{
+  grub_disk_addr_t part_start;
+  /* Number of file sectors accounted for so far.  */
+  grub_size_t nsectors;
+  unsigned nruns;
+  struct
+  {
+    grub_size_t file_sector;
+    grub_disk_addr_t disk_sector;
+    grub_size_t count;
+  } runs[LOOPBACK_MAX_RUNS];
+  int failed;
+};
+
+/* Helper for grub_loopback_read.  */
+static void
+learn_extent (grub_disk_addr_t sector, unsigned offset, unsigned length,
+	      void *data)
+{
+  struct learn_ctx *ctx = data;
+
+  if (ctx->failed)
+    return;
+
+  /* Only whole sectors map one to one.  */
+  if (offset != 0 || length != GRUB_DISK_SECTOR_SIZE
+      || sector < ctx->part_start)
+    {
+      ctx->failed = 1;
+      return;
+    }
+  sector -= ctx->part_start;
+
+  if (ctx->nruns
+      && (ctx->runs[ctx->nruns - 1].disk_sector
+	  + ctx->runs[ctx->nruns - 1].count) == sector)
+    ctx->runs[ctx->nruns - 1].count++;
+  else if (ctx->nruns == LOOPBACK_MAX_RUNS)
+    {
+      ctx->failed = 1;
+      return;
+    }
+  else
+    {
+      ctx->runs[ctx->nruns].file_sector = ctx->nsectors;
+      ctx->runs[ctx->nruns].disk_sector = sector;
+      ctx->runs[ctx->nruns].count = 1;
+      ctx->nruns++;
+    }
+  ctx->nsectors++;
+}
+
+/* Check that the runs in CTX really hold the SIZE sectors in BUF and
+   remember them as extents starting at file sector SECTOR.  */
+static void
+learn_extents (struct grub_loopback *dev, grub_disk_addr_t sector,
+	       grub_size_t size, const char *buf, struct learn_ctx *ctx)
+{
+  grub_disk_t disk = dev->file->device->disk;
+  char *tmp;
+  unsigned i;
+
+  /* Sparse, compressed or cached data don't show up as one read per
+     file sector.  */
+  if (ctx->failed || ctx->nsectors != size)
+    return;
+
+  tmp = grub_malloc (size << GRUB_DISK_SECTOR_BITS);
+  if (!tmp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  /* The sectors were just read, so this is served by the disk cache.  */
+  for (i = 0; i < ctx->nruns; i++)
+    if (grub_disk_read (disk, ctx->runs[i].disk_sector, 0,
+			ctx->runs[i].count << GRUB_DISK_SECTOR_BITS,
+			tmp + (ctx->runs[i].file_sector
+			       << GRUB_DISK_SECTOR_BITS)))
+      {
+	grub_errno = GRUB_ERR_NONE;
+	grub_free (tmp);
+	return;
+      }
+
+  if (grub_memcmp (tmp, buf, size << GRUB_DISK_SECTOR_BITS) == 0)
+    for (i = 0; i < ctx->nruns; i++)
+      add_extent (dev, sector + ctx->runs[i].file_sector,
+		  ctx->runs[i].disk_sector, ctx->runs[i].count);
+
+  grub_free (tmp);
+}
+
 static grub_err_t
 grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+  struct grub_loopback *dev = disk->data;
+  grub_file_t file = dev->file;
+  struct learn_ctx ctx;
+  grub_disk_t fdisk = file->device->disk;
   grub_off_t pos;
 
+  /* Sectors whose location on the underlying disk is known are read from
+     there directly, bypassing the filesystem.  */
+  if (fdisk && extents_cover (dev, sector, size))
+    {
+      while (size)
+	{
+	  struct grub_loopback_extent *e = find_extent (dev, sector);
+	  grub_size_t n = e->file_sector + e->count - sector;
+
+	  if (n > size)
+	    n = size;
+	  if (grub_disk_read (fdisk, e->disk_sector + (sector - e->file_sector),
+			      0, n << GRUB_DISK_SECTOR_BITS, buf))
+	    return grub_errno;
+	  sector += n;
+	  size -= n;
+	  buf += n << GRUB_DISK_SECTOR_BITS;
+	}
+      return 0;
+    }
+
   grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
 
-  grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
+  if (fdisk && !file->read_hook)
+    {
+      ctx.part_start = grub_partition_get_start (fdisk->partition);
+      ctx.nsectors = 0;
+      ctx.nruns = 0;
+      ctx.failed = 0;
+      file->read_hook = learn_extent;
+      file->read_hook_data = &ctx;
+      grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
+      file->read_hook = 0;
+      file->read_hook_data = 0;
+      if (grub_errno)
+	return grub_errno;
+      learn_extents (dev, sector, size, buf, &ctx);
+    }
+  else
+    grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
   if (grub_errno)
     return grub_errno;
 
@@ -24,6 +24,9 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/crypto.h>
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -33,16 +36,135 @@ static grub_uint8_t powx[255 * 2];
 static int powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+#if defined (__i386__) || defined (__x86_64__)
+#ifdef __SSE__
+# define SSE_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm5", "xmm6", "xmm7"
+#else
+# define SSE_CLOBBERS "cc", "memory"
+#endif
+
+/* Multiply every byte of BUF by the constant whose products with the
+   low and the high nibble are in TABLES[0..15] and TABLES[16..31],
+   16 bytes at a time with PSHUFB.  SIZE has to be a non-zero multiple
+   of 16.  */
 static void
-grub_raid_block_mulx (int mul, char *buf, int size)
+mulx_ssse3 (const grub_uint8_t *tables, char *buf, grub_size_t size)
 {
-  int i;
+  static const grub_uint8_t mask[16] =
+    { 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+      0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f };
+
+  asm volatile ("movdqu (%[tables]), %%xmm5\n\t"
+		"movdqu 16(%[tables]), %%xmm6\n\t"
+		"movdqu (%[mask]), %%xmm7\n\t"
+		"1:\n\t"
+		"movdqu (%[buf]), %%xmm0\n\t"
+		"movdqa %%xmm0, %%xmm1\n\t"
+		"psrlw $4, %%xmm1\n\t"
+		"pand %%xmm7, %%xmm0\n\t"
+		"pand %%xmm7, %%xmm1\n\t"
+		"movdqa %%xmm5, %%xmm2\n\t"
+		"movdqa %%xmm6, %%xmm3\n\t"
+		"pshufb %%xmm0, %%xmm2\n\t"
+		"pshufb %%xmm1, %%xmm3\n\t"
+		"pxor %%xmm3, %%xmm2\n\t"
+		"movdqu %%xmm2, (%[buf])\n\t"
+		"add $16, %[buf]\n\t"
+		"sub $16, %[size]\n\t"
+		"jnz 1b\n\t"
+		: [buf] "+r" (buf), [size] "+r" (size)
+		: [tables] "r" (tables), [mask] "r" (mask)
+		: SSE_CLOBBERS);
+}
+
+/* Multiply every byte of BUF by x, 16 bytes at a time.  SIZE has to be
+   a non-zero multiple of 16.  */
+static void
+mul2_sse2 (char *buf, grub_size_t size)
+{
+  static const grub_uint8_t polys[16] =
+    { 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d,
+      0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d };
+
+  asm volatile ("movdqu (%[polys]), %%xmm7\n\t"
+		"1:\n\t"
+		"movdqu (%[buf]), %%xmm0\n\t"
+		/* 0xff in every byte with the top bit set.  */
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pcmpgtb %%xmm0, %%xmm1\n\t"
+		"paddb %%xmm0, %%xmm0\n\t"
+		"pand %%xmm7, %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[buf])\n\t"
+		"add $16, %[buf]\n\t"
+		"sub $16, %[size]\n\t"
+		"jnz 1b\n\t"
+		: [buf] "+r" (buf), [size] "+r" (size)
+		: [polys] "r" (polys)
+		: SSE_CLOBBERS);
+}
+#endif
+
+/* Multiply every byte of BUF by x**MUL.  */
+static void
+grub_raid_block_mulx (int mul, char *buf, grub_size_t size)
+{
+  grub_uint8_t table[256];
   grub_uint8_t *p;
+  int i;
+
+  mul %= 255;
+  table[0] = 0;
+  for (i = 1; i < 256; i++)
+    table[i] = powx[mul + powx_inv[i]];
+
+#if defined (__i386__) || defined (__x86_64__)
+  if ((grub_cpu_sse_features () & GRUB_CPU_SSSE3) && size
+      && size % 16 == 0)
+    {
+      grub_uint8_t tables[32];
+
+      /* Multiplication distributes over the XOR of the two nibbles.  */
+      for (i = 0; i < 16; i++)
+	{
+	  tables[i] = table[i];
+	  tables[i + 16] = table[i << 4];
+	}
+      mulx_ssse3 (tables, buf, size);
+      return;
+    }
+#endif
 
   p = (grub_uint8_t *) buf;
-  for (i = 0; i < size; i++, p++)
-    if (*p)
-      *p = powx[mul + powx_inv[*p]];
+  for (; size; size--, p++)
+    *p = table[*p];
+}
+
+/* Multiply every byte of BUF by x, a word at a time.  BUF has to be
+   word-aligned and SIZE a multiple of the word size.  */
+static void
+grub_raid_block_mul2 (char *buf, grub_size_t size)
+{
+  const unsigned long ones = ~0UL / 0xff;
+  unsigned long *p = (unsigned long *) buf;
+
+#if defined (__i386__) || defined (__x86_64__)
+  if ((grub_cpu_sse_features () & GRUB_CPU_SSE2) && size
+      && size % 16 == 0)
+    {
+      mul2_sse2 (buf, size);
+      return;
+    }
+#endif
+
+  for (; size; size -= sizeof (*p), p++)
+    {
+      unsigned long v = *p;
+      unsigned long carry = (v >> 7) & ones;
+
+      *p = ((v & (ones * 0x7f)) << 1) ^ (carry * poly);
+    }
 }
 
 static void
@@ -67,9 +189,16 @@ static grub_err_t
 grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
                     char *buf, grub_disk_addr_t sector, grub_size_t size)
 {
-  int i, q, pos;
+  int i, q, pos, c;
   int bad1 = -1, bad2 = -1;
   char *pbuf = 0, *qbuf = 0;
+  int *disk_of;
+
+  disk_of = grub_malloc (array->node_count * sizeof (disk_of[0]));
+  if (!disk_of)
+    return grub_errno;
+  for (i = 0; i < (int) array->node_count; i++)
+    disk_of[i] = -1;
 
   size <<= GRUB_DISK_SECTOR_BITS;
   pbuf = grub_zalloc (size);
@@ -90,32 +219,13 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
 
   for (i = 0; i < (int) array->node_count - 2; i++)
     {
-      int c;
       if (array->layout & GRUB_RAID_LAYOUT_MUL_FROM_POS)
 	c = pos;
       else
 	c = i;
+      disk_of[c] = pos;
       if (pos == disknr)
         bad1 = c;
-      else
-        {
-          if (! grub_diskfilter_read_node (&array->nodes[pos], sector,
-					   size >> GRUB_DISK_SECTOR_BITS, buf))
-            {
-              grub_crypto_xor (pbuf, pbuf, buf, size);
-              grub_raid_block_mulx (c, buf, size);
-              grub_crypto_xor (qbuf, qbuf, buf, size);
-            }
-          else
-            {
-              /* Too many bad devices */
-              if (bad2 >= 0)
-                goto quit;
-
-              bad2 = c;
-              grub_errno = GRUB_ERR_NONE;
-            }
-        }
 
       pos++;
       if (pos == (int) array->node_count)
@@ -126,6 +236,32 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   if (bad1 < 0)
     goto quit;
 
+  /* Evaluate the Q syndrome by Horner's rule, highest coefficient
+     first, so that only multiplications by x are needed.  */
+  for (c = (int) array->node_count - 1; c >= 0; c--)
+    {
+      grub_raid_block_mul2 (qbuf, size);
+
+      if (disk_of[c] < 0 || c == bad1)
+	continue;
+
+      if (! grub_diskfilter_read_node (&array->nodes[disk_of[c]], sector,
+				       size >> GRUB_DISK_SECTOR_BITS, buf))
+	{
+	  grub_crypto_xor (pbuf, pbuf, buf, size);
+	  grub_crypto_xor (qbuf, qbuf, buf, size);
+	}
+      else
+	{
+	  /* Too many bad devices */
+	  if (bad2 >= 0)
+	    goto quit;
+
+	  bad2 = c;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
   if (bad2 < 0)
     {
       /* One bad device */
@@ -148,8 +284,6 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   else
     {
       /* Two bad devices */
-      int c;
-
       if (grub_diskfilter_read_node (&array->nodes[p], sector,
 				     size >> GRUB_DISK_SECTOR_BITS, buf))
         goto quit;
@@ -173,6 +307,7 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
     }
 
 quit:
+  grub_free (disk_of);
   grub_free (pbuf);
   grub_free (qbuf);
 
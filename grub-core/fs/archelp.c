@@ -21,9 +21,43 @@
 #include <grub/fs.h>
 #include <grub/disk.h>
 #include <grub/dl.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* How many archives to keep an index for.  */
+#define ARCHELP_MAX_INDEXES 4
+
+struct archelp_entry
+{
+  char *name;
+  grub_off_t hofs;
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+  /* Next entry with the same hash, or -1.  */
+  int hash_next;
+};
+
+/* All entries of one archive, in archive order.  */
+struct archelp_index
+{
+  struct archelp_index *next;
+
+  struct grub_archelp_ops *arcops;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_disk_addr_t size;
+
+  int num_entries;
+  int alloc_entries;
+  struct archelp_entry *entries;
+  int hash_size;
+  int *hash;
+};
+
+static struct archelp_index *indexes;
+
 static inline void
 canonicalize (char *name)
 {
@@ -54,6 +88,225 @@ canonicalize (char *name)
   *optr = 0;
 }
 
+static unsigned
+hash_name (const char *name, int len)
+{
+  unsigned h = 0;
+
+  for (; len; len--)
+    h = h * 31 + (grub_uint8_t) *name++;
+  return h;
+}
+
+static void
+free_index (struct archelp_index *index)
+{
+  int i;
+
+  for (i = 0; i < index->num_entries; i++)
+    grub_free (index->entries[i].name);
+  grub_free (index->entries);
+  grub_free (index->hash);
+  grub_free (index);
+}
+
+static void
+drop_index (struct archelp_index *index)
+{
+  struct archelp_index **p;
+
+  for (p = &indexes; *p; p = &(*p)->next)
+    if (*p == index)
+      {
+	*p = index->next;
+	free_index (index);
+	return;
+      }
+}
+
+/* Scan the whole archive once and record where every entry is.  */
+static struct archelp_index *
+build_index (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *index;
+  int i;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return 0;
+
+  arcops->rewind (data);
+  while (1)
+    {
+      struct archelp_entry *entry;
+      grub_off_t hofs;
+      grub_int32_t mtime;
+      grub_uint32_t mode;
+      char *name;
+
+      hofs = arcops->tell (data);
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+
+      if (index->num_entries == index->alloc_entries)
+	{
+	  struct archelp_entry *tmp;
+	  int alloc = index->alloc_entries ? 2 * index->alloc_entries : 64;
+
+	  tmp = grub_realloc (index->entries, alloc * sizeof (*tmp));
+	  if (!tmp)
+	    {
+	      grub_free (name);
+	      goto fail;
+	    }
+	  index->entries = tmp;
+	  index->alloc_entries = alloc;
+	}
+      canonicalize (name);
+      entry = &index->entries[index->num_entries++];
+      entry->name = name;
+      entry->hofs = hofs;
+      entry->mtime = mtime;
+      entry->mode = mode;
+    }
+
+  for (index->hash_size = 16; index->hash_size < index->num_entries;
+       index->hash_size <<= 1);
+  index->hash = grub_malloc (index->hash_size * sizeof (index->hash[0]));
+  if (!index->hash)
+    goto fail;
+  for (i = 0; i < index->hash_size; i++)
+    index->hash[i] = -1;
+  /* Insert backwards so that the first of duplicate names is found
+     first, like a linear scan would.  */
+  for (i = index->num_entries - 1; i >= 0; i--)
+    {
+      struct archelp_entry *entry = &index->entries[i];
+      unsigned h = hash_name (entry->name, grub_strlen (entry->name))
+	& (index->hash_size - 1);
+
+      entry->hash_next = index->hash[h];
+      index->hash[h] = i;
+    }
+
+  return index;
+
+ fail:
+  free_index (index);
+  return 0;
+}
+
+/* Read the header of ENTRY again, so that DATA describes it.  Return
+   1 if the archive doesn't match the index anymore.  */
+static int
+load_entry (struct grub_archelp_data *data,
+	    struct grub_archelp_ops *arcops,
+	    struct archelp_entry *entry)
+{
+  grub_uint32_t mode;
+  char *name;
+  int stale;
+
+  arcops->seek (data, entry->hofs);
+  if (arcops->find_file (data, &name, NULL, &mode))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1;
+    }
+  if (mode == GRUB_ARCHELP_ATTR_END)
+    return 1;
+  canonicalize (name);
+  stale = (mode != entry->mode || grub_strcmp (name, entry->name) != 0);
+  grub_free (name);
+  return stale;
+}
+
+/* Return the index of the archive DATA is on, building it if
+   necessary.  NULL means the archive has to be scanned linearly.  A
+   kept index is only checked against the first header; entries found
+   not to match later make the caller drop it.  */
+static struct archelp_index *
+get_index (struct grub_archelp_data *data,
+	   struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *index, **p;
+  grub_disk_t disk;
+  grub_disk_addr_t start, size;
+  int n;
+
+  if (!arcops->tell || !arcops->seek || !arcops->get_disk)
+    return 0;
+
+  disk = arcops->get_disk (data);
+  start = disk->partition ? grub_partition_get_start (disk->partition) : 0;
+  size = grub_disk_get_size (disk);
+
+  for (p = &indexes; *p; p = &(*p)->next)
+    {
+      index = *p;
+      if (index->arcops == arcops && index->dev_id == disk->dev->id
+	  && index->disk_id == disk->id && index->start == start
+	  && index->size == size)
+	{
+	  if (!index->num_entries
+	      || load_entry (data, arcops, &index->entries[0]))
+	    {
+	      *p = index->next;
+	      free_index (index);
+	      arcops->rewind (data);
+	      break;
+	    }
+
+	  /* Move to the front.  */
+	  *p = index->next;
+	  index->next = indexes;
+	  indexes = index;
+	  return index;
+	}
+    }
+
+  index = build_index (data, arcops);
+  if (!index)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      arcops->rewind (data);
+      return 0;
+    }
+  index->arcops = arcops;
+  index->dev_id = disk->dev->id;
+  index->disk_id = disk->id;
+  index->start = start;
+  index->size = size;
+
+  index->next = indexes;
+  indexes = index;
+  for (n = 1, p = &indexes->next; *p; p = &(*p)->next, n++)
+    if (n == ARCHELP_MAX_INDEXES)
+      {
+	free_index (*p);
+	*p = 0;
+	break;
+      }
+
+  return index;
+}
+
+static struct archelp_entry *
+lookup_entry (struct archelp_index *index, const char *name, int len)
+{
+  int i;
+
+  for (i = index->hash[hash_name (name, len) & (index->hash_size - 1)];
+       i >= 0; i = index->entries[i].hash_next)
+    if (grub_strncmp (index->entries[i].name, name, len) == 0
+	&& index->entries[i].name[len] == 0)
+      return &index->entries[i];
+  return 0;
+}
+
 static grub_err_t
 handle_symlink (struct grub_archelp_data *data,
 		struct grub_archelp_ops *arcops,
@@ -140,6 +393,11 @@ grub_archelp_dir (struct grub_archelp_data *data,
   char *prev, *name, *path, *ptr;
   grub_size_t len;
   int symlinknest = 0;
+  struct archelp_index *index;
+  int pos = 0;
+  int emitted = 0;
+
+  index = get_index (data, arcops);
 
   path = grub_strdup (path_in + 1);
   if (!path)
@@ -157,13 +415,49 @@ grub_archelp_dir (struct grub_archelp_data *data,
       grub_uint32_t mode;
       grub_err_t err;
 
-      if (arcops->find_file (data, &name, &mtime, &mode))
-	goto fail;
+      if (index)
+	{
+	  struct archelp_entry *entry;
+
+	  if (pos == index->num_entries)
+	    break;
+	  entry = &index->entries[pos++];
+	  mtime = entry->mtime;
+	  mode = entry->mode;
+	  /* get_link_target needs the header.  */
+	  if ((mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_LNK
+	      && load_entry (data, arcops, entry))
+	    {
+	      /* The archive changed.  What was listed so far came from the
+		 old one and can't be mixed with a scan of the new one.  */
+	      drop_index (index);
+	      index = 0;
+	      if (emitted)
+		{
+		  grub_error (GRUB_ERR_BAD_FS,
+			      "archive changed while listing it");
+		  goto fail;
+		}
+	      arcops->rewind (data);
+	      grub_free (prev);
+	      prev = 0;
+	      pos = 0;
+	      continue;
+	    }
+	  name = grub_strdup (entry->name);
+	  if (!name)
+	    goto fail;
+	}
+      else
+	{
+	  if (arcops->find_file (data, &name, &mtime, &mode))
+	    goto fail;
 
-      if (mode == GRUB_ARCHELP_ATTR_END)
-	break;
+	  if (mode == GRUB_ARCHELP_ATTR_END)
+	    break;
 
-      canonicalize (name);
+	  canonicalize (name);
+	}
 
       if (grub_memcmp (path, name, len) == 0
 	  && (name[len] == 0 || name[len] == '/' || len == 0))
@@ -189,6 +483,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 		  info.mtime = mtime;
 		  info.mtimeset = 1;
 		}
+	      emitted = 1;
 	      if (hook (n, &info, hook_data))
 		{
 		  grub_free (name);
@@ -215,6 +510,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 		      goto fail;
 		    }
 		  arcops->rewind (data);
+		  pos = 0;
 		}
 	    }
 	}
@@ -230,6 +526,69 @@ fail:
   return grub_errno;
 }
 
+/* Look NAME up in INDEX, resolving symlinks on the way.  Return 1 if
+   the index turned out to be stale and the archive needs to be
+   scanned.  */
+static int
+open_indexed (struct grub_archelp_data *data,
+	      struct grub_archelp_ops *arcops,
+	      struct archelp_index *index,
+	      char **name, const char *name_in)
+{
+  struct archelp_entry *entry;
+  int symlinknest = 0;
+  char *ptr;
+
+ restart:
+  /* A symlink may stand for any leading part of the name.  */
+  for (ptr = *name; ; ptr++)
+    {
+      int restart;
+      grub_err_t err;
+      char *fn;
+
+      if (*ptr != '/' && *ptr != 0)
+	continue;
+
+      entry = lookup_entry (index, *name, ptr - *name);
+      if (entry && ((entry->mode & GRUB_ARCHELP_ATTR_TYPE)
+		    == GRUB_ARCHELP_ATTR_LNK))
+	{
+	  if (load_entry (data, arcops, entry))
+	    return 1;
+	  fn = grub_strdup (entry->name);
+	  if (!fn)
+	    return 0;
+	  err = handle_symlink (data, arcops, fn, name, entry->mode,
+				&restart);
+	  grub_free (fn);
+	  if (err)
+	    return 0;
+	  if (restart)
+	    {
+	      if (++symlinknest == 8)
+		{
+		  grub_error (GRUB_ERR_SYMLINK_LOOP,
+			      N_("too deep nesting of symlinks"));
+		  return 0;
+		}
+	      goto restart;
+	    }
+	}
+
+      if (*ptr == 0)
+	break;
+    }
+
+  if (!entry)
+    {
+      grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+		  name_in);
+      return 0;
+    }
+  return load_entry (data, arcops, entry);
+}
+
 grub_err_t
 grub_archelp_open (struct grub_archelp_data *data,
 		   struct grub_archelp_ops *arcops,
@@ -238,12 +597,32 @@ grub_archelp_open (struct grub_archelp_data *data,
   char *fn;
   char *name = grub_strdup (name_in + 1);
   int symlinknest = 0;
+  struct archelp_index *index;
 
   if (!name)
     return grub_errno;
 
   canonicalize (name);
 
+  index = get_index (data, arcops);
+  if (index)
+    {
+      char *name2 = grub_strdup (name);
+
+      if (!name2)
+	goto fail;
+      if (!open_indexed (data, arcops, index, &name2, name_in))
+	{
+	  grub_free (name2);
+	  grub_free (name);
+	  return grub_errno;
+	}
+      grub_free (name2);
+      grub_errno = GRUB_ERR_NONE;
+      drop_index (index);
+      arcops->rewind (data);
+    }
+
   while (1)
     {
       grub_uint32_t mode;
@@ -296,3 +675,15 @@ fail:
 
   return grub_errno;
 }
+
+GRUB_MOD_FINI (archelp)
+{
+  struct archelp_index *index, *next;
+
+  for (index = indexes; index; index = next)
+    {
+      next = index->next;
+      free_index (index);
+    }
+  indexes = 0;
+}
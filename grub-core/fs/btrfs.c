@@ -44,6 +44,11 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE (GRUB_BTRFS_LZO_BLOCK_SIZE + \
 				     (GRUB_BTRFS_LZO_BLOCK_SIZE / 16) + 64 + 3)
 
+/* Large reads from mirrored chunks are split into pieces of this size
+   and the pieces alternate between the copies, so that every member
+   sees long contiguous requests.  */
+#define GRUB_BTRFS_MIRROR_BALANCE_SIZE (1 << 20)
+
 typedef grub_uint8_t grub_btrfs_checksum_t[0x20];
 typedef grub_uint16_t grub_btrfs_uuid_t[8];
 
@@ -705,6 +710,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	grub_uint64_t stripe_offset;
 	grub_uint64_t off = addr - grub_le_to_cpu64 (key->offset);
 	unsigned redundancy = 1;
+	grub_uint64_t first_copy = 0;
 	unsigned i, j;
 
 	if (grub_le_to_cpu64 (chunk->size) <= off)
@@ -739,13 +745,29 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	      break;
 	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
+	    {
+	      grub_dprintf ("btrfs", "DUP\n");
+	      stripen = 0;
+	      stripe_offset = off;
+	      csize = grub_le_to_cpu64 (chunk->size) - off;
+	      redundancy = 2;
+	      break;
+	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID1:
 	    {
+	      grub_uint64_t piece;
 	      grub_dprintf ("btrfs", "RAID1\n");
 	      stripen = 0;
 	      stripe_offset = off;
-	      csize = grub_le_to_cpu64 (chunk->size) - off;
 	      redundancy = 2;
+	      /* Both copies live on different devices: alternate between
+		 them in GRUB_BTRFS_MIRROR_BALANCE_SIZE pieces.  */
+	      piece = grub_divmod64 (off, GRUB_BTRFS_MIRROR_BALANCE_SIZE,
+				     NULL);
+	      first_copy = piece & 1;
+	      csize = (piece + 1) * GRUB_BTRFS_MIRROR_BALANCE_SIZE - off;
+	      if (csize > grub_le_to_cpu64 (chunk->size) - off)
+		csize = grub_le_to_cpu64 (chunk->size) - off;
 	      break;
 	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID0:
@@ -781,6 +803,13 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	      stripe_offset = low + grub_le_to_cpu64 (chunk->stripe_length)
 		* high;
 	      csize = grub_le_to_cpu64 (chunk->stripe_length) - low;
+	      /* Pick the copy by position on the member device so that
+		 each mirror gets runs of GRUB_BTRFS_MIRROR_BALANCE_SIZE.  */
+	      if (redundancy > 1)
+		grub_divmod64 (grub_divmod64 (stripe_offset,
+					      GRUB_BTRFS_MIRROR_BALANCE_SIZE,
+					      NULL),
+			       redundancy, &first_copy);
 	      break;
 	    }
 	  default:
@@ -805,7 +834,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
 		/* Right now the redundancy handling is easy.
 		   With RAID5-like it will be more difficult.  */
-		stripe += stripen + i;
+		stripe += stripen + (first_copy + i) % redundancy;
 
 		paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
 
@@ -1581,6 +1610,11 @@ grub_btrfs_dir (grub_device_t device, const char *path,
 	    {
 	      info.mtime = grub_le_to_cpu64 (inode.mtime.sec);
 	      info.mtimeset = 1;
+	      if (cdirel->type == GRUB_BTRFS_DIR_ITEM_TYPE_REGULAR)
+		{
+		  info.size = grub_le_to_cpu64 (inode.size);
+		  info.sizeset = 1;
+		}
 	    }
 	  c = cdirel->name[grub_le_to_cpu16 (cdirel->n)];
 	  cdirel->name[grub_le_to_cpu16 (cdirel->n)] = 0;
@@ -1733,6 +1767,13 @@ grub_btrfs_embed (grub_device_t device __attribute__ ((unused)),
 }
 #endif
 
+static const struct grub_fs_signature grub_btrfs_signatures[] =
+  {
+    { 64 * 1024 + 0x40, sizeof (GRUB_BTRFS_SIGNATURE) - 1,
+      GRUB_BTRFS_SIGNATURE },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_btrfs_fs = {
   .name = "btrfs",
   .dir = grub_btrfs_dir,
@@ -1741,6 +1782,7 @@ static struct grub_fs grub_btrfs_fs = {
   .close = grub_btrfs_close,
   .uuid = grub_btrfs_uuid,
   .label = grub_btrfs_label,
+  .signatures = grub_btrfs_signatures,
 #ifdef GRUB_UTIL
   .embed = grub_btrfs_embed,
   .reserved_first_sector = 1,
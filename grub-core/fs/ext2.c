@@ -884,6 +884,13 @@ grub_ext2_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_le_to_cpu32 (node->inode.mtime);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_le_to_cpu32 (node->inode.size);
+	  info.size |= ((grub_off_t) grub_le_to_cpu32 (node->inode.size_high))
+	    << 32;
+	}
     }
 
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
@@ -1003,6 +1010,13 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
 
 
 
+/* EXT2_MAGIC in the superblock at 1 KiB.  */
+static const struct grub_fs_signature grub_ext2_signatures[] =
+  {
+    { 1024 + 56, 2, "\x53\xef" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ext2_fs =
   {
     .name = "ext2",
@@ -1013,6 +1027,7 @@ static struct grub_fs grub_ext2_fs =
     .label = grub_ext2_label,
     .uuid = grub_ext2_uuid,
     .mtime = grub_ext2_mtime,
+    .signatures = grub_ext2_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -173,6 +173,15 @@ typedef struct grub_fat_dir_entry grub_fat_dir_node_t;
 
 #endif
 
+/* Consecutive clusters CLUSTER to CLUSTER + LEN - 1 holding the file
+   data from logical cluster LOGICAL on.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t len;
+};
+
 struct grub_fat_data
 {
   int logical_sector_bits;
@@ -196,8 +205,11 @@ struct grub_fat_data
   grub_uint8_t attr;
   grub_ssize_t file_size;
   grub_uint32_t file_cluster;
-  grub_uint32_t cur_cluster_num;
-  grub_uint32_t cur_cluster;
+
+  /* The part of the cluster chain of the file read so far.  */
+  struct grub_fat_run *runs;
+  grub_uint32_t num_runs;
+  grub_uint32_t alloc_runs;
 
   grub_uint32_t uuid;
 };
@@ -237,6 +249,9 @@ grub_fat_mount (grub_disk_t disk)
   if (! data)
     goto fail;
 
+  data->runs = 0;
+  data->num_runs = data->alloc_runs = 0;
+
   /* Read the BPB.  */
   if (grub_disk_read (disk, 0, 0, sizeof (bpb), &bpb))
     goto fail;
@@ -441,7 +456,7 @@ grub_fat_mount (grub_disk_t disk)
 
   /* Start from the root directory.  */
   data->file_cluster = data->root_cluster;
-  data->cur_cluster_num = ~0U;
+  data->num_runs = 0;
   data->attr = GRUB_FAT_ATTR_DIRECTORY;
   return data;
 
@@ -452,6 +467,149 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_fat_free_data (struct grub_fat_data *data)
+{
+  if (data)
+    grub_free (data->runs);
+  grub_free (data);
+}
+
+/* Find the run holding LOGICAL_CLUSTER among those read so far.  */
+static struct grub_fat_run *
+grub_fat_find_run (struct grub_fat_data *data, grub_uint32_t logical_cluster)
+{
+  grub_uint32_t low = 0, high = data->num_runs;
+
+  while (low < high)
+    {
+      grub_uint32_t mid = low + (high - low) / 2;
+
+      if (data->runs[mid].logical <= logical_cluster)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+
+  if (low == 0
+      || logical_cluster - data->runs[low - 1].logical >= data->runs[low - 1].len)
+    return 0;
+  return &data->runs[low - 1];
+}
+
+static grub_err_t
+grub_fat_add_run (struct grub_fat_data *data, grub_uint32_t logical,
+		  grub_uint32_t cluster)
+{
+  if (data->num_runs == data->alloc_runs)
+    {
+      struct grub_fat_run *runs;
+      grub_uint32_t n = data->alloc_runs ? 2 * data->alloc_runs : 8;
+
+      runs = grub_realloc (data->runs, n * sizeof (runs[0]));
+      if (! runs)
+	return grub_errno;
+      data->runs = runs;
+      data->alloc_runs = n;
+    }
+
+  data->runs[data->num_runs].logical = logical;
+  data->runs[data->num_runs].cluster = cluster;
+  data->runs[data->num_runs].len = 1;
+  data->num_runs++;
+  return GRUB_ERR_NONE;
+}
+
+/* Follow the cluster chain of the file until LOGICAL_CLUSTER is covered
+   by the runs.  Return 1 if it is, 0 if the chain ends before and -1 on
+   error.  */
+static int
+grub_fat_extend_runs (grub_disk_t disk, struct grub_fat_data *data,
+		      grub_uint32_t logical_cluster)
+{
+  struct grub_fat_run *last;
+
+  if (data->num_runs == 0)
+    {
+      if (data->file_cluster < 2 || data->file_cluster >= data->num_clusters)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+		      data->file_cluster);
+	  return -1;
+	}
+      if (grub_fat_add_run (data, 0, data->file_cluster))
+	return -1;
+    }
+
+  last = &data->runs[data->num_runs - 1];
+  while (logical_cluster - last->logical >= last->len)
+    {
+      /* Find next cluster.  */
+      grub_uint32_t cur_cluster = last->cluster + last->len - 1;
+      grub_uint32_t next_cluster;
+      unsigned long fat_offset;
+
+      switch (data->fat_size)
+	{
+	case 32:
+	  fat_offset = cur_cluster << 2;
+	  break;
+	case 16:
+	  fat_offset = cur_cluster << 1;
+	  break;
+	default:
+	  /* case 12: */
+	  fat_offset = cur_cluster + (cur_cluster >> 1);
+	  break;
+	}
+
+      /* Read the FAT.  */
+      if (grub_disk_read (disk, data->fat_sector, fat_offset,
+			  (data->fat_size + 7) >> 3,
+			  (char *) &next_cluster))
+	return -1;
+
+      next_cluster = grub_le_to_cpu32 (next_cluster);
+      switch (data->fat_size)
+	{
+	case 16:
+	  next_cluster &= 0xFFFF;
+	  break;
+	case 12:
+	  if (cur_cluster & 1)
+	    next_cluster >>= 4;
+
+	  next_cluster &= 0x0FFF;
+	  break;
+	}
+
+      grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		    data->fat_size, next_cluster);
+
+      /* Check the end.  */
+      if (next_cluster >= data->cluster_eof_mark)
+	return 0;
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+		      next_cluster);
+	  return -1;
+	}
+
+      if (next_cluster == cur_cluster + 1)
+	last->len++;
+      else
+	{
+	  if (grub_fat_add_run (data, last->logical + last->len, next_cluster))
+	    return -1;
+	  last = &data->runs[data->num_runs - 1];
+	}
+    }
+
+  return 1;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, struct grub_fat_data *data,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -485,79 +643,31 @@ grub_fat_read_data (grub_disk_t disk, struct grub_fat_data *data,
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
-  if (logical_cluster < data->cur_cluster_num)
-    {
-      data->cur_cluster_num = 0;
-      data->cur_cluster = data->file_cluster;
-    }
-
   while (len)
     {
-      while (logical_cluster > data->cur_cluster_num)
-	{
-	  /* Find next cluster.  */
-	  grub_uint32_t next_cluster;
-	  unsigned long fat_offset;
-
-	  switch (data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = data->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = data->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = data->cur_cluster + (data->cur_cluster >> 1);
-	      break;
-	    }
+      struct grub_fat_run *run;
+      grub_uint64_t avail;
 
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, data->fat_sector, fat_offset,
-			      (data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
+      run = grub_fat_find_run (data, logical_cluster);
+      if (! run)
+	{
+	  int r = grub_fat_extend_runs (disk, data, logical_cluster);
+	  if (r < 0)
 	    return -1;
-
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (data->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			data->fat_size, next_cluster);
-
-	  /* Check the end.  */
-	  if (next_cluster >= data->cluster_eof_mark)
+	  if (r == 0)
 	    return ret;
-
-	  if (next_cluster < 2 || next_cluster >= data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
-
-	  data->cur_cluster = next_cluster;
-	  data->cur_cluster_num++;
+	  run = &data->runs[data->num_runs - 1];
 	}
 
-      /* Read the data here.  */
+      /* Read the data here, up to the end of the run at once.  */
       sector = (data->cluster_sector
-		+ ((data->cur_cluster - 2)
+		+ ((run->cluster + (logical_cluster - run->logical) - 2)
 		   << data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
-      if (size > len)
-	size = len;
+      avail = (((grub_uint64_t) (run->len - (logical_cluster - run->logical))
+		<< logical_cluster_bits) - offset);
+      size = len;
+      if (size > avail)
+	size = avail;
 
       disk->read_hook = read_hook;
       disk->read_hook_data = read_hook_data;
@@ -569,8 +679,9 @@ grub_fat_read_data (grub_disk_t disk, struct grub_fat_data *data,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
-      offset = 0;
+      offset += size;
+      logical_cluster += offset >> logical_cluster_bits;
+      offset &= (1ULL << logical_cluster_bits) - 1;
     }
 
   return ret;
@@ -922,7 +1033,7 @@ grub_fat_find_dir (grub_disk_t disk, struct grub_fat_data *data,
 	  data->file_cluster = ((grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
 				| grub_le_to_cpu16 (ctxt.dir.first_cluster_low));
 #endif
-	  data->cur_cluster_num = ~0U;
+	  data->num_runs = 0;
 
 	  if (call_hook)
 	    hook (ctxt.filename, &info, hook_data);
@@ -981,7 +1092,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
 
   grub_free (dirname);
-  grub_free (data);
+  grub_fat_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -1021,7 +1132,7 @@ grub_fat_open (grub_file_t file, const char *name)
 
  fail:
 
-  grub_free (data);
+  grub_fat_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -1039,7 +1150,7 @@ grub_fat_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_fat_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_fat_free_data (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -1085,7 +1196,7 @@ grub_fat_label (grub_device_t device, char **label)
 				* GRUB_MAX_UTF8_PER_UTF16 + 1);
 	  if (!*label)
 	    {
-	      grub_free (data);
+	      grub_fat_free_data (data);
 	      return grub_errno;
 	    }
 	  chc = dir.type_specific.volume_label.character_count;
@@ -1097,7 +1208,7 @@ grub_fat_label (grub_device_t device, char **label)
 	}
     }
 
-  grub_free (data);
+  grub_fat_free_data (data);
   return grub_errno;
 }
 
@@ -1142,7 +1253,7 @@ grub_fat_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_fat_free_data (data);
 
   return grub_errno;
 }
@@ -1172,7 +1283,7 @@ grub_fat_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_fat_free_data (data);
 
   return grub_errno;
 }
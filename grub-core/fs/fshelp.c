@@ -41,6 +41,9 @@ struct grub_fshelp_find_file_ctx
   int symlinknest;
   char *name;
   enum grub_fshelp_filetype type;
+  iterate_dir_func iterate_dir;
+  grub_fshelp_lookup_file_t lookup_file;
+  read_symlink_func read_symlink;
 };
 
 /* Helper for find_file_iter.  */
@@ -75,10 +78,35 @@ find_file_iter (const char *filename, enum grub_fshelp_filetype filetype,
   return 1;
 }
 
+/* Look up CTX->name in CTX->currnode.  Returns 1 if found.  */
+static int
+find_in_dir (struct grub_fshelp_find_file_ctx *ctx)
+{
+  grub_fshelp_node_t foundnode = NULL;
+  enum grub_fshelp_filetype foundtype = GRUB_FSHELP_UNKNOWN;
+
+  if (!ctx->lookup_file)
+    return ctx->iterate_dir (ctx->currnode, find_file_iter, ctx);
+
+  if (ctx->lookup_file (ctx->currnode, ctx->name, &foundnode, &foundtype)
+      || !foundnode)
+    return 0;
+
+  if (foundtype == GRUB_FSHELP_UNKNOWN)
+    {
+      grub_free (foundnode);
+      return 0;
+    }
+
+  ctx->type = foundtype & ~GRUB_FSHELP_CASE_INSENSITIVE;
+  ctx->oldnode = ctx->currnode;
+  ctx->currnode = foundnode;
+  return 1;
+}
+
 static grub_err_t
 find_file (const char *currpath, grub_fshelp_node_t currroot,
 	   grub_fshelp_node_t *currfound,
-	   iterate_dir_func iterate_dir, read_symlink_func read_symlink,
 	   struct grub_fshelp_find_file_ctx *ctx)
 {
   char fpath[grub_strlen (currpath) + 1];
@@ -125,7 +153,7 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 	}
 
       /* Iterate over the directory.  */
-      found = iterate_dir (ctx->currnode, find_file_iter, ctx);
+      found = find_in_dir (ctx);
       if (! found)
 	{
 	  free_node (ctx->currnode, ctx);
@@ -152,7 +180,7 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 				 N_("too deep nesting of symlinks"));
 	    }
 
-	  symlink = read_symlink (ctx->currnode);
+	  symlink = ctx->read_symlink (ctx->currnode);
 	  free_node (ctx->currnode, ctx);
 	  ctx->currnode = 0;
 
@@ -171,8 +199,7 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 	    }
 
 	  /* Lookup the node the symlink points to.  */
-	  find_file (symlink, ctx->oldnode, &ctx->currnode,
-		     iterate_dir, read_symlink, ctx);
+	  find_file (symlink, ctx->oldnode, &ctx->currnode, ctx);
 	  ctx->type = ctx->foundtype;
 	  grub_free (symlink);
 
@@ -205,6 +232,38 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 		     ctx->path);
 }
 
+static grub_err_t
+find_file_real (const char *path, grub_fshelp_node_t rootnode,
+		grub_fshelp_node_t *foundnode,
+		struct grub_fshelp_find_file_ctx *ctx,
+		enum grub_fshelp_filetype expecttype)
+{
+  grub_err_t err;
+
+  ctx->path = path;
+  ctx->rootnode = rootnode;
+  ctx->foundtype = GRUB_FSHELP_DIR;
+  ctx->symlinknest = 0;
+
+  if (!path || path[0] != '/')
+    {
+      grub_error (GRUB_ERR_BAD_FILENAME, N_("invalid file name `%s'"), path);
+      return grub_errno;
+    }
+
+  err = find_file (path, rootnode, foundnode, ctx);
+  if (err)
+    return err;
+
+  /* Check if the node that was found was of the expected type.  */
+  if (expecttype == GRUB_FSHELP_REG && ctx->foundtype != expecttype)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a regular file"));
+  else if (expecttype == GRUB_FSHELP_DIR && ctx->foundtype != expecttype)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a directory"));
+
+  return 0;
+}
+
 /* Lookup the node PATH.  The node ROOTNODE describes the root of the
    directory tree.  The node found is returned in FOUNDNODE, which is
    either a ROOTNODE or a new malloc'ed node.  ITERATE_DIR is used to
@@ -220,30 +279,30 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 		       enum grub_fshelp_filetype expecttype)
 {
   struct grub_fshelp_find_file_ctx ctx = {
-    .path = path,
-    .rootnode = rootnode,
-    .foundtype = GRUB_FSHELP_DIR,
-    .symlinknest = 0
+    .iterate_dir = iterate_dir,
+    .lookup_file = 0,
+    .read_symlink = read_symlink
   };
-  grub_err_t err;
-
-  if (!path || path[0] != '/')
-    {
-      grub_error (GRUB_ERR_BAD_FILENAME, N_("invalid file name `%s'"), path);
-      return grub_errno;
-    }
 
-  err = find_file (path, rootnode, foundnode, iterate_dir, read_symlink, &ctx);
-  if (err)
-    return err;
+  return find_file_real (path, rootnode, foundnode, &ctx, expecttype);
+}
 
-  /* Check if the node that was found was of the expected type.  */
-  if (expecttype == GRUB_FSHELP_REG && ctx.foundtype != expecttype)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a regular file"));
-  else if (expecttype == GRUB_FSHELP_DIR && ctx.foundtype != expecttype)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a directory"));
+/* Like grub_fshelp_find_file but uses LOOKUP_FILE to find a single
+   name in a directory instead of iterating over all of its entries.  */
+grub_err_t
+grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      grub_fshelp_lookup_file_t lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype)
+{
+  struct grub_fshelp_find_file_ctx ctx = {
+    .iterate_dir = 0,
+    .lookup_file = lookup_file,
+    .read_symlink = read_symlink
+  };
 
-  return 0;
+  return find_file_real (path, rootnode, foundnode, &ctx, expecttype);
 }
 
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
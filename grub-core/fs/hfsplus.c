@@ -143,72 +143,166 @@ grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
 static int grub_hfsplus_cmp_extkey (struct grub_hfsplus_key *keya,
 				    struct grub_hfsplus_key_internal *keyb);
 
-/* Search for the block FILEBLOCK inside the file NODE.  Return the
-   blocknumber of this block on disk.  */
-static grub_disk_addr_t
-grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Append the 8 extents EXTENT to LIST.  Return the number of
+   extents which were in use.  */
+static int
+grub_hfsplus_add_extents (struct grub_hfsplus_extent_list *list,
+			  struct grub_hfsplus_extent *extent,
+			  grub_uint32_t *fileblock)
 {
-  struct grub_hfsplus_btnode *nnode = 0;
-  grub_disk_addr_t blksleft = fileblock;
-  struct grub_hfsplus_extent *extents = node->compressed 
-    ? &node->resource_extents[0] : &node->extents[0];
+  int i;
 
-  while (1)
+  for (i = 0; i < 8; i++)
     {
-      struct grub_hfsplus_extkey *key;
-      struct grub_hfsplus_key_internal extoverflow;
-      grub_disk_addr_t blk;
-      grub_off_t ptr;
+      struct grub_hfsplus_extent_run *run;
+      grub_uint32_t count = grub_be_to_cpu32 (extent[i].count);
 
-      /* Try to find this block in the current set of extents.  */
-      blk = grub_hfsplus_find_block (extents, &blksleft);
-
-      /* The previous iteration of this loop allocated memory.  The
-	 code above used this memory, it can be freed now.  */
-      grub_free (nnode);
-      nnode = 0;
-
-      if (blk != 0xffffffffffffffffULL)
-	return blk;
+      if (count == 0)
+	break;
 
-      /* For the extent overflow file, extra extents can't be found in
-	 the extent overflow file.  If this happens, you found a
-	 bug...  */
-      if (node->fileid == GRUB_HFSPLUS_FILEID_OVERFLOW)
+      if (list->num_runs == list->alloc_runs)
 	{
-	  grub_error (GRUB_ERR_READ_ERROR,
-		      "extra extents found in an extend overflow file");
-	  break;
+	  struct grub_hfsplus_extent_run *tmp;
+	  unsigned alloc = list->alloc_runs ? 2 * list->alloc_runs : 16;
+
+	  tmp = grub_realloc (list->runs, alloc * sizeof (list->runs[0]));
+	  if (!tmp)
+	    return -1;
+	  list->runs = tmp;
+	  list->alloc_runs = alloc;
 	}
+      run = &list->runs[list->num_runs++];
+      run->fileblock = *fileblock;
+      run->start = grub_be_to_cpu32 (extent[i].start);
+      run->count = count;
+      *fileblock += count;
+    }
+
+  return i;
+}
+
+static void
+grub_hfsplus_free_extent_list (struct grub_hfsplus_extent_list *list)
+{
+  grub_free (list->runs);
+  grub_free (list);
+}
+
+/* Return the list of all extents of the fork of NODE which is being
+   read, walking the extent overflow file the first time.  */
+static struct grub_hfsplus_extent_list *
+grub_hfsplus_get_extent_list (grub_fshelp_node_t node)
+{
+  struct grub_hfsplus_extent_list *list;
+  grub_uint8_t type = node->compressed ? 0xff : 0;
+  grub_uint32_t fileblock = 0;
+
+  for (list = node->data->extent_lists; list; list = list->next)
+    if (list->fileid == node->fileid && list->type == type)
+      return list;
+
+  list = grub_zalloc (sizeof (*list));
+  if (!list)
+    return 0;
+  list->fileid = node->fileid;
+  list->type = type;
+
+  if (grub_hfsplus_add_extents (list, node->compressed
+				? node->resource_extents : node->extents,
+				&fileblock) < 0)
+    goto fail;
+
+  while (1)
+    {
+      struct grub_hfsplus_btnode *nnode;
+      struct grub_hfsplus_extkey *key;
+      struct grub_hfsplus_key_internal extoverflow;
+      grub_off_t ptr;
+      int n;
 
       /* Set up the key to look for in the extent overflow file.  */
       extoverflow.extkey.fileid = node->fileid;
-      extoverflow.extkey.type = 0;
-      extoverflow.extkey.start = fileblock - blksleft;
-      extoverflow.extkey.type = node->compressed ? 0xff : 0;
+      extoverflow.extkey.type = type;
+      extoverflow.extkey.start = fileblock;
       if (grub_hfsplus_btree_search (&node->data->extoverflow_tree,
 				     &extoverflow,
-				     grub_hfsplus_cmp_extkey, &nnode, &ptr)
-	  || !nnode)
-	{
-	  grub_error (GRUB_ERR_READ_ERROR,
-		      "no block found for the file id 0x%x and the block offset 0x%x",
-		      node->fileid, fileblock);
-	  break;
-	}
+				     grub_hfsplus_cmp_extkey, &nnode, &ptr))
+	goto fail;
+      if (!nnode)
+	break;
 
       /* The extent overflow file has 8 extents right after the key.  */
       key = (struct grub_hfsplus_extkey *)
 	grub_hfsplus_btree_recptr (&node->data->extoverflow_tree, nnode, ptr);
-      extents = (struct grub_hfsplus_extent *) (key + 1);
+      n = grub_hfsplus_add_extents (list,
+				    (struct grub_hfsplus_extent *) (key + 1),
+				    &fileblock);
+      grub_free (nnode);
+      if (n < 0)
+	goto fail;
+      if (n == 0)
+	break;
+    }
+
+  list->next = node->data->extent_lists;
+  node->data->extent_lists = list;
+  return list;
 
-      /* The block wasn't found.  Perhaps the next iteration will find
-	 it.  The last block we found is stored in BLKSLEFT now.  */
+ fail:
+  grub_hfsplus_free_extent_list (list);
+  return 0;
+}
+
+/* Search for the block FILEBLOCK inside the file NODE.  Return the
+   blocknumber of this block on disk.  */
+static grub_disk_addr_t
+grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  grub_disk_addr_t blksleft = fileblock;
+  struct grub_hfsplus_extent *extents = node->compressed 
+    ? &node->resource_extents[0] : &node->extents[0];
+  struct grub_hfsplus_extent_list *list;
+  grub_disk_addr_t blk;
+  unsigned lo, hi;
+
+  /* Try to find this block in the extents of the catalog record.  */
+  blk = grub_hfsplus_find_block (extents, &blksleft);
+  if (blk != 0xffffffffffffffffULL)
+    return blk;
+
+  /* For the extent overflow file, extra extents can't be found in
+     the extent overflow file.  If this happens, you found a
+     bug...  */
+  if (node->fileid == GRUB_HFSPLUS_FILEID_OVERFLOW)
+    {
+      grub_error (GRUB_ERR_READ_ERROR,
+		  "extra extents found in an extend overflow file");
+      return -1;
     }
 
-  grub_free (nnode);
+  list = grub_hfsplus_get_extent_list (node);
+  if (!list)
+    return -1;
+
+  lo = 0;
+  hi = list->num_runs;
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      struct grub_hfsplus_extent_run *run = &list->runs[mid];
+
+      if (fileblock < run->fileblock)
+	hi = mid;
+      else if (fileblock - run->fileblock >= run->count)
+	lo = mid + 1;
+      else
+	return run->start + (fileblock - run->fileblock);
+    }
 
   /* Too bad, you lose.  */
+  grub_error (GRUB_ERR_READ_ERROR,
+	      "no block found for the file id 0x%x and the block offset 0x%x",
+	      node->fileid, fileblock);
   return -1;
 }
 
@@ -228,6 +322,79 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 				node->data->embedded_offset);
 }
 
+/* Read the node NODENO of BTREE into BUF, going to the disk only if
+   it isn't in the cache.  */
+static grub_err_t
+grub_hfsplus_read_btnode (struct grub_hfsplus_btree *btree,
+			  grub_uint32_t nodeno, char *buf)
+{
+  struct grub_hfsplus_data *data = btree->file.data;
+  struct grub_hfsplus_btnode_cache *entry, *victim;
+  int i;
+
+  victim = &data->btnode_cache[0];
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE_SIZE; i++)
+    {
+      entry = &data->btnode_cache[i];
+      if (entry->stamp && entry->fileid == btree->file.fileid
+	  && entry->nodeno == nodeno)
+	{
+	  entry->stamp = ++data->btnode_cache_stamp;
+	  grub_memcpy (buf, entry->buf, btree->nodesize);
+	  return GRUB_ERR_NONE;
+	}
+      if (entry->stamp < victim->stamp)
+	victim = entry;
+    }
+
+  if (grub_hfsplus_read_file (&btree->file, 0, 0,
+			      (grub_disk_addr_t) nodeno
+			      * (grub_disk_addr_t) btree->nodesize,
+			      btree->nodesize, buf) <= 0)
+    return grub_errno ? : grub_error (GRUB_ERR_BAD_FS,
+				      "couldn't read B-tree node");
+
+  if (victim->size != btree->nodesize)
+    {
+      grub_free (victim->buf);
+      victim->stamp = 0;
+      victim->size = btree->nodesize;
+      victim->buf = grub_malloc (victim->size);
+    }
+  if (victim->buf)
+    {
+      grub_memcpy (victim->buf, buf, btree->nodesize);
+      victim->fileid = btree->file.fileid;
+      victim->nodeno = nodeno;
+      victim->stamp = ++data->btnode_cache_stamp;
+    }
+  else
+    {
+      victim->size = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_hfsplus_free_data (struct grub_hfsplus_data *data)
+{
+  struct grub_hfsplus_extent_list *list, *next;
+  int i;
+
+  if (!data)
+    return;
+
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE_SIZE; i++)
+    grub_free (data->btnode_cache[i].buf);
+  for (list = data->extent_lists; list; list = next)
+    {
+      next = list->next;
+      grub_hfsplus_free_extent_list (list);
+    }
+  grub_free (data);
+}
+
 static struct grub_hfsplus_data *
 grub_hfsplus_mount (grub_disk_t disk)
 {
@@ -240,7 +407,7 @@ grub_hfsplus_mount (grub_disk_t disk)
     struct grub_hfsplus_volheader hfsplus;
   } volheader;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
 
@@ -379,7 +546,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a HFS+ filesystem");
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
   return 0;
 }
 
@@ -524,11 +691,9 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 	saved_node = first_node->next;
       node_count++;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (((grub_disk_addr_t)
-				    grub_be_to_cpu32 (first_node->next))
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      if (grub_hfsplus_read_btnode (btree,
+				    grub_be_to_cpu32 (first_node->next),
+				    cnode))
 	return 1;
 
       /* Don't skip any record in the next iteration.  */
@@ -583,10 +748,7 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       node_count++;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (grub_disk_addr_t) currnode
-				  * (grub_disk_addr_t) btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
+      if (grub_hfsplus_read_btnode (btree, currnode, node))
 	{
 	  grub_free (node);
 	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
@@ -857,7 +1019,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -874,7 +1036,7 @@ grub_hfsplus_close (grub_file_t file)
   grub_free (data->opened_file.cbuf);
   grub_free (data->opened_file.compress_index);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -917,6 +1079,13 @@ grub_hfsplus_dir_iter (const char *filename,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = node->mtime;
+  /* Compressed files keep their data elsewhere and have an empty data
+     fork.  Leave their size to grub_hfsplus_open.  */
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG && node->size)
+    {
+      info.sizeset = 1;
+      info.size = node->size;
+    }
   info.case_insensitive = !! (filetype & GRUB_FSHELP_CASE_INSENSITIVE);
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
@@ -949,7 +1118,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -984,7 +1153,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 				 grub_hfsplus_cmp_catkey_id, &node, &ptr)
       || !node)
     {
-      grub_free (data);
+      grub_hfsplus_free_data (data);
       return 0;
     }
 
@@ -1009,7 +1178,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 		       label_len) = '\0';
 
   grub_free (node);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return GRUB_ERR_NONE;
 }
@@ -1031,7 +1200,7 @@ grub_hfsplus_mtime (grub_device_t device, grub_int32_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return grub_errno;
 
@@ -1057,13 +1226,22 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return grub_errno;
 }
 
 
 
+/* HFS+, HFSX or an HFS wrapper.  */
+static const struct grub_fs_signature grub_hfsplus_signatures[] =
+  {
+    { GRUB_HFSPLUS_SBLOCK * GRUB_DISK_SECTOR_SIZE, 2, "H+" },
+    { GRUB_HFSPLUS_SBLOCK * GRUB_DISK_SECTOR_SIZE, 2, "HX" },
+    { GRUB_HFSPLUS_SBLOCK * GRUB_DISK_SECTOR_SIZE, 2, "BD" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_hfsplus_fs =
   {
     .name = "hfsplus",
@@ -1074,6 +1252,7 @@ static struct grub_fs grub_hfsplus_fs =
     .label = grub_hfsplus_label,
     .mtime = grub_hfsplus_mtime,
     .uuid = grub_hfsplus_uuid,
+    .signatures = grub_hfsplus_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
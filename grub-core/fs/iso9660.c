@@ -28,6 +28,7 @@
 #include <grub/fshelp.h>
 #include <grub/charset.h>
 #include <grub/datetime.h>
+#include <grub/deflate.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -48,6 +49,9 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_ISO9660_VOLDESC_PART	3
 #define GRUB_ISO9660_VOLDESC_END	255
 
+/* The header of a file compressed with zisofs (mkisofs -z).  */
+#define GRUB_ISO9660_ZISOFS_MAGIC	"\x37\xe4\x53\x96\xc9\xdb\xd6\x07"
+
 /* The head of a volume descriptor.  */
 struct grub_iso9660_voldesc
 {
@@ -153,6 +157,11 @@ struct grub_iso9660_data
   int susp_skip;
   int joliet;
   struct grub_fshelp_node *node;
+
+  /* The last decompressed block of a zisofs file.  */
+  char *zisofs_buf;
+  grub_uint32_t zisofs_block;
+  grub_uint32_t zisofs_header_size;
 };
 
 struct grub_fshelp_node
@@ -160,6 +169,10 @@ struct grub_fshelp_node
   struct grub_iso9660_data *data;
   grub_size_t have_dirents, alloc_dirents;
   int have_symlink;
+  /* Log2 of the block size and uncompressed size of a zisofs file,
+     0 if the file isn't compressed.  */
+  grub_uint8_t zisofs_log2_blksz;
+  grub_uint32_t zisofs_size;
   struct grub_iso9660_dir dirents[8];
   char symlink[0];
 };
@@ -521,6 +534,8 @@ struct iterate_dir_ctx
   enum grub_fshelp_filetype type;
   char *symlink;
   int was_continue;
+  grub_uint8_t zisofs_log2_blksz;
+  grub_uint32_t zisofs_size;
 };
 
   /* Extend the symlink.  */
@@ -649,6 +664,15 @@ susp_iterate_dir (struct grub_iso9660_susp_entry *entry,
       if (grub_errno)
 	return grub_errno;
     }
+  /* The file is compressed with zisofs.  */
+  else if (grub_strncmp ("ZF", (char *) entry->sig, 2) == 0
+	   && entry->len >= 16 && entry->data[0] == 'p'
+	   && entry->data[1] == 'z')
+    {
+      ctx->zisofs_log2_blksz = entry->data[3];
+      ctx->zisofs_size = grub_get_unaligned32 (&entry->data[4]);
+      ctx->zisofs_size = grub_le_to_cpu32 (ctx->zisofs_size);
+    }
 
   return 0;
 }
@@ -692,6 +716,8 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	ctx.filename = 0;
 	ctx.filename_alloc = 0;
 	ctx.type = GRUB_FSHELP_UNKNOWN;
+	ctx.zisofs_log2_blksz = 0;
+	ctx.zisofs_size = 0;
 
 	if (dir->data->rockridge
 	    && grub_iso9660_susp_iterate (dir, sua_off, sua_size,
@@ -712,6 +738,8 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	/* Setup a new node.  */
 	node->data = dir->data;
 	node->have_symlink = 0;
+	node->zisofs_log2_blksz = ctx.zisofs_log2_blksz;
+	node->zisofs_size = ctx.zisofs_size;
 
 	/* If the filetype was not stored using rockridge, use
 	   whatever is stored in the iso9660 filesystem.  */
@@ -861,6 +889,13 @@ grub_iso9660_dir_iter (const char *filename,
   grub_memset (&info, 0, sizeof (info));
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = !!iso9660_to_unixtime2 (&node->dirents[0].mtime, &info.mtime);
+  /* The size of zisofs files is only known once the header is checked.  */
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG
+      && !node->zisofs_log2_blksz)
+    {
+      info.sizeset = 1;
+      info.size = get_node_size (node);
+    }
 
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
@@ -910,6 +945,108 @@ grub_iso9660_dir (grub_device_t device, const char *path,
 }
 
 
+/* Check the zisofs header of NODE.  If it isn't valid, treat the file
+   as not compressed.  */
+static grub_err_t
+zisofs_open (struct grub_iso9660_data *data, grub_fshelp_node_t node)
+{
+  grub_uint8_t header[16];
+
+  if (get_node_size (node) < sizeof (header))
+    {
+      node->zisofs_log2_blksz = 0;
+      return GRUB_ERR_NONE;
+    }
+  if (read_node (node, 0, sizeof (header), (char *) header))
+    return grub_errno;
+  if (grub_memcmp (header, GRUB_ISO9660_ZISOFS_MAGIC, 8) != 0
+      || header[13] < 15 || header[13] > 17)
+    {
+      node->zisofs_log2_blksz = 0;
+      return GRUB_ERR_NONE;
+    }
+
+  node->zisofs_size = grub_le_to_cpu32 (grub_get_unaligned32 (header + 8));
+  node->zisofs_log2_blksz = header[13];
+  data->zisofs_header_size = header[12] << 2;
+  data->zisofs_block = 0xffffffff;
+  data->zisofs_buf = grub_malloc (1 << node->zisofs_log2_blksz);
+  if (!data->zisofs_buf)
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
+/* Read LEN bytes at POS of the zisofs file of DATA.  Every block is
+   a separate zlib stream, located through the block pointer table
+   after the header.  */
+static grub_err_t
+zisofs_read (struct grub_iso9660_data *data, grub_off_t pos,
+	     grub_size_t len, char *buf)
+{
+  grub_fshelp_node_t node = data->node;
+  grub_uint32_t blksz = 1 << node->zisofs_log2_blksz;
+
+  while (len > 0)
+    {
+      grub_uint32_t block = pos >> node->zisofs_log2_blksz;
+      grub_uint32_t blkoff = pos & (blksz - 1);
+      grub_uint32_t blklen = blksz;
+      grub_size_t toread;
+
+      if ((grub_off_t) block * blksz + blklen > node->zisofs_size)
+	blklen = node->zisofs_size - (grub_off_t) block * blksz;
+
+      if (block != data->zisofs_block)
+	{
+	  grub_uint32_t ptrs[2], start, end;
+
+	  data->zisofs_block = 0xffffffff;
+	  if (read_node (node, data->zisofs_header_size
+			 + (grub_off_t) block * sizeof (ptrs[0]),
+			 sizeof (ptrs), (char *) ptrs))
+	    return grub_errno;
+	  start = grub_le_to_cpu32 (ptrs[0]);
+	  end = grub_le_to_cpu32 (ptrs[1]);
+	  if (end < start || end - start > 2 * blksz)
+	    return grub_error (GRUB_ERR_BAD_FS, "invalid zisofs block pointer");
+
+	  /* An empty block stands for zeros.  */
+	  if (end == start)
+	    grub_memset (data->zisofs_buf, 0, blklen);
+	  else
+	    {
+	      char *cbuf;
+	      grub_ssize_t ret;
+
+	      cbuf = grub_malloc (end - start);
+	      if (!cbuf)
+		return grub_errno;
+	      if (read_node (node, start, end - start, cbuf))
+		{
+		  grub_free (cbuf);
+		  return grub_errno;
+		}
+	      ret = grub_zlib_decompress (cbuf, end - start, 0,
+					  data->zisofs_buf, blklen);
+	      grub_free (cbuf);
+	      if (ret != (grub_ssize_t) blklen)
+		return grub_errno ? : grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+						  "corrupted zisofs block");
+	    }
+	  data->zisofs_block = block;
+	}
+
+      toread = blklen - blkoff;
+      if (toread > len)
+	toread = len;
+      grub_memcpy (buf, data->zisofs_buf + blkoff, toread);
+      buf += toread;
+      pos += toread;
+      len -= toread;
+    }
+  return GRUB_ERR_NONE;
+}
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_iso9660_open (struct grub_file *file, const char *name)
@@ -943,6 +1080,17 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   file->size = get_node_size (foundnode);
   file->offset = 0;
 
+  if (foundnode->zisofs_log2_blksz)
+    {
+      if (zisofs_open (data, foundnode))
+	{
+	  grub_free (foundnode);
+	  goto fail;
+	}
+      if (foundnode->zisofs_log2_blksz)
+	file->size = foundnode->zisofs_size;
+    }
+
   return 0;
 
  fail:
@@ -963,7 +1111,10 @@ grub_iso9660_read (grub_file_t file, char *buf, grub_size_t len)
   /* XXX: The file is stored in as a single extent.  */
   data->disk->read_hook = file->read_hook;
   data->disk->read_hook_data = file->read_hook_data;
-  read_node (data->node, file->offset, len, buf);
+  if (data->node->zisofs_log2_blksz)
+    zisofs_read (data, file->offset, len, buf);
+  else
+    read_node (data->node, file->offset, len, buf);
   data->disk->read_hook = NULL;
 
   if (grub_errno)
@@ -979,6 +1130,7 @@ grub_iso9660_close (grub_file_t file)
   struct grub_iso9660_data *data =
     (struct grub_iso9660_data *) file->data;
   grub_free (data->node);
+  grub_free (data->zisofs_buf);
   grub_free (data);
 
   grub_dl_unref (my_mod);
@@ -1099,6 +1251,12 @@ grub_iso9660_mtime (grub_device_t device, grub_int32_t *timebuf)
 
 
 
+static const struct grub_fs_signature grub_iso9660_signatures[] =
+  {
+    { 16 * GRUB_ISO9660_BLKSZ + 1, 5, "CD001" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_iso9660_fs =
   {
     .name = "iso9660",
@@ -1109,6 +1267,7 @@ static struct grub_fs grub_iso9660_fs =
     .label = grub_iso9660_label,
     .uuid = grub_iso9660_uuid,
     .mtime = grub_iso9660_mtime,
+    .signatures = grub_iso9660_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
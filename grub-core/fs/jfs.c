@@ -832,6 +832,12 @@ grub_jfs_dir (grub_device_t device, const char *path,
 		  & GRUB_JFS_FILETYPE_MASK) == GRUB_JFS_FILETYPE_DIR;
       info.mtimeset = 1;
       info.mtime = grub_le_to_cpu32 (inode.mtime.sec);
+      if ((grub_le_to_cpu32 (inode.mode)
+	   & GRUB_JFS_FILETYPE_MASK) == GRUB_JFS_FILETYPE_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_le_to_cpu64 (inode.size);
+	}
       if (hook (diro->name, &info, hook_data))
 	goto fail;
     }
@@ -972,6 +978,12 @@ grub_jfs_label (grub_device_t device, char **label)
 }
 
 
+static const struct grub_fs_signature grub_jfs_signatures[] =
+  {
+    { GRUB_JFS_SBLOCK * GRUB_DISK_SECTOR_SIZE, 4, "JFS1" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_jfs_fs =
   {
     .name = "jfs",
@@ -981,6 +993,7 @@ static struct grub_fs grub_jfs_fs =
     .close = grub_jfs_close,
     .label = grub_jfs_label,
     .uuid = grub_jfs_uuid,
+    .signatures = grub_jfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
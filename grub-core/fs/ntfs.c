@@ -108,6 +108,9 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->runs = NULL;
+  at->num_runs = at->alloc_runs = 0;
+  at->runs_type = 0;
 }
 
 static void
@@ -116,6 +119,9 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->num_runs = at->alloc_runs = 0;
 }
 
 static grub_uint8_t *
@@ -261,6 +267,8 @@ locate_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft,
 {
   grub_uint8_t *pa;
 
+  /* AT may still hold the runs decoded for an earlier attribute.  */
+  grub_free (at->runs);
   init_attr (at, mft);
   pa = find_attr (at, attr);
   if (pa == NULL)
@@ -351,20 +359,85 @@ retry:
   return 0;
 }
 
+/* Find the decoded run of AT containing VCN.  */
+static struct grub_ntfs_run *
+find_run (struct grub_ntfs_attr *at, grub_disk_addr_t vcn)
+{
+  grub_size_t low = 0, high = at->num_runs;
+
+  while (low < high)
+    {
+      grub_size_t mid = low + (high - low) / 2;
+
+      if (at->runs[mid].vcn <= vcn)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+
+  if (low == 0 || vcn >= at->runs[low - 1].next_vcn)
+    return NULL;
+  return &at->runs[low - 1];
+}
+
+/* Remember the run just decoded by CTX.  */
+static grub_err_t
+add_run (struct grub_ntfs_rlst *ctx)
+{
+  struct grub_ntfs_attr *at = ctx->attr;
+  grub_size_t pos;
+
+  if (ctx->next_vcn <= ctx->curr_vcn || find_run (at, ctx->curr_vcn))
+    return GRUB_ERR_NONE;
+
+  if (at->num_runs == at->alloc_runs)
+    {
+      struct grub_ntfs_run *runs;
+      grub_size_t n = at->alloc_runs ? 2 * at->alloc_runs : 16;
+
+      runs = grub_realloc (at->runs, n * sizeof (runs[0]));
+      if (!runs)
+	return grub_errno;
+      at->runs = runs;
+      at->alloc_runs = n;
+    }
+
+  /* Runs are mostly decoded in order, so the new one usually goes last.  */
+  for (pos = at->num_runs; pos > 0; pos--)
+    if (at->runs[pos - 1].vcn < ctx->curr_vcn)
+      break;
+  grub_memmove (&at->runs[pos + 1], &at->runs[pos],
+		(at->num_runs - pos) * sizeof (at->runs[0]));
+  at->runs[pos].vcn = ctx->curr_vcn;
+  at->runs[pos].next_vcn = ctx->next_vcn;
+  at->runs[pos].lcn = ctx->curr_lcn;
+  at->runs[pos].sparse = !!(ctx->flags & GRUB_NTFS_RF_BLNK);
+  at->num_runs++;
+  return GRUB_ERR_NONE;
+}
+
 static grub_disk_addr_t
 grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 {
   struct grub_ntfs_rlst *ctx;
+  struct grub_ntfs_run *run;
 
   ctx = (struct grub_ntfs_rlst *) node;
-  if (block >= ctx->next_vcn)
+  run = find_run (ctx->attr, block);
+  if (run)
+    return run->sparse ? 0 : (block - run->vcn + run->lcn);
+
+  while (block >= ctx->next_vcn)
     {
-      if (grub_ntfs_read_run_list (ctx))
+      if (grub_ntfs_read_run_list (ctx) || add_run (ctx))
 	return -1;
-      return ctx->curr_lcn;
     }
-  else
-    return (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
+  if (block < ctx->curr_vcn)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+      return -1;
+    }
+  return (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
 					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
@@ -439,11 +512,30 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 
   ctx->next_vcn = u32at (pa, 0x10);
   ctx->curr_lcn = 0;
-  while (ctx->next_vcn <= ctx->target_vcn)
+
+  /* Plain reads look the runs up in those decoded by earlier reads
+     of the same attribute and only decode the run list where these
+     don't cover the data.  */
+  if (!(ctx->flags & GRUB_NTFS_RF_COMP) && !(at->flags & GRUB_NTFS_AF_GPOS))
     {
-      if (grub_ntfs_read_run_list (ctx))
-	return grub_errno;
+      if (at->runs_type != pa[0])
+	{
+	  at->num_runs = 0;
+	  at->runs_type = pa[0];
+	}
+      if (!find_run (at, ctx->target_vcn))
+	while (ctx->next_vcn <= ctx->target_vcn)
+	  {
+	    if (grub_ntfs_read_run_list (ctx) || add_run (ctx))
+	      return grub_errno;
+	  }
     }
+  else
+    while (ctx->next_vcn <= ctx->target_vcn)
+      {
+	if (grub_ntfs_read_run_list (ctx))
+	  return grub_errno;
+      }
 
   if (at->flags & GRUB_NTFS_AF_GPOS)
     {
@@ -534,11 +626,42 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint32_t mftno)
 {
+  grub_size_t size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  struct grub_ntfs_mft_cache *entry, *victim;
+  int i;
+
+  victim = &data->mft_cache[0];
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    {
+      entry = &data->mft_cache[i];
+      if (entry->stamp && entry->mftno == mftno)
+	{
+	  entry->stamp = ++data->mft_cache_stamp;
+	  grub_memcpy (buf, entry->buf, size);
+	  return 0;
+	}
+      if (entry->stamp < victim->stamp)
+	victim = entry;
+    }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%X fails", mftno);
-  return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
+  if (fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    return grub_errno;
+
+  if (!victim->buf)
+    victim->buf = grub_malloc (size);
+  if (victim->buf)
+    {
+      grub_memcpy (victim->buf, buf, size);
+      victim->mftno = mftno;
+      victim->stamp = ++data->mft_cache_stamp;
+    }
+  else
+    grub_errno = GRUB_ERR_NONE;
+  return 0;
 }
 
 static grub_err_t
@@ -588,6 +711,18 @@ free_file (struct grub_ntfs_file *mft)
   grub_free (mft->buf);
 }
 
+static void
+free_data (struct grub_ntfs_data *data)
+{
+  int i;
+
+  free_file (&data->mmft);
+  free_file (&data->cmft);
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    grub_free (data->mft_cache[i].buf);
+  grub_free (data);
+}
+
 static int
 list_file (struct grub_ntfs_file *diro, grub_uint8_t *pos,
 	   grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -995,9 +1130,7 @@ fail:
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   return 0;
 }
@@ -1057,9 +1190,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1106,9 +1237,7 @@ grub_ntfs_open (grub_file_t file, const char *name)
 fail:
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1139,9 +1268,7 @@ grub_ntfs_close (grub_file_t file)
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1208,9 +1335,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1234,9 +1359,7 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
       if (*uuid)
 	for (ptr = *uuid; *ptr; ptr++)
 	  *ptr = grub_toupper (*ptr);
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   else
     *uuid = NULL;
@@ -1246,6 +1369,12 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_ntfs_signatures[] =
+  {
+    { 3, 4, "NTFS" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ntfs_fs =
   {
     .name = "ntfs",
@@ -1255,6 +1384,7 @@ static struct grub_fs grub_ntfs_fs =
     .close = grub_ntfs_close,
     .label = grub_ntfs_label,
     .uuid = grub_ntfs_uuid,
+    .signatures = grub_ntfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1271,6 +1271,12 @@ grub_reiserfs_dir_iter (const char *filename,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = node->mtime;
+  /* Only stat items of files are read.  */
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+    {
+      info.sizeset = 1;
+      info.size = node->size;
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -1378,6 +1384,13 @@ grub_reiserfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_signature grub_reiserfs_signatures[] =
+  {
+    { REISERFS_SUPER_BLOCK_OFFSET + 52, sizeof (REISERFS_MAGIC_STRING) - 1,
+      REISERFS_MAGIC_STRING },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_reiserfs_fs =
   {
     .name = "reiserfs",
@@ -1387,6 +1400,7 @@ static struct grub_fs grub_reiserfs_fs =
     .close = grub_reiserfs_close,
     .label = grub_reiserfs_label,
     .uuid = grub_reiserfs_uuid,
+    .signatures = grub_reiserfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -26,6 +26,10 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/env.h>
+#include <grub/partition.h>
+#include <grub/lz4.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -183,16 +187,52 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
 #define SQUASH_CHUNK_SIZE 0x2000
 #define XZBUFSIZ 0x2000
 
+/* Default size of the decompressed block cache, in KiB.  It may be
+   overridden with the squash4_cache_size variable, 0 disables it.  */
+#define SQUASH_CACHE_DEFAULT_SIZE 1024
+
+/* Identifies the image a cached block belongs to.  */
+struct grub_squash_cache_key
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t creation_time;
+  grub_uint64_t total_size;
+};
+
+/* Decompressed metadata chunk or fragment block.  */
+struct grub_squash_cache_block
+{
+  struct grub_squash_cache_block *next;
+  struct grub_squash_cache_block *prev;
+  struct grub_squash_cache_key key;
+  /* Disk offset of the compressed data.  */
+  grub_uint64_t offset;
+  /* Allocated and decompressed sizes.  */
+  grub_size_t alloc;
+  grub_size_t size;
+  int cached;
+  char data[0];
+};
+
+/* LRU list shared by all mounts, most recently used first.  */
+static struct grub_squash_cache_block *cache_head, *cache_tail;
+static grub_size_t cache_used;
+
 struct grub_squash_data
 {
   grub_disk_t disk;
   struct grub_squash_super sb;
+  struct grub_squash_cache_key cache_key;
   struct grub_squash_cache_inode ino;
   grub_uint64_t fragments;
   int log2_blksz;
@@ -216,6 +256,165 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+static grub_size_t
+cache_budget (void)
+{
+  const char *val;
+  unsigned long kib;
+
+  val = grub_env_get ("squash4_cache_size");
+  if (!val || !*val)
+    return (grub_size_t) SQUASH_CACHE_DEFAULT_SIZE << 10;
+  kib = grub_strtoul (val, 0, 0);
+  if (grub_errno)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return (grub_size_t) SQUASH_CACHE_DEFAULT_SIZE << 10;
+    }
+  return (grub_size_t) kib << 10;
+}
+
+static void
+cache_unlink (struct grub_squash_cache_block *blk)
+{
+  if (blk->prev)
+    blk->prev->next = blk->next;
+  else
+    cache_head = blk->next;
+  if (blk->next)
+    blk->next->prev = blk->prev;
+  else
+    cache_tail = blk->prev;
+  blk->next = blk->prev = NULL;
+}
+
+static void
+cache_link_head (struct grub_squash_cache_block *blk)
+{
+  blk->prev = NULL;
+  blk->next = cache_head;
+  if (cache_head)
+    cache_head->prev = blk;
+  else
+    cache_tail = blk;
+  cache_head = blk;
+}
+
+static void
+cache_flush (void)
+{
+  while (cache_head)
+    {
+      struct grub_squash_cache_block *blk = cache_head;
+      cache_unlink (blk);
+      grub_free (blk);
+    }
+  cache_used = 0;
+}
+
+static struct grub_squash_cache_block *
+cache_find (struct grub_squash_data *data, grub_uint64_t offset)
+{
+  struct grub_squash_cache_block *blk;
+
+  for (blk = cache_head; blk; blk = blk->next)
+    if (blk->offset == offset
+	&& blk->key.dev_id == data->cache_key.dev_id
+	&& blk->key.disk_id == data->cache_key.disk_id
+	&& blk->key.part_start == data->cache_key.part_start
+	&& blk->key.creation_time == data->cache_key.creation_time
+	&& blk->key.total_size == data->cache_key.total_size)
+      {
+	if (blk != cache_head)
+	  {
+	    cache_unlink (blk);
+	    cache_link_head (blk);
+	  }
+	return blk;
+      }
+  return NULL;
+}
+
+static void
+cache_insert (struct grub_squash_cache_block *blk)
+{
+  grub_size_t budget = cache_budget ();
+
+  blk->cached = 0;
+  if (blk->alloc > budget)
+    return;
+  while (cache_tail && cache_used + blk->alloc > budget)
+    {
+      struct grub_squash_cache_block *victim = cache_tail;
+      cache_unlink (victim);
+      cache_used -= victim->alloc;
+      grub_free (victim);
+    }
+  cache_link_head (blk);
+  cache_used += blk->alloc;
+  blk->cached = 1;
+}
+
+/* Return the decompressed contents of the CSIZE bytes at disk offset
+   OFFSET, which are at most USIZE bytes once decompressed.  The block
+   stays valid until the next get_block and must be released with
+   put_block.  */
+static struct grub_squash_cache_block *
+get_block (struct grub_squash_data *data, grub_uint64_t offset,
+	   grub_size_t csize, grub_size_t usize)
+{
+  struct grub_squash_cache_block *blk;
+  grub_ssize_t r;
+  char *tmp;
+  grub_err_t err;
+
+  blk = cache_find (data, offset);
+  if (blk)
+    return blk;
+
+  tmp = grub_malloc (csize);
+  if (!tmp)
+    return NULL;
+  err = grub_disk_read (data->disk, offset >> GRUB_DISK_SECTOR_BITS,
+			offset & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp);
+  if (err)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+
+  blk = grub_malloc (sizeof (*blk) + usize);
+  if (!blk)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+
+  r = data->decompress (tmp, csize, 0, blk->data, usize, data);
+  grub_free (tmp);
+  if (r < 0)
+    {
+      grub_free (blk);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return NULL;
+    }
+
+  blk->key = data->cache_key;
+  blk->offset = offset;
+  blk->alloc = sizeof (*blk) + usize;
+  blk->size = r;
+  cache_insert (blk);
+  return blk;
+}
+
+static void
+put_block (struct grub_squash_cache_block *blk)
+{
+  if (!blk->cached)
+    grub_free (blk);
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +453,19 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  struct grub_squash_cache_block *blk;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
+	  blk = get_block (data, chunk_start + 2, bsize, SQUASH_CHUNK_SIZE);
+	  if (!blk)
+	    return grub_errno;
+	  if (offset + csize > blk->size)
 	    {
-	      grub_free (tmp);
-	      return grub_errno;
+	      put_block (blk);
+	      return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	    }
-	  grub_free (tmp);
+	  grub_memcpy (buf, blk->data + offset, csize);
+	  put_block (blk);
 	}
       len -= csize;
       offset += csize;
@@ -314,6 +503,10 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
       grub_free (udata);
       return -1;
     }
+  if (off >= usize)
+    len = 0;
+  else if (len > usize - off)
+    len = usize - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
@@ -377,6 +570,62 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+/* Helper for codecs which can only decompress whole blocks.  */
+static grub_ssize_t
+whole_block_decompress (grub_ssize_t (*decompress) (const void *inbuf,
+						    grub_size_t insize,
+						    void *outbuf,
+						    grub_size_t outsize),
+			char *inbuf, grub_size_t insize, grub_off_t off,
+			char *outbuf, grub_size_t len,
+			struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  grub_ssize_t ret;
+  char *udata;
+
+  if (usize < SQUASH_CHUNK_SIZE)
+    usize = SQUASH_CHUNK_SIZE;
+
+  /* No block is bigger than usize, so decompress in place if possible.  */
+  if (off == 0 && len >= usize)
+    return decompress (inbuf, insize, outbuf, len);
+
+  udata = grub_malloc (usize);
+  if (!udata)
+    return -1;
+
+  ret = decompress (inbuf, insize, udata, usize);
+  if (ret < 0)
+    {
+      grub_free (udata);
+      return -1;
+    }
+  if (off >= (grub_size_t) ret)
+    len = 0;
+  else if (len > ret - off)
+    len = ret - off;
+  grub_memcpy (outbuf, udata + off, len);
+  grub_free (udata);
+  return len;
+}
+
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  return whole_block_decompress (grub_lz4_decompress, inbuf, insize, off,
+				 outbuf, len, data);
+}
+
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  return whole_block_decompress (grub_zstd_decompress, inbuf, insize, off,
+				 outbuf, len, data);
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -414,6 +663,11 @@ squash_mount (grub_disk_t disk)
   data->sb = sb;
   data->disk = disk;
   data->fragments = grub_le_to_cpu64 (frag);
+  data->cache_key.dev_id = disk->dev->id;
+  data->cache_key.disk_id = disk->id;
+  data->cache_key.part_start = grub_partition_get_start (disk->partition);
+  data->cache_key.creation_time = grub_le_to_cpu32 (sb.creation_time);
+  data->cache_key.total_size = grub_le_to_cpu64 (sb.total_size);
 
   switch (sb.compression)
     {
@@ -439,6 +693,12 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -656,6 +916,19 @@ grub_squash_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = grub_le_to_cpu32 (node->ino.mtime);
+  switch (node->ino.type)
+    {
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_LONG_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu64 (node->ino.long_file.size);
+      break;
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu32 (node->ino.file.size);
+      break;
+    default:
+      break;
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -909,32 +1182,23 @@ grub_squash_read_data (struct grub_squash_data *data,
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
+      struct grub_squash_cache_block *blk;
+
+      /* Fragment blocks are shared by many small files, so keep them
+	 decompressed.  */
+      blk = get_block (data, a, grub_le_to_cpu32 (frag.size), data->blksz);
+      if (!blk)
 	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
+      if (b + len > blk->size)
 	{
-	  grub_free (block);
+	  put_block (blk);
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
-	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	  return -1;
-	}
-      grub_free (block);
+      grub_memcpy (buf, blk->data + b, len);
+      put_block (blk);
     }
   else
     {
@@ -975,6 +1239,12 @@ grub_squash_mtime (grub_device_t dev, grub_int32_t *tm)
   return GRUB_ERR_NONE;
 } 
 
+static const struct grub_fs_signature grub_squash_signatures[] =
+  {
+    { 0, 4, "hsqs" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_squash_fs =
   {
     .name = "squash4",
@@ -983,6 +1253,7 @@ static struct grub_fs grub_squash_fs =
     .read = grub_squash_read,
     .close = grub_squash_close,
     .mtime = grub_squash_mtime,
+    .signatures = grub_squash_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 0,
@@ -998,5 +1269,6 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  cache_flush ();
 }
 
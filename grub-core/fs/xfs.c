@@ -34,6 +34,16 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define XFS_INODE_FORMAT_EXT	2
 #define XFS_INODE_FORMAT_BTREE	3
 
+/* Byte offset of the hash index in leaf and node directories.  */
+#define XFS_DIR2_LEAF_OFFSET	(1ULL << 35)
+
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DA_NODE_MAXDEPTH	5
+
+/* Upper bound of leaf blocks scanned for one run of equal hashes.  */
+#define XFS_DIR2_MAX_HASH_CHAIN	16
 
 struct grub_xfs_sblock
 {
@@ -142,6 +152,40 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } __attribute__ ((packed));
 
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} __attribute__ ((packed));
+
+struct grub_xfs_dir2_leaf_header
+{
+  struct grub_xfs_da_blkinfo info;
+  grub_uint16_t count;
+  grub_uint16_t stale;
+} __attribute__ ((packed));
+
+struct grub_xfs_dir2_leaf_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t address;
+} __attribute__ ((packed));
+
+struct grub_xfs_da_node_header
+{
+  struct grub_xfs_da_blkinfo info;
+  grub_uint16_t count;
+  grub_uint16_t level;
+} __attribute__ ((packed));
+
+struct grub_xfs_da_node_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t before;
+} __attribute__ ((packed));
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -157,6 +201,11 @@ struct grub_xfs_data
   int pos;
   int bsize;
   grub_uint32_t agsize;
+  /* All extents of the BTREE format inode EXTINO, read from the
+     leaves of its bmap btree.  */
+  grub_uint64_t extino;
+  grub_xfs_extent *extents;
+  grub_uint32_t nextents;
   struct grub_fshelp_node diropen;
 };
 
@@ -275,68 +324,132 @@ grub_xfs_read_inode (struct grub_xfs_data *data, grub_uint64_t ino,
 }
 
 
+/* Read the extent list of the BTREE format inode of NODE into
+   NODE->data->extents, unless it is already there.  */
+static grub_err_t
+grub_xfs_load_extents (grub_fshelp_node_t node)
+{
+  struct grub_xfs_data *data = node->data;
+  struct grub_xfs_btree_node *leaf;
+  grub_xfs_extent *exts;
+  grub_uint32_t maxext, n = 0;
+  grub_uint64_t blk;
+  int nrec, recoffset, level, maxrec;
+
+  if (data->extents && data->extino == node->ino)
+    return GRUB_ERR_NONE;
+
+  maxext = grub_be_to_cpu32 (node->inode.nextents);
+  nrec = grub_be_to_cpu16 (node->inode.data.btree.numrecs);
+  level = grub_be_to_cpu16 (node->inode.data.btree.level);
+  if (maxext == 0 || nrec == 0 || level == 0
+      || maxext > GRUB_SIZE_MAX / sizeof (grub_xfs_extent))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid XFS bmap btree root");
+
+  exts = grub_malloc (maxext * sizeof (grub_xfs_extent));
+  if (!exts)
+    return grub_errno;
+
+  leaf = grub_malloc (data->bsize);
+  if (!leaf)
+    {
+      grub_free (exts);
+      return grub_errno;
+    }
+
+  if (node->inode.fork_offset)
+    recoffset = (node->inode.fork_offset - 1) / 2;
+  else
+    recoffset = ((1 << data->sblock.log2_inode)
+		 - ((char *) &node->inode.data.btree.keys
+		    - (char *) &node->inode))
+      / (2 * sizeof (grub_uint64_t));
+  maxrec = ((data->bsize - ((char *) &leaf->keys - (char *) leaf))
+	    / (2 * sizeof (grub_uint64_t)));
+
+  /* Descend along the leftmost path down to the first leaf.  */
+  blk = grub_be_to_cpu64 (node->inode.data.btree.keys[recoffset]);
+  for (;;)
+    {
+      if (grub_disk_read (data->disk,
+			  GRUB_XFS_FSB_TO_BLOCK (data, blk)
+			  << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+			  0, data->bsize, leaf))
+	goto fail;
+
+      level--;
+      if (grub_strncmp ((char *) leaf->magic, "BMAP", 4)
+	  || grub_be_to_cpu16 (leaf->level) != level
+	  || grub_be_to_cpu16 (leaf->numrecs) == 0
+	  || grub_be_to_cpu16 (leaf->numrecs) > maxrec)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+	  goto fail;
+	}
+
+      if (!level)
+	break;
+
+      blk = grub_be_to_cpu64 (leaf->keys[maxrec]);
+    }
+
+  /* Collect the records of all leaves from left to right.  */
+  for (;;)
+    {
+      nrec = grub_be_to_cpu16 (leaf->numrecs);
+      if ((grub_uint32_t) nrec > maxext - n)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "too many extents in XFS BMAP btree");
+	  goto fail;
+	}
+      grub_memcpy (exts + n, leaf->keys, nrec * sizeof (grub_xfs_extent));
+      n += nrec;
+
+      blk = grub_be_to_cpu64 (leaf->right);
+      if (blk == ~(grub_uint64_t) 0)
+	break;
+
+      if (grub_disk_read (data->disk,
+			  GRUB_XFS_FSB_TO_BLOCK (data, blk)
+			  << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+			  0, data->bsize, leaf))
+	goto fail;
+
+      if (grub_strncmp ((char *) leaf->magic, "BMAP", 4)
+	  || leaf->level != 0
+	  || grub_be_to_cpu16 (leaf->numrecs) > maxrec)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+	  goto fail;
+	}
+    }
+
+  grub_free (leaf);
+  grub_free (data->extents);
+  data->extents = exts;
+  data->nextents = n;
+  data->extino = node->ino;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (leaf);
+  grub_free (exts);
+  return grub_errno;
+}
+
 static grub_disk_addr_t
 grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 {
-  struct grub_xfs_btree_node *leaf = 0;
-  int ex, nrec;
+  int nrec, low, high;
   grub_xfs_extent *exts;
   grub_uint64_t ret = 0;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
-      const grub_uint64_t *keys;
-      int recoffset;
-
-      leaf = grub_malloc (node->data->bsize);
-      if (leaf == 0)
-        return 0;
-
-      nrec = grub_be_to_cpu16 (node->inode.data.btree.numrecs);
-      keys = &node->inode.data.btree.keys[0];
-      if (node->inode.fork_offset)
-	recoffset = (node->inode.fork_offset - 1) / 2;
-      else
-	recoffset = ((1 << node->data->sblock.log2_inode)
-		     - ((char *) &node->inode.data.btree.keys
-			- (char *) &node->inode))
-	  / (2 * sizeof (grub_uint64_t));
-      do
-        {
-          int i;
-
-          for (i = 0; i < nrec; i++)
-            {
-              if (fileblock < grub_be_to_cpu64 (keys[i]))
-                break;
-            }
-
-          /* Sparse block.  */
-          if (i == 0)
-            {
-              grub_free (leaf);
-              return 0;
-            }
-          if (grub_disk_read (node->data->disk,
-                              GRUB_XFS_FSB_TO_BLOCK (node->data, grub_be_to_cpu64 (keys[i - 1 + recoffset])) << (node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
-                              0, node->data->bsize, leaf))
-            return 0;
-
-          if (grub_strncmp ((char *) leaf->magic, "BMAP", 4))
-            {
-              grub_free (leaf);
-              grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
-              return 0;
-            }
-
-          nrec = grub_be_to_cpu16 (leaf->numrecs);
-          keys = &leaf->keys[0];
-	  recoffset = ((node->data->bsize - ((char *) &leaf->keys
-					     - (char *) leaf))
-		       / (2 * sizeof (grub_uint64_t)));
-	}
-      while (leaf->level);
-      exts = (grub_xfs_extent *) keys;
+      if (grub_xfs_load_extents (node))
+	return 0;
+      nrec = node->data->nextents;
+      exts = node->data->extents;
     }
   else if (node->inode.format == XFS_INODE_FORMAT_EXT)
     {
@@ -351,25 +464,30 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       return 0;
     }
 
-  /* Iterate over each extent to figure out which extent has
-     the block we are looking for.  */
-  for (ex = 0; ex < nrec; ex++)
+  /* The extents are sorted by offset, find the last one starting at
+     or before the block we are looking for.  */
+  low = 0;
+  high = nrec;
+  while (low < high)
     {
-      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, ex);
-      grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
-      grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, ex);
-
-      /* Sparse block.  */
-      if (fileblock < offset)
-        break;
-      else if (fileblock < offset + size)
-        {
-          ret = (fileblock - offset + start);
-          break;
-        }
+      int mid = low + (high - low) / 2;
+
+      if (GRUB_XFS_EXTENT_OFFSET (exts, mid) <= fileblock)
+	low = mid + 1;
+      else
+	high = mid;
     }
 
-  grub_free (leaf);
+  if (low > 0)
+    {
+      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, low - 1);
+      grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, low - 1);
+      grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, low - 1);
+
+      /* Otherwise it is a sparse block.  */
+      if (fileblock < offset + size)
+	ret = (fileblock - offset + start);
+    }
 
   return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
 }
@@ -441,6 +559,32 @@ grub_xfs_mode_to_filetype (grub_uint16_t mode)
 }
 
 
+/* Allocate a node for the inode INO and read the inode.  */
+static struct grub_fshelp_node *
+grub_xfs_new_node (struct grub_xfs_data *data, grub_uint64_t ino)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node)
+		       - sizeof (struct grub_xfs_inode)
+		       + (1 << data->sblock.log2_inode));
+  if (!fdiro)
+    return 0;
+
+  /* The inode should be read, otherwise the filetype can
+     not be determined.  */
+  fdiro->ino = ino;
+  fdiro->inode_read = 1;
+  fdiro->data = data;
+  if (grub_xfs_read_inode (data, ino, &fdiro->inode))
+    {
+      grub_free (fdiro);
+      return 0;
+    }
+
+  return fdiro;
+}
+
 /* Context for grub_xfs_iterate_dir.  */
 struct grub_xfs_iterate_dir_ctx
 {
@@ -454,29 +598,14 @@ static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
 				  struct grub_xfs_iterate_dir_ctx *ctx)
 {
   struct grub_fshelp_node *fdiro;
-  grub_err_t err;
 
-  fdiro = grub_malloc (sizeof (struct grub_fshelp_node)
-		       - sizeof (struct grub_xfs_inode)
-		       + (1 << ctx->diro->data->sblock.log2_inode));
+  fdiro = grub_xfs_new_node (ctx->diro->data, ino);
   if (!fdiro)
     {
       grub_print_error ();
       return 0;
     }
 
-  /* The inode should be read, otherwise the filetype can
-     not be determined.  */
-  fdiro->ino = ino;
-  fdiro->inode_read = 1;
-  fdiro->data = ctx->diro->data;
-  err = grub_xfs_read_inode (ctx->diro->data, ino, &fdiro->inode);
-  if (err)
-    {
-      grub_print_error ();
-      return 0;
-    }
-
   return ctx->hook (filename, grub_xfs_mode_to_filetype (fdiro->inode.mode),
 		    fdiro, ctx->hook_data);
 }
@@ -657,6 +786,350 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 }
 
 
+/* Compute the hash of directory entry names, as used by the hash
+   index of block, leaf and node directories.  */
+static grub_uint32_t
+grub_xfs_da_hashname (const grub_uint8_t *name, int namelen)
+{
+  grub_uint32_t hash;
+
+#define rol32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+  for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
+    hash = ((name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7)
+	    ^ (name[3] << 0) ^ rol32 (hash, 7 * 4));
+
+  switch (namelen)
+    {
+    case 3:
+      return ((name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0)
+	      ^ rol32 (hash, 7 * 3));
+    case 2:
+      return (name[0] << 7) ^ (name[1] << 0) ^ rol32 (hash, 7 * 2);
+    case 1:
+      return (name[0] << 0) ^ rol32 (hash, 7 * 1);
+    default:
+      return hash;
+    }
+#undef rol32
+}
+
+/* Read LEN bytes at POS of the directory DIR.  Unlike grub_xfs_read_file
+   this can read the hash index, which is stored past the size of the
+   directory.  */
+static grub_err_t
+grub_xfs_read_dir (grub_fshelp_node_t dir, grub_uint64_t pos,
+		   grub_size_t len, void *buf)
+{
+  grub_ssize_t numread;
+
+  numread = grub_fshelp_read_file (dir->data->disk, dir, 0, 0,
+				   pos, len, buf, grub_xfs_read_block,
+				   pos + len,
+				   dir->data->sblock.log2_bsize
+				   - GRUB_DISK_SECTOR_BITS, 0);
+  if (grub_errno)
+    return grub_errno;
+  if (numread != (grub_ssize_t) len)
+    return grub_error (GRUB_ERR_BAD_FS, "incomplete XFS directory read");
+  return GRUB_ERR_NONE;
+}
+
+/* Check whether the directory entry at data address ADDRESS of DIR is
+   called NAME.  BLOCK is the single block of a block directory or NULL.
+   Returns 1 and stores the inode number in INO if it is.  */
+static int
+grub_xfs_check_entry (grub_fshelp_node_t dir, const char *block,
+		      grub_uint32_t address, const char *name,
+		      grub_uint64_t *ino)
+{
+  struct grub_xfs_dir2_entry de;
+  grub_uint64_t pos = (grub_uint64_t) address << 3;
+  grub_size_t namelen = grub_strlen (name);
+  char entname[256];
+
+  if (block)
+    {
+      grub_size_t dirblk_size = 1 << (dir->data->sblock.log2_bsize
+				      + dir->data->sblock.log2_dirblk);
+
+      if (pos + sizeof (de) + namelen > dirblk_size)
+	return 0;
+      grub_memcpy (&de, block + pos, sizeof (de));
+      if (de.len != namelen
+	  || grub_memcmp (block + pos + sizeof (de), name, namelen) != 0)
+	return 0;
+    }
+  else
+    {
+      if (grub_xfs_read_dir (dir, pos, sizeof (de), &de))
+	return 0;
+      if (de.len != namelen
+	  || grub_xfs_read_dir (dir, pos + sizeof (de), namelen, entname)
+	  || grub_memcmp (entname, name, namelen) != 0)
+	return 0;
+    }
+
+  /* Unused space starts with 0xffff.  */
+  if (grub_get_unaligned16 (&de.inode) == 0xffff)
+    return 0;
+
+  *ino = de.inode;
+  return 1;
+}
+
+/* Look up NAME with hash HASH in the COUNT leaf entries ENTS.  Returns 1
+   if found, 0 if not and -1 if the run of entries with hash HASH may
+   continue in the next leaf block.  */
+static int
+grub_xfs_lookup_leaf (grub_fshelp_node_t dir, const char *block,
+		      struct grub_xfs_dir2_leaf_entry *ents, int count,
+		      grub_uint32_t hash, const char *name, grub_uint64_t *ino)
+{
+  int low = 0, high = count;
+
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+
+      if (grub_be_to_cpu32 (ents[mid].hashval) < hash)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+
+  for (; low < count && grub_be_to_cpu32 (ents[low].hashval) == hash; low++)
+    {
+      /* Stale entries have a null address.  */
+      if (ents[low].address == 0)
+	continue;
+
+      if (grub_xfs_check_entry (dir, block,
+				grub_be_to_cpu32 (ents[low].address),
+				name, ino))
+	return 1;
+      if (grub_errno)
+	return 0;
+    }
+
+  if (low == count && count > 0
+      && grub_be_to_cpu32 (ents[count - 1].hashval) == hash)
+    return -1;
+
+  return 0;
+}
+
+/* Find NAME in the block, leaf or node directory DIR using its hash
+   index.  Returns 1 if found, 0 if not and -1 if the directory has to
+   be searched linearly.  */
+static int
+grub_xfs_lookup_hashed (grub_fshelp_node_t dir, const char *name,
+			grub_uint64_t *ino)
+{
+  int dirblk_log2 = (dir->data->sblock.log2_bsize
+		     + dir->data->sblock.log2_dirblk);
+  int dirblk_size = 1 << dirblk_log2;
+  grub_uint32_t hash;
+  char *block;
+  int is_block = 0;
+  int ret = -1;
+
+  hash = grub_xfs_da_hashname ((const grub_uint8_t *) name,
+			       grub_strlen (name));
+
+  block = grub_malloc (dirblk_size);
+  if (!block)
+    return 0;
+
+  if (grub_be_to_cpu64 (dir->inode.size) == (grub_uint64_t) dirblk_size)
+    {
+      if (grub_xfs_read_dir (dir, 0, dirblk_size, block))
+	goto out;
+      is_block = !grub_strncmp (block, "XD2B", 4);
+    }
+
+  if (is_block)
+    {
+      /* A block directory, the hash index is in front of the tail.  */
+      struct grub_xfs_dirblock_tail *tail;
+      grub_uint32_t count;
+
+      tail = (struct grub_xfs_dirblock_tail *)
+	&block[dirblk_size - sizeof (*tail)];
+      count = grub_be_to_cpu32 (tail->leaf_count);
+      if (count > ((dirblk_size - 16 - sizeof (*tail))
+		   / sizeof (struct grub_xfs_dir2_leaf_entry)))
+	goto out;
+
+      ret = grub_xfs_lookup_leaf (dir, block,
+				  (struct grub_xfs_dir2_leaf_entry *) tail
+				  - count, count, hash, name, ino);
+      /* There is no further leaf block.  */
+      if (ret < 0)
+	ret = 0;
+    }
+  else
+    {
+      struct grub_xfs_dir2_leaf_header *leaf = (void *) block;
+      struct grub_xfs_da_node_header *node = (void *) block;
+      grub_uint64_t pos = XFS_DIR2_LEAF_OFFSET;
+      int level = XFS_DA_NODE_MAXDEPTH;
+      int chain;
+
+      /* Descend the node blocks down to the leaf that may have HASH.  */
+      for (;;)
+	{
+	  struct grub_xfs_da_node_entry *ents;
+	  int count, low, high;
+
+	  if (grub_xfs_read_dir (dir, pos, dirblk_size, block))
+	    goto out;
+	  if (grub_be_to_cpu16 (node->info.magic) != XFS_DA_NODE_MAGIC)
+	    break;
+
+	  count = grub_be_to_cpu16 (node->count);
+	  if (grub_be_to_cpu16 (node->level) >= level
+	      || count > ((dirblk_size - (int) sizeof (*node))
+			  / (int) sizeof (*ents)))
+	    goto out;
+	  level = grub_be_to_cpu16 (node->level);
+
+	  /* Each entry has the highest hash of its subtree.  */
+	  ents = (struct grub_xfs_da_node_entry *) (node + 1);
+	  low = 0;
+	  high = count;
+	  while (low < high)
+	    {
+	      int mid = low + (high - low) / 2;
+
+	      if (grub_be_to_cpu32 (ents[mid].hashval) < hash)
+		low = mid + 1;
+	      else
+		high = mid;
+	    }
+	  if (low == count)
+	    {
+	      ret = 0;
+	      goto out;
+	    }
+	  pos = ((grub_uint64_t) grub_be_to_cpu32 (ents[low].before)
+		 << dir->data->sblock.log2_bsize);
+	}
+
+      for (chain = 0; chain < XFS_DIR2_MAX_HASH_CHAIN; chain++)
+	{
+	  int count;
+
+	  if (grub_be_to_cpu16 (leaf->info.magic) != XFS_DIR2_LEAF1_MAGIC
+	      && grub_be_to_cpu16 (leaf->info.magic) != XFS_DIR2_LEAFN_MAGIC)
+	    goto out;
+
+	  count = grub_be_to_cpu16 (leaf->count);
+	  if (count > ((dirblk_size - (int) sizeof (*leaf))
+		       / (int) sizeof (struct grub_xfs_dir2_leaf_entry)))
+	    goto out;
+
+	  ret = grub_xfs_lookup_leaf (dir, 0,
+				      (struct grub_xfs_dir2_leaf_entry *)
+				      (leaf + 1), count, hash, name, ino);
+	  if (ret >= 0 || grub_errno)
+	    goto out;
+
+	  /* The run of equal hashes continues in the next leaf.  */
+	  if (leaf->info.forw == 0)
+	    {
+	      ret = 0;
+	      goto out;
+	    }
+	  pos = ((grub_uint64_t) grub_be_to_cpu32 (leaf->info.forw)
+		 << dir->data->sblock.log2_bsize);
+	  if (grub_xfs_read_dir (dir, pos, dirblk_size, block))
+	    goto out;
+	  ret = -1;
+	}
+    }
+
+ out:
+  grub_free (block);
+  return ret;
+}
+
+/* Context for grub_xfs_lookup.  */
+struct grub_xfs_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_xfs_lookup.  */
+static int
+grub_xfs_lookup_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		      grub_fshelp_node_t node, void *data)
+{
+  struct grub_xfs_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN || grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+static grub_err_t
+grub_xfs_lookup (grub_fshelp_node_t dir, const char *name,
+		 grub_fshelp_node_t *foundnode,
+		 enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  grub_uint64_t ino;
+  int found = -1;
+
+  *foundnode = 0;
+
+  if (dir->inode.format == XFS_INODE_FORMAT_EXT
+      || dir->inode.format == XFS_INODE_FORMAT_BTREE)
+    found = grub_xfs_lookup_hashed (dir, name, &ino);
+
+  if (grub_errno)
+    return grub_errno;
+
+  if (found < 0)
+    {
+      /* Short form directories live in the inode and are small.  They
+	 and directories with an unexpected hash index are searched
+	 linearly.  */
+      grub_xfs_iterate_dir (dir, grub_xfs_lookup_iter, &ctx);
+      return grub_errno;
+    }
+
+  if (!found)
+    return GRUB_ERR_NONE;
+
+  *foundnode = grub_xfs_new_node (dir->data, ino);
+  if (!*foundnode)
+    return grub_errno;
+
+  *foundtype = grub_xfs_mode_to_filetype ((*foundnode)->inode.mode);
+  return GRUB_ERR_NONE;
+}
+
+
+static void
+grub_xfs_free_data (struct grub_xfs_data *data)
+{
+  if (data)
+    grub_free (data->extents);
+  grub_free (data);
+}
+
 static struct grub_xfs_data *
 grub_xfs_mount (grub_disk_t disk)
 {
@@ -731,6 +1204,11 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_be_to_cpu32 (node->inode.mtime.sec);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_be_to_cpu64 (node->inode.size);
+	}
     }
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   grub_free (node);
@@ -751,8 +1229,8 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup (path, &data->diropen, &fdiro, grub_xfs_lookup,
+				grub_xfs_read_symlink, GRUB_FSHELP_DIR);
   if (grub_errno)
     goto fail;
 
@@ -761,7 +1239,7 @@ grub_xfs_dir (grub_device_t device, const char *path,
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_free_data (data);
 
  mount_fail:
 
@@ -784,8 +1262,8 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup (name, &data->diropen, &fdiro, grub_xfs_lookup,
+				grub_xfs_read_symlink, GRUB_FSHELP_REG);
   if (grub_errno)
     goto fail;
 
@@ -814,7 +1292,7 @@ grub_xfs_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_free_data (data);
 
  mount_fail:
   grub_dl_unref (my_mod);
@@ -838,7 +1316,7 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_xfs_free_data (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -862,7 +1340,7 @@ grub_xfs_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_free_data (data);
 
   return grub_errno;
 }
@@ -893,13 +1371,19 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_free_data (data);
 
   return grub_errno;
 }
 
 
 
+static const struct grub_fs_signature grub_xfs_signatures[] =
+  {
+    { 0, 4, "XFSB" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_xfs_fs =
   {
     .name = "xfs",
@@ -909,6 +1393,7 @@ static struct grub_fs grub_xfs_fs =
     .close = grub_xfs_close,
     .label = grub_xfs_label,
     .uuid = grub_xfs_uuid,
+    .signatures = grub_xfs_signatures,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 1,
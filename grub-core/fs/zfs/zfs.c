@@ -36,6 +36,7 @@
 #include <grub/misc.h>
 #include <grub/disk.h>
 #include <grub/partition.h>
+#include <grub/env.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/zfs/zfs.h>
@@ -206,6 +207,11 @@ struct grub_zfs_device_desc
   /* Valid only for RAIDZ.  */
   unsigned nparity;
 
+  /* Set while the last read from this leaf failed.  A RAIDZ parent then
+     reconstructs its columns without trying it, unless that isn't
+     enough.  */
+  int failed;
+
   /* Valid only for leaf devices.  */
   grub_device_t dev;
   grub_disk_addr_t vdev_phys_sector;
@@ -1250,12 +1256,47 @@ static grub_uint8_t powx[255 * 2];
 static int powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+static inline grub_uint8_t
+gf_mul (grub_uint8_t a, grub_uint8_t b)
+{
+  if (a == 0 || b == 0)
+    return 0;
+  return powx[powx_inv[a] + powx_inv[b]];
+}
+
+/* Multiply each of the 8 bytes in V by x.  */
+static inline grub_uint64_t
+gf_mul_x_word (grub_uint64_t v)
+{
+  grub_uint64_t hi = v & 0x8080808080808080ULL;
+
+  return (((v << 1) & 0xfefefefefefefefeULL)
+	  ^ (((hi << 1) - (hi >> 7)) & 0x1d1d1d1d1d1d1d1dULL));
+}
+
+/* Multiply each of the 8 bytes in V by C.  */
+static inline grub_uint64_t
+gf_mul_word (grub_uint64_t v, grub_uint8_t c)
+{
+  grub_uint64_t r = 0;
+
+  while (1)
+    {
+      if (c & 1)
+	r ^= v;
+      c >>= 1;
+      if (!c)
+	return r;
+      v = gf_mul_x_word (v);
+    }
+}
+
 /* perform the operation a ^= b * (x ** (known_idx * recovery_pow) ) */
 static inline void
 xor_out (grub_uint8_t *a, const grub_uint8_t *b, grub_size_t s,
 	 int known_idx, int recovery_pow)
 {
-  int add;
+  grub_uint8_t mul;
 
   /* Simple xor.  */
   if (known_idx == 0 || recovery_pow == 0)
@@ -1263,18 +1304,12 @@ xor_out (grub_uint8_t *a, const grub_uint8_t *b, grub_size_t s,
       grub_crypto_xor (a, a, b, s);
       return;
     }
-  add = (known_idx * recovery_pow) % 255;
-  for (;s--; b++, a++)
-    if (*b)
-      *a ^= powx[powx_inv[*b] + add];
-}
-
-static inline grub_uint8_t
-gf_mul (grub_uint8_t a, grub_uint8_t b)
-{
-  if (a == 0 || b == 0)
-    return 0;
-  return powx[powx_inv[a] + powx_inv[b]];
+  mul = powx[(known_idx * recovery_pow) % 255];
+  for (; s >= 8; s -= 8, a += 8, b += 8)
+    grub_set_unaligned64 (a, grub_get_unaligned64 (a)
+			  ^ gf_mul_word (grub_get_unaligned64 (b), mul));
+  for (; s--; b++, a++)
+    *a ^= gf_mul (*b, mul);
 }
 
 static inline grub_err_t
@@ -1291,14 +1326,15 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
       /* Easy: r_0 = bufs[0] / (x << (powers[i] * idx[j])).  */
     case 1:
       {
-	int add;
+	grub_uint8_t mul;
 	grub_uint8_t *a;
 	if (powers[0] == 0 || idx[0] == 0)
 	  return GRUB_ERR_NONE;
-	add = 255 - ((powers[0] * idx[0]) % 255);
-	for (a = bufs[0]; s--; a++)
-	  if (*a)
-	    *a = powx[powx_inv[*a] + add];
+	mul = powx[255 - ((powers[0] * idx[0]) % 255)];
+	for (a = bufs[0]; s >= 8; s -= 8, a += 8)
+	  grub_set_unaligned64 (a, gf_mul_word (grub_get_unaligned64 (a), mul));
+	for (; s--; a++)
+	  *a = gf_mul (*a, mul);
 	return GRUB_ERR_NONE;
       }
       /* Case 2x2: Let's use the determinant formula.  */
@@ -1317,7 +1353,20 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
 	matrixinv[1][1] = gf_mul (powx[(powers[0] * idx[0]) % 255], det_inv);
 	matrixinv[0][1] = gf_mul (powx[(powers[0] * idx[1]) % 255], det_inv);
 	matrixinv[1][0] = gf_mul (powx[(powers[1] * idx[0]) % 255], det_inv);
-	for (i = 0; i < s; i++)
+	for (i = 0; i + 8 <= s; i += 8)
+	  {
+	    grub_uint64_t b0, b1;
+	    b0 = grub_get_unaligned64 (bufs[0] + i);
+	    b1 = grub_get_unaligned64 (bufs[1] + i);
+
+	    grub_set_unaligned64 (bufs[0] + i,
+				  gf_mul_word (b0, matrixinv[0][0])
+				  ^ gf_mul_word (b1, matrixinv[0][1]));
+	    grub_set_unaligned64 (bufs[1] + i,
+				  gf_mul_word (b0, matrixinv[1][0])
+				  ^ gf_mul_word (b1, matrixinv[1][1]));
+	  }
+	for (; i < s; i++)
 	  {
 	    grub_uint8_t b0, b1;
 	    b0 = bufs[0][i];
@@ -1399,7 +1448,20 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
 	      }
 	  }
 
-	for (i = 0; i < (int) s; i++)
+	for (i = 0; i + 8 <= (int) s; i += 8)
+	  {
+	    grub_uint64_t b[nbufs], r;
+	    for (j = 0; j < nbufs; j++)
+	      b[j] = grub_get_unaligned64 (bufs[j] + i);
+	    for (j = 0; j < nbufs; j++)
+	      {
+		r = 0;
+		for (k = 0; k < nbufs; k++)
+		  r ^= gf_mul_word (b[k], matrix2[j][k]);
+		grub_set_unaligned64 (bufs[j] + i, r);
+	      }
+	  }
+	for (; i < (int) s; i++)
 	  {
 	    grub_uint8_t b[nbufs];
 	    for (j = 0; j < nbufs; j++)
@@ -1467,12 +1529,22 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	grub_size_t recovery_len[4];
 	int recovery_idx[4];
 	unsigned failed_devices = 0;
+	/* Members passed over because of an earlier failure.  */
+	unsigned skipped;
+	int skip_failed = 1;
 	int idx, orig_idx;
+	grub_err_t err;
 
 	if (desc->nparity < 1 || desc->nparity > 3)
 	  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, 
 			     "raidz%d is not supported", desc->nparity);
 
+	retry:
+	c = 0;
+	failed_devices = 0;
+	skipped = 0;
+	buf = orig_buf;
+	len = orig_len;
 	orig_s = (((len + (1 << desc->ashift) - 1) >> desc->ashift)
 		  + (desc->n_children - desc->nparity) - 1);
 	s = orig_s;
@@ -1493,7 +1565,6 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	  {
 	    grub_size_t csize;
 	    grub_uint32_t bsize;
-	    grub_err_t err;
 	    bsize = s / (desc->n_children - desc->nparity);
 
 	    if (desc->nparity == 1
@@ -1513,10 +1584,23 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 			  PRIxGRUB_UINT64_T ")\n",
 			  offset >> desc->ashift, c, len, bsize, high,
 			  devn);
-	    err = read_device ((high << desc->ashift)
-			       | (offset & ((1 << desc->ashift) - 1)),
-			       &desc->children[devn],
-			       csize, buf);
+	    /* Don't wait for a member which already failed while parity
+	       can still stand in for it.  */
+	    if (skip_failed && desc->children[devn].failed
+		&& failed_devices < desc->nparity)
+	      {
+		err = GRUB_ERR_READ_ERROR;
+		skipped++;
+	      }
+	    else
+	      {
+		err = read_device ((high << desc->ashift)
+				   | (offset & ((1 << desc->ashift) - 1)),
+				   &desc->children[devn],
+				   csize, buf);
+		if (desc->children[devn].dev)
+		  desc->children[devn].failed = !!err;
+	      }
 	    if (err && failed_devices < desc->nparity)
 	      {
 		recovery_buf[failed_devices] = buf;
@@ -1526,7 +1610,7 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 		grub_errno = err = 0;
 	      }
 	    if (err)
-	      return err;
+	      goto fail;
 
 	    c++;
 	    idx--;
@@ -1540,7 +1624,6 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	    unsigned cur_redundancy_pow = 0;
 	    unsigned n_redundancy = 0;
 	    unsigned i, j;
-	    grub_err_t err;
 
 	    /* Compute mul. x**s has a period of 255.  */
 	    if (powx[0] == 0)
@@ -1570,11 +1653,20 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 							 - desc->max_children_ashift))
 					     & 1)),
 				      desc->n_children, &devn);
+		if (skip_failed && desc->children[devn].failed
+		    && (n_redundancy + desc->nparity - cur_redundancy_pow - 1
+			>= failed_devices))
+		  {
+		    skipped++;
+		    continue;
+		  }
 		err = read_device ((high << desc->ashift)
 				   | (offset & ((1 << desc->ashift) - 1)),
 				   &desc->children[devn],
 				   recovery_len[n_redundancy],
 				   recovery_buf[n_redundancy]);
+		if (desc->children[devn].dev)
+		  desc->children[devn].failed = !!err;
 		/* Ignore error if we may still have enough devices.  */
 		if (err && n_redundancy + desc->nparity - cur_redundancy_pow - 1
 		    >= failed_devices)
@@ -1583,7 +1675,7 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 		    continue;
 		  }
 		if (err)
-		  return err;
+		  goto fail;
 		redundancy_pow[n_redundancy] = cur_redundancy_pow;
 		n_redundancy++;
 	      }
@@ -1629,14 +1721,25 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 		err = recovery (tmp_recovery_buf, recovery_len[0] - recovery_len[failed_devices - 1], i, redundancy_pow,
 				recovery_idx);
 		if (err)
-		  return err;
+		  goto fail;
 	      }
 	    err = recovery (recovery_buf, recovery_len[failed_devices - 1],
 			    failed_devices, redundancy_pow, recovery_idx);
 	    if (err)
-	      return err;
+	      goto fail;
 	  }
 	return GRUB_ERR_NONE;
+
+      fail:
+	/* Members skipped as failed might have been only transiently so;
+	   give them another chance before giving up.  */
+	if (skip_failed && skipped)
+	  {
+	    skip_failed = 0;
+	    grub_errno = GRUB_ERR_NONE;
+	    goto retry;
+	  }
+	return err;
       }
     }
   return grub_error (GRUB_ERR_BAD_FS, "unsupported device type");
@@ -1769,6 +1872,174 @@ zio_read_data (blkptr_t * bp, grub_zfs_endian_t endian, void *buf,
   return err;
 }
 
+/*
+ * Cache of verified and decompressed blocks, shared by all mounts.
+ * Blocks are identified by pool, first DVA, birth txg and checksum, so a
+ * cached copy is only ever returned for the very same block.
+ */
+
+/* Default size of the block cache, in KiB.  It may be overridden with
+   the zfs_cache_size variable, 0 disables it.  */
+#define ZIO_CACHE_DEFAULT_SIZE 4096
+#define ZIO_CACHE_HASH_SIZE 64
+
+struct zio_cache_block
+{
+  /* LRU list.  */
+  struct zio_cache_block *next, *prev;
+  /* Hash chain.  */
+  struct zio_cache_block *hash_next;
+  unsigned hash;
+  grub_uint64_t guid;
+  dva_t dva;
+  grub_uint64_t birth;
+  zio_cksum_t cksum;
+  grub_size_t size;
+  char data[0];
+};
+
+/* Most recently used first.  */
+static struct zio_cache_block *zio_cache_head, *zio_cache_tail;
+static struct zio_cache_block *zio_cache_hash[ZIO_CACHE_HASH_SIZE];
+static grub_size_t zio_cache_used;
+
+static grub_size_t
+zio_cache_budget (void)
+{
+  const char *val;
+  unsigned long kib;
+
+  val = grub_env_get ("zfs_cache_size");
+  if (!val || !*val)
+    return (grub_size_t) ZIO_CACHE_DEFAULT_SIZE << 10;
+  kib = grub_strtoul (val, 0, 0);
+  if (grub_errno)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return (grub_size_t) ZIO_CACHE_DEFAULT_SIZE << 10;
+    }
+  return (grub_size_t) kib << 10;
+}
+
+static unsigned
+zio_cache_hashval (const blkptr_t *bp)
+{
+  grub_uint64_t v = (bp->blk_dva[0].dva_word[1] ^ bp->blk_birth
+		     ^ bp->blk_cksum.zc_word[0]);
+
+  v ^= (v >> 32) ^ (v >> 13);
+  return (unsigned) v % ZIO_CACHE_HASH_SIZE;
+}
+
+static void
+zio_cache_unlink (struct zio_cache_block *blk)
+{
+  if (blk->prev)
+    blk->prev->next = blk->next;
+  else
+    zio_cache_head = blk->next;
+  if (blk->next)
+    blk->next->prev = blk->prev;
+  else
+    zio_cache_tail = blk->prev;
+}
+
+static void
+zio_cache_link_head (struct zio_cache_block *blk)
+{
+  blk->prev = NULL;
+  blk->next = zio_cache_head;
+  if (zio_cache_head)
+    zio_cache_head->prev = blk;
+  else
+    zio_cache_tail = blk;
+  zio_cache_head = blk;
+}
+
+static void
+zio_cache_remove (struct zio_cache_block *blk)
+{
+  struct zio_cache_block **p;
+
+  for (p = &zio_cache_hash[blk->hash]; *p != blk; p = &(*p)->hash_next);
+  *p = blk->hash_next;
+  zio_cache_unlink (blk);
+  zio_cache_used -= blk->size;
+  grub_free (blk);
+}
+
+static void
+zio_cache_flush (void)
+{
+  while (zio_cache_head)
+    zio_cache_remove (zio_cache_head);
+}
+
+/* Copy the cached contents of BP, if any, to a new buffer in *BUF.  */
+static int
+zio_cache_get (blkptr_t *bp, void **buf, struct grub_zfs_data *data)
+{
+  struct zio_cache_block *blk;
+
+  for (blk = zio_cache_hash[zio_cache_hashval (bp)]; blk;
+       blk = blk->hash_next)
+    if (blk->guid == data->guid
+	&& blk->birth == bp->blk_birth
+	&& grub_memcmp (&blk->dva, &bp->blk_dva[0], sizeof (blk->dva)) == 0
+	&& grub_memcmp (&blk->cksum, &bp->blk_cksum, sizeof (blk->cksum)) == 0)
+      break;
+  if (!blk)
+    return 0;
+
+  *buf = grub_malloc (blk->size);
+  if (!*buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_memcpy (*buf, blk->data, blk->size);
+
+  if (blk != zio_cache_head)
+    {
+      zio_cache_unlink (blk);
+      zio_cache_link_head (blk);
+    }
+  return 1;
+}
+
+static void
+zio_cache_put (blkptr_t *bp, const void *buf, grub_size_t size,
+	       struct grub_zfs_data *data)
+{
+  struct zio_cache_block *blk;
+  grub_size_t budget = zio_cache_budget ();
+
+  if (size > budget / 4)
+    return;
+
+  blk = grub_malloc (sizeof (*blk) + size);
+  if (!blk)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  blk->guid = data->guid;
+  blk->dva = bp->blk_dva[0];
+  blk->birth = bp->blk_birth;
+  blk->cksum = bp->blk_cksum;
+  blk->size = size;
+  grub_memcpy (blk->data, buf, size);
+
+  while (zio_cache_tail && zio_cache_used + size > budget)
+    zio_cache_remove (zio_cache_tail);
+
+  blk->hash = zio_cache_hashval (bp);
+  blk->hash_next = zio_cache_hash[blk->hash];
+  zio_cache_hash[blk->hash] = blk;
+  zio_cache_link_head (blk);
+  zio_cache_used += size;
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1783,9 +2054,12 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   grub_err_t err;
   zio_cksum_t zc = bp->blk_cksum;
   grub_uint32_t checksum;
+  grub_uint64_t prop;
+  int cacheable;
 
   *buf = NULL;
 
+  prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
   checksum = (grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 40) & 0xff;
   comp = (grub_zfs_to_cpu64((bp)->blk_prop, endian)>>32) & 0xff;
   encrypted = ((grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 60) & 3);
@@ -1797,6 +2071,14 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   if (size)
     *size = lsize;
 
+  /* File contents are kept by zfs_read itself and would only push the
+     metadata out.  Decrypted data isn't kept around either.  */
+  cacheable = (lsize != 0 && !encrypted
+	       && !(((prop >> 56) & 0x1f) == 0
+		    && ((prop >> 48) & 0xff) == DMU_OT_PLAIN_FILE_CONTENTS));
+  if (cacheable && zio_cache_get (bp, buf, data))
+    return GRUB_ERR_NONE;
+
   if (comp >= ZIO_COMPRESS_FUNCTIONS)
     return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		       "compression algorithm %u not supported\n", (unsigned int) comp);
@@ -1901,6 +2183,9 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	}
     }
 
+  if (cacheable)
+    zio_cache_put (bp, *buf, lsize, data);
+
   return GRUB_ERR_NONE;
 }
 
@@ -1944,7 +2229,7 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
 						dn->endian) 
 	    << SPA_MINBLOCKSHIFT;
 	  *buf = grub_malloc (size);
-	  if (*buf)
+	  if (!*buf)
 	    {
 	      err = grub_errno;
 	      break;
@@ -4257,4 +4542,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zio_cache_flush ();
 }
@@ -37,6 +37,9 @@
 #include <grub/zfs/dmu_objset.h>
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
 
 void
 fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
@@ -60,25 +63,154 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+/*
+ * Fletcher-4 is computed on four interleaved streams of words whose sums
+ * don't depend on each other, which keeps the CPU busy instead of waiting
+ * for one long chain of additions.  The sums of the streams are combined
+ * into the plain Fletcher-4 ones at the end, as OpenZFS does.
+ */
+#define FLETCHER_4_LANE(i, conv)		\
+  a[i] += conv (ip[i]);				\
+  b[i] += a[i];					\
+  c[i] += b[i];					\
+  d[i] += c[i]
+
+#define FLETCHER_4_STEP(conv)			\
+  do						\
+    {						\
+      FLETCHER_4_LANE (0, conv);		\
+      FLETCHER_4_LANE (1, conv);		\
+      FLETCHER_4_LANE (2, conv);		\
+      FLETCHER_4_LANE (3, conv);		\
+    }						\
+  while (0)
+
+#if defined (__i386__) || defined (__x86_64__)
+#ifdef __SSE__
+# define SSE_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+# define SSE_CLOBBERS "cc", "memory"
+#endif
+
+/* %xmm0 to %xmm3 hold a, b, c and d of two lanes, one fed by the even
+   and one by the odd words, %xmm4 and %xmm5 the zero-extended words and
+   %xmm7 zero.  */
+#define FLETCHER_4_SSE2_LOOP(swap)		\
+  "pxor %%xmm0, %%xmm0\n\t"			\
+  "pxor %%xmm1, %%xmm1\n\t"			\
+  "pxor %%xmm2, %%xmm2\n\t"			\
+  "pxor %%xmm3, %%xmm3\n\t"			\
+  "pxor %%xmm7, %%xmm7\n\t"			\
+  "1:\n\t"					\
+  "movdqu (%[ip]), %%xmm4\n\t"			\
+  swap						\
+  "movdqa %%xmm4, %%xmm5\n\t"			\
+  "punpckldq %%xmm7, %%xmm4\n\t"		\
+  "punpckhdq %%xmm7, %%xmm5\n\t"		\
+  "paddq %%xmm4, %%xmm0\n\t"			\
+  "paddq %%xmm0, %%xmm1\n\t"			\
+  "paddq %%xmm1, %%xmm2\n\t"			\
+  "paddq %%xmm2, %%xmm3\n\t"			\
+  "paddq %%xmm5, %%xmm0\n\t"			\
+  "paddq %%xmm0, %%xmm1\n\t"			\
+  "paddq %%xmm1, %%xmm2\n\t"			\
+  "paddq %%xmm2, %%xmm3\n\t"			\
+  "add $16, %[ip]\n\t"				\
+  "sub $1, %[n]\n\t"				\
+  "jnz 1b\n\t"					\
+  "movdqu %%xmm0, (%[lanes])\n\t"		\
+  "movdqu %%xmm1, 16(%[lanes])\n\t"		\
+  "movdqu %%xmm2, 32(%[lanes])\n\t"		\
+  "movdqu %%xmm3, 48(%[lanes])\n\t"
+
+/* Swap the bytes of each word in %xmm4, SSE2 has no PSHUFB.  */
+#define FLETCHER_4_SSE2_BSWAP			\
+  "movdqa %%xmm4, %%xmm5\n\t"			\
+  "psrlw $8, %%xmm4\n\t"			\
+  "psllw $8, %%xmm5\n\t"			\
+  "por %%xmm5, %%xmm4\n\t"			\
+  "pshuflw $0xb1, %%xmm4, %%xmm4\n\t"		\
+  "pshufhw $0xb1, %%xmm4, %%xmm4\n\t"
+
+/* Fletcher-4 of N groups of four words at IP in two lanes of SSE2
+   registers.  The lane sums are combined into the plain ones, as
+   OpenZFS does.  */
+static void
+fletcher_4_sse2 (const grub_uint32_t *ip, grub_size_t n,
+		 grub_zfs_endian_t endian, grub_uint64_t *A, grub_uint64_t *B,
+		 grub_uint64_t *C, grub_uint64_t *D)
+{
+  /* a, b, c and d of both lanes.  */
+  grub_uint64_t l[8];
+
+  if (endian == GRUB_ZFS_BIG_ENDIAN)
+    asm volatile (FLETCHER_4_SSE2_LOOP (FLETCHER_4_SSE2_BSWAP)
+		  : [ip] "+r" (ip), [n] "+r" (n)
+		  : [lanes] "r" (l)
+		  : SSE_CLOBBERS);
+  else
+    asm volatile (FLETCHER_4_SSE2_LOOP ("")
+		  : [ip] "+r" (ip), [n] "+r" (n)
+		  : [lanes] "r" (l)
+		  : SSE_CLOBBERS);
+
+  *A = l[0] + l[1];
+  *B = 2 * l[2] + 2 * l[3] - l[1];
+  *C = 4 * l[4] - l[2] + 4 * l[5] - 3 * l[3];
+  *D = 8 * l[6] - 4 * l[4] + 8 * l[7] - 8 * l[5] + l[3];
+}
+#endif
+
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
-  grub_uint64_t a, b, c, d;
-  
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+  const grub_uint32_t *ip4 = ip + ((ipend - ip) & ~3);
+  grub_uint64_t a[4] = { 0 }, b[4] = { 0 }, c[4] = { 0 }, d[4] = { 0 };
+  grub_uint64_t A, B, C, D;
+
+#if defined (__i386__) || defined (__x86_64__)
+  if ((grub_cpu_sse_features () & GRUB_CPU_SSE2) && ip < ip4)
     {
-      a += grub_zfs_to_cpu32 (ip[0], endian);;
-      b += a;
-      c += b;
-      d += c;
+      fletcher_4_sse2 (ip, (ip4 - ip) / 4, endian, &A, &B, &C, &D);
+      ip = ip4;
     }
+  else
+#endif
+    {
+      if (endian == GRUB_ZFS_BIG_ENDIAN)
+	for (; ip < ip4; ip += 4)
+	  FLETCHER_4_STEP (grub_be_to_cpu32);
+      else
+	for (; ip < ip4; ip += 4)
+	  FLETCHER_4_STEP (grub_le_to_cpu32);
 
-  zcp->zc_word[0] = grub_cpu_to_zfs64 (a, endian);
-  zcp->zc_word[1] = grub_cpu_to_zfs64 (b, endian);
-  zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
-  zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
-}
+      A = a[0] + a[1] + a[2] + a[3];
+      B = (4 * (b[0] + b[1] + b[2] + b[3])
+	   - a[1] - 2 * a[2] - 3 * a[3]);
+      C = (16 * (c[0] + c[1] + c[2] + c[3])
+	   + a[2] + 3 * a[3]
+	   - 6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3]);
+      D = (64 * (d[0] + d[1] + d[2] + d[3])
+	   - a[3]
+	   + 4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3]
+	   - 48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3]);
+    }
 
+  /* Less than four words left.  */
+  for (; ip < ipend; ip++) 
+    {
+      A += grub_zfs_to_cpu32 (ip[0], endian);
+      B += A;
+      C += B;
+      D += C;
+    }
+
+  zcp->zc_word[0] = grub_cpu_to_zfs64 (A, endian);
+  zcp->zc_word[1] = grub_cpu_to_zfs64 (B, endian);
+  zcp->zc_word[2] = grub_cpu_to_zfs64 (C, endian);
+  zcp->zc_word[3] = grub_cpu_to_zfs64 (D, endian);
+}
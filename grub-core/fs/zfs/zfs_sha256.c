@@ -37,13 +37,17 @@
 #include <grub/zfs/dmu_objset.h>
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
 
 /*
  * SHA-256 checksum, as specified in FIPS 180-2, available at:
  * http://csrc.nist.gov/cryptval
  *
- * This is a very compact implementation of SHA-256.
- * It is designed to be simple and portable, not to be fast.
+ * The message schedule is kept in a 16 word window and the rounds are
+ * unrolled eight at a time, so that no variables have to be shuffled
+ * around between rounds.
  */
 
 /*
@@ -62,7 +66,7 @@
 #define	sigma0(x)	(Rot32(x, 7) ^ Rot32(x, 18) ^ ((x) >> 3))
 #define	sigma1(x)	(Rot32(x, 17) ^ Rot32(x, 19) ^ ((x) >> 10))
 
-static const grub_uint32_t SHA256_K[64] = {
+static const grub_uint32_t SHA256_K[64] __attribute__ ((aligned (16))) = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
 	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -81,32 +85,146 @@ static const grub_uint32_t SHA256_K[64] = {
 	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+#define	ROUND(a, b, c, d, e, f, g, h, t)				\
+	T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + W[(t) & 15];	\
+	d += T1;							\
+	h = T1 + SIGMA0(a) + Maj(a, b, c)
+
+#define	SCHEDULE(t)							\
+	W[(t) & 15] += sigma1(W[((t) - 2) & 15]) + W[((t) - 7) & 15] +	\
+	    sigma0(W[((t) - 15) & 15])
+
 static void
 SHA256Transform(grub_uint32_t *H, const grub_uint8_t *cp)
 {
-	grub_uint32_t a, b, c, d, e, f, g, h, t, T1, T2, W[64];
+	grub_uint32_t a, b, c, d, e, f, g, h, t, T1, W[16];
 
 	for (t = 0; t < 16; t++, cp += 4)
-		W[t] = (cp[0] << 24) | (cp[1] << 16) | (cp[2] << 8) | cp[3];
-
-	for (t = 16; t < 64; t++)
-		W[t] = sigma1(W[t - 2]) + W[t - 7] +
-		    sigma0(W[t - 15]) + W[t - 16];
+		W[t] = grub_be_to_cpu32(grub_get_unaligned32(cp));
 
 	a = H[0]; b = H[1]; c = H[2]; d = H[3];
 	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
-	for (t = 0; t < 64; t++) {
-		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + W[t];
-		T2 = SIGMA0(a) + Maj(a, b, c);
-		h = g; g = f; f = e; e = d + T1;
-		d = c; c = b; b = a; a = T1 + T2;
+	for (t = 0; t < 64; t += 8) {
+		if (t >= 16) {
+			SCHEDULE(t); SCHEDULE(t + 1);
+			SCHEDULE(t + 2); SCHEDULE(t + 3);
+			SCHEDULE(t + 4); SCHEDULE(t + 5);
+			SCHEDULE(t + 6); SCHEDULE(t + 7);
+		}
+		ROUND(a, b, c, d, e, f, g, h, t);
+		ROUND(h, a, b, c, d, e, f, g, t + 1);
+		ROUND(g, h, a, b, c, d, e, f, t + 2);
+		ROUND(f, g, h, a, b, c, d, e, t + 3);
+		ROUND(e, f, g, h, a, b, c, d, t + 4);
+		ROUND(d, e, f, g, h, a, b, c, t + 5);
+		ROUND(c, d, e, f, g, h, a, b, t + 6);
+		ROUND(b, c, d, e, f, g, h, a, t + 7);
 	}
 
 	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
+#if defined (__i386__) || defined (__x86_64__)
+#ifdef __SSE__
+# define SHANI_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+# define SHANI_CLOBBERS "cc", "memory"
+#endif
+
+static const grub_uint8_t shani_bswap_mask[16] __attribute__ ((aligned (16))) =
+	{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+
+/*
+ * The same transform with the Intel SHA extensions, as in the libgcrypt
+ * SHA-256.  %xmm0 holds the message words plus constants and is the
+ * implicit operand of sha256rnds2, %xmm1 and %xmm2 the ABEF and CDGH
+ * halves of the state, %xmm3 to %xmm6 the message schedule.
+ */
+#define	SHANI_LOAD(i, m)						\
+	"movdqu " #i "*16(%[cp]), %%xmm0\n\t"				\
+	"pshufb %[mask], %%xmm0\n\t"					\
+	"movdqa %%xmm0, %%xmm" #m "\n\t"
+#define	SHANI_MOV(m)							\
+	"movdqa %%xmm" #m ", %%xmm0\n\t"
+#define	SHANI_RND1(i)							\
+	"paddd " #i "*16(%[k]), %%xmm0\n\t"				\
+	"sha256rnds2 %%xmm1, %%xmm2\n\t"
+#define	SHANI_RND2							\
+	"pshufd $0x0e, %%xmm0, %%xmm0\n\t"				\
+	"sha256rnds2 %%xmm2, %%xmm1\n\t"
+#define	SHANI_MSG1(c, p)						\
+	"sha256msg1 %%xmm" #c ", %%xmm" #p "\n\t"
+#define	SHANI_MSG2(c, p, n)						\
+	"movdqa %%xmm" #c ", %%xmm7\n\t"					\
+	"palignr $4, %%xmm" #p ", %%xmm7\n\t"				\
+	"paddd %%xmm7, %%xmm" #n "\n\t"					\
+	"sha256msg2 %%xmm" #c ", %%xmm" #n "\n\t"
+
+static void
+SHA256TransformSHANI(grub_uint32_t *H, const grub_uint8_t *cp)
+{
+	asm volatile(
+	    /* DCBA, HGFE -> ABEF, CDGH.  */
+	    "movdqu (%[H]), %%xmm1\n\t"
+	    "movdqu 16(%[H]), %%xmm2\n\t"
+	    "pshufd $0xb1, %%xmm1, %%xmm1\n\t"
+	    "pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+	    "movdqa %%xmm1, %%xmm7\n\t"
+	    "palignr $8, %%xmm2, %%xmm1\n\t"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n\t"
+
+	    SHANI_LOAD(0, 3) SHANI_RND1(0) SHANI_RND2
+	    SHANI_LOAD(1, 4) SHANI_RND1(1) SHANI_RND2 SHANI_MSG1(4, 3)
+	    SHANI_LOAD(2, 5) SHANI_RND1(2) SHANI_RND2 SHANI_MSG1(5, 4)
+	    SHANI_LOAD(3, 6) SHANI_RND1(3) SHANI_MSG2(6, 5, 3)
+	    SHANI_RND2 SHANI_MSG1(6, 5)
+	    SHANI_MOV(3) SHANI_RND1(4) SHANI_MSG2(3, 6, 4)
+	    SHANI_RND2 SHANI_MSG1(3, 6)
+	    SHANI_MOV(4) SHANI_RND1(5) SHANI_MSG2(4, 3, 5)
+	    SHANI_RND2 SHANI_MSG1(4, 3)
+	    SHANI_MOV(5) SHANI_RND1(6) SHANI_MSG2(5, 4, 6)
+	    SHANI_RND2 SHANI_MSG1(5, 4)
+	    SHANI_MOV(6) SHANI_RND1(7) SHANI_MSG2(6, 5, 3)
+	    SHANI_RND2 SHANI_MSG1(6, 5)
+	    SHANI_MOV(3) SHANI_RND1(8) SHANI_MSG2(3, 6, 4)
+	    SHANI_RND2 SHANI_MSG1(3, 6)
+	    SHANI_MOV(4) SHANI_RND1(9) SHANI_MSG2(4, 3, 5)
+	    SHANI_RND2 SHANI_MSG1(4, 3)
+	    SHANI_MOV(5) SHANI_RND1(10) SHANI_MSG2(5, 4, 6)
+	    SHANI_RND2 SHANI_MSG1(5, 4)
+	    SHANI_MOV(6) SHANI_RND1(11) SHANI_MSG2(6, 5, 3)
+	    SHANI_RND2 SHANI_MSG1(6, 5)
+	    SHANI_MOV(3) SHANI_RND1(12) SHANI_MSG2(3, 6, 4)
+	    SHANI_RND2 SHANI_MSG1(3, 6)
+	    SHANI_MOV(4) SHANI_RND1(13) SHANI_MSG2(4, 3, 5)
+	    SHANI_RND2
+	    SHANI_MOV(5) SHANI_RND1(14) SHANI_MSG2(5, 4, 6)
+	    SHANI_RND2
+	    SHANI_MOV(6) SHANI_RND1(15)
+	    SHANI_RND2
+
+	    /* ABEF, CDGH -> DCBA, HGFE and add the previous state.  */
+	    "pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+	    "pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+	    "movdqa %%xmm1, %%xmm7\n\t"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+	    "palignr $8, %%xmm7, %%xmm2\n\t"
+	    "movdqu (%[H]), %%xmm3\n\t"
+	    "movdqu 16(%[H]), %%xmm4\n\t"
+	    "paddd %%xmm3, %%xmm1\n\t"
+	    "paddd %%xmm4, %%xmm2\n\t"
+	    "movdqu %%xmm1, (%[H])\n\t"
+	    "movdqu %%xmm2, 16(%[H])\n\t"
+	    :
+	    : [H] "r" (H), [cp] "r" (cp), [k] "r" (SHA256_K),
+	      [mask] "m" (shani_bswap_mask)
+	    : SHANI_CLOBBERS);
+}
+#endif
+
 void
 zio_checksum_SHA256(const void *buf, grub_uint64_t size,
 		    grub_zfs_endian_t endian, zio_cksum_t *zcp)
@@ -116,12 +234,23 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   grub_uint8_t pad[128];
   unsigned padsize = size & 63;
   unsigned i;
+  void (*transform) (grub_uint32_t *H, const grub_uint8_t *cp)
+    = SHA256Transform;
+
+#if defined (__i386__) || defined (__x86_64__)
+  {
+    unsigned int need = GRUB_CPU_SHA | GRUB_CPU_SSSE3 | GRUB_CPU_SSE4_1;
+
+    if ((grub_cpu_sse_features () & need) == need)
+      transform = SHA256TransformSHANI;
+  }
+#endif
   
   for (i = 0; i < size - padsize; i += 64)
-    SHA256Transform(H, (grub_uint8_t *)buf + i);
+    transform(H, (grub_uint8_t *)buf + i);
   
   for (i = 0; i < padsize; i++)
-    pad[i] = ((grub_uint8_t *)buf)[i];
+    pad[i] = ((grub_uint8_t *)buf)[size - padsize + i];
   
   for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
     pad[padsize] = 0;
@@ -130,7 +259,7 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
     pad[padsize++] = (size << 3) >> (56 - 8 * i);
   
   for (i = 0; i < padsize && i <= 64; i += 64)
-    SHA256Transform(H, pad + i);
+    transform(H, pad + i);
   
   zcp->zc_word[0] = grub_cpu_to_zfs64 ((grub_uint64_t)H[0] << 32 | H[1], 
 				       endian);
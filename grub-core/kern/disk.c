@@ -46,6 +46,8 @@ static struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
+grub_disk_read_record_hook_t grub_disk_read_record_hook;
+unsigned int grub_disk_generation;
 
 #if DISK_CACHE_STATS
 static unsigned long grub_disk_cache_hits;
@@ -94,6 +96,9 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
+  grub_fs_probe_invalidate ();
+  grub_partition_probe_invalidate ();
+
   for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
@@ -185,6 +190,7 @@ grub_disk_dev_register (grub_disk_dev_t dev)
 {
   dev->next = grub_disk_dev_list;
   grub_disk_dev_list = dev;
+  grub_disk_generation++;
 }
 
 void
@@ -489,6 +495,9 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  if (grub_disk_read_record_hook)
+    grub_disk_read_record_hook (disk, sector, offset, size);
+
   real_sector = sector;
   real_offset = offset;
   real_size = size;
@@ -625,6 +634,10 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     return -1;
 
+  /* The filesystem or partition map found on the disk may change.  */
+  grub_fs_probe_invalidate ();
+  grub_partition_probe_invalidate ();
+
   aligned_sector = (sector & ~((1 << (disk->log_sector_size
 				      - GRUB_DISK_SECTOR_BITS)) - 1));
   real_offset = offset + ((sector - aligned_sector) << GRUB_DISK_SECTOR_BITS);
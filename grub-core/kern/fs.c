@@ -27,11 +27,108 @@
 #include <grub/mm.h>
 #include <grub/term.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 grub_fs_t grub_fs_list = 0;
 
 grub_fs_autoload_hook_t grub_fs_autoload_hook = 0;
 
+/* Signatures within this many bytes from the start of the device are
+   checked with a single read.  */
+#define FS_SIGNATURE_WINDOW	4096
+
+#ifndef GRUB_UTIL
+#define FS_PROBE_CACHE_SIZE	8
+
+/* The filesystems found by recent probes.  */
+static struct
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_fs_t fs;
+} fs_probe_cache[FS_PROBE_CACHE_SIZE];
+static unsigned fs_probe_cache_next;
+
+static grub_disk_addr_t
+fs_probe_start (grub_disk_t disk)
+{
+  return disk->partition ? grub_partition_get_start (disk->partition) : 0;
+}
+
+static grub_fs_t
+fs_probe_cache_get (grub_disk_t disk)
+{
+  grub_disk_addr_t start = fs_probe_start (disk);
+  grub_fs_t p;
+  unsigned i;
+
+  for (i = 0; i < FS_PROBE_CACHE_SIZE; i++)
+    if (fs_probe_cache[i].fs && fs_probe_cache[i].dev_id == disk->dev->id
+	&& fs_probe_cache[i].disk_id == disk->id
+	&& fs_probe_cache[i].start == start)
+      /* The module may have been unloaded since.  */
+      FOR_FILESYSTEMS (p)
+	if (p == fs_probe_cache[i].fs)
+	  return p;
+  return 0;
+}
+
+static void
+fs_probe_cache_put (grub_disk_t disk, grub_fs_t fs)
+{
+  fs_probe_cache[fs_probe_cache_next].dev_id = disk->dev->id;
+  fs_probe_cache[fs_probe_cache_next].disk_id = disk->id;
+  fs_probe_cache[fs_probe_cache_next].start = fs_probe_start (disk);
+  fs_probe_cache[fs_probe_cache_next].fs = fs;
+  fs_probe_cache_next = (fs_probe_cache_next + 1) % FS_PROBE_CACHE_SIZE;
+}
+#endif
+
+/* Forget the results of previous probes.  Called whenever a disk is
+   written to, the disk cache is flushed or a loopback device is
+   rebound.  */
+void
+grub_fs_probe_invalidate (void)
+{
+#ifndef GRUB_UTIL
+  grub_memset (fs_probe_cache, 0, sizeof (fs_probe_cache));
+#endif
+}
+
+/* Check whether FS may be on DISK.  WINDOW holds the first
+   FS_SIGNATURE_WINDOW bytes of DISK, or is NULL if they couldn't be
+   read.  */
+static int
+fs_signature_match (grub_fs_t fs, grub_disk_t disk, const char *window)
+{
+  const struct grub_fs_signature *sig;
+  char buf[16];
+
+  if (!fs->signatures)
+    return 1;
+
+  for (sig = fs->signatures; sig->len; sig++)
+    {
+      if (sig->len > sizeof (buf))
+	return 1;
+      if (window && sig->offset + sig->len <= FS_SIGNATURE_WINDOW)
+	{
+	  if (grub_memcmp (window + sig->offset, sig->magic, sig->len) == 0)
+	    return 1;
+	  continue;
+	}
+      if (grub_disk_read (disk, 0, sig->offset, sig->len, buf))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      if (grub_memcmp (buf, sig->magic, sig->len) == 0)
+	return 1;
+    }
+  return 0;
+}
+
 /* Helper for grub_fs_probe.  */
 static int
 probe_dummy_iter (const char *filename __attribute__ ((unused)),
@@ -45,14 +142,33 @@ grub_fs_t
 grub_fs_probe (grub_device_t device)
 {
   grub_fs_t p;
+  char *window = 0;
 
   if (device->disk)
     {
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
 
+#ifndef GRUB_UTIL
+      p = fs_probe_cache_get (device->disk);
+      if (p)
+	return p;
+#endif
+
+      window = grub_malloc (FS_SIGNATURE_WINDOW);
+      if (window && grub_disk_read (device->disk, 0, 0,
+				    FS_SIGNATURE_WINDOW, window))
+	{
+	  grub_free (window);
+	  window = 0;
+	}
+      grub_errno = GRUB_ERR_NONE;
+
       for (p = grub_fs_list; p; p = p->next)
 	{
+	  if (!fs_signature_match (p, device->disk, window))
+	    continue;
+
 	  grub_dprintf ("fs", "Detecting %s...\n", p->name);
 
 	  /* This is evil: newly-created just mounted BtrFS after copying all
@@ -72,7 +188,7 @@ grub_fs_probe (grub_device_t device)
 #endif
 	    (p->dir) (device, "/", probe_dummy_iter, NULL);
 	  if (grub_errno == GRUB_ERR_NONE)
-	    return p;
+	    goto found;
 
 	  grub_error_push ();
 	  grub_dprintf ("fs", "%s detection failed.\n", p->name);
@@ -80,11 +196,16 @@ grub_fs_probe (grub_device_t device)
 
 	  if (grub_errno != GRUB_ERR_BAD_FS
 	      && grub_errno != GRUB_ERR_OUT_OF_RANGE)
-	    return 0;
+	    {
+	      grub_free (window);
+	      return 0;
+	    }
 
 	  grub_errno = GRUB_ERR_NONE;
 	}
 
+      grub_free (window);
+
       /* Let's load modules automatically.  */
       if (grub_fs_autoload_hook && count == 0)
 	{
@@ -98,7 +219,8 @@ grub_fs_probe (grub_device_t device)
 	      if (grub_errno == GRUB_ERR_NONE)
 		{
 		  count--;
-		  return p;
+		  window = 0;
+		  goto found;
 		}
 
 	      if (grub_errno != GRUB_ERR_BAD_FS
@@ -119,6 +241,13 @@ grub_fs_probe (grub_device_t device)
 
   grub_error (GRUB_ERR_UNKNOWN_FS, N_("unknown filesystem"));
   return 0;
+
+ found:
+  grub_free (window);
+#ifndef GRUB_UTIL
+  fs_probe_cache_put (device->disk, p);
+#endif
+  return p;
 }
 
 
@@ -28,6 +28,248 @@
 
 grub_partition_map_t grub_partition_map_list;
 
+#ifndef GRUB_UTIL
+#define PARTMAP_CACHE_HASH_SIZE	64
+
+/* The outcome of running one partition map over one disk or partition:
+   either the partitions it reported or GRUB_ERR_BAD_PART_TABLE.  */
+struct partmap_cache_entry
+{
+  struct partmap_cache_entry *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t parent_start;
+  grub_uint64_t parent_len;
+  grub_partition_map_t parent_partmap;
+  grub_uint8_t parent_msdostype;
+  const struct grub_partition_map *partmap;
+  grub_err_t err;
+  /* Number of replays in progress and whether the entry was dropped from
+     the table meanwhile.  */
+  int refcnt;
+  int dead;
+  unsigned nparts;
+  struct grub_partition parts[0];
+};
+
+static struct partmap_cache_entry *partmap_cache[PARTMAP_CACHE_HASH_SIZE];
+/* Bumped on every invalidation so that runs spanning one aren't kept.  */
+static unsigned long partmap_cache_generation;
+
+static unsigned
+partmap_cache_hash (grub_disk_t disk, grub_disk_addr_t parent_start,
+		    const struct grub_partition_map *partmap)
+{
+  return ((disk->dev->id * 524287UL + disk->id * 2606459UL
+	   + (unsigned) parent_start + (unsigned) (grub_addr_t) partmap)
+	  % PARTMAP_CACHE_HASH_SIZE);
+}
+
+static int
+partmap_cache_match (const struct partmap_cache_entry *e, grub_disk_t disk,
+		     grub_disk_addr_t parent_start,
+		     const struct grub_partition_map *partmap)
+{
+  const struct grub_partition *parent = disk->partition;
+
+  return (e->dev_id == disk->dev->id && e->disk_id == disk->id
+	  && e->partmap == partmap && e->parent_start == parent_start
+	  && e->parent_len == (parent ? parent->len : 0)
+	  && e->parent_partmap == (parent ? parent->partmap : NULL)
+	  && e->parent_msdostype == (parent ? parent->msdostype : 0));
+}
+#endif
+
+/* Forget all cached partition map results.  Called whenever a disk is
+   written to or the disk cache is flushed.  */
+void
+grub_partition_probe_invalidate (void)
+{
+#ifndef GRUB_UTIL
+  unsigned i;
+
+  for (i = 0; i < PARTMAP_CACHE_HASH_SIZE; i++)
+    {
+      struct partmap_cache_entry *e, *next;
+
+      for (e = partmap_cache[i]; e; e = next)
+	{
+	  next = e->next;
+	  if (e->refcnt)
+	    e->dead = 1;
+	  else
+	    grub_free (e);
+	}
+      partmap_cache[i] = 0;
+    }
+  partmap_cache_generation++;
+#endif
+}
+
+#ifndef GRUB_UTIL
+/* Context for partmap_iterate.  */
+struct partmap_record_ctx
+{
+  grub_partition_iterate_hook_t hook;
+  void *hook_data;
+  struct partmap_cache_entry *entry;
+  unsigned alloc;
+  /* HOOK asked to stop; the remaining partitions are only recorded.  */
+  int stopped;
+  /* HOOK stopped with an error.  */
+  int hook_failed;
+  /* The record is incomplete.  */
+  int failed;
+};
+
+/* Helper for partmap_iterate.  */
+static int
+record_iter (grub_disk_t dsk, const grub_partition_t partition, void *data)
+{
+  struct partmap_record_ctx *ctx = data;
+
+  if (!ctx->failed && ctx->entry->nparts == ctx->alloc)
+    {
+      struct partmap_cache_entry *n;
+
+      n = grub_realloc (ctx->entry, sizeof (*n) + 2 * ctx->alloc
+			* sizeof (n->parts[0]));
+      if (n)
+	{
+	  ctx->entry = n;
+	  ctx->alloc *= 2;
+	}
+      else
+	{
+	  ctx->failed = 1;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+  if (!ctx->failed)
+    ctx->entry->parts[ctx->entry->nparts++] = *partition;
+
+  if (ctx->stopped)
+    return ctx->failed;
+
+  if (ctx->hook (dsk, partition, ctx->hook_data))
+    {
+      ctx->stopped = 1;
+      if (grub_errno)
+	ctx->hook_failed = ctx->failed = 1;
+      /* Keep going so that the whole map gets recorded.  */
+      return ctx->failed;
+    }
+  return 0;
+}
+#endif
+
+/* Run PARTMAP over DISK, replaying the result of an earlier run on the
+   same disk and parent partition when available.  */
+static grub_err_t
+partmap_iterate (const struct grub_partition_map *partmap, grub_disk_t disk,
+		 grub_partition_iterate_hook_t hook, void *hook_data)
+{
+#ifdef GRUB_UTIL
+  return partmap->iterate (disk, hook, hook_data);
+#else
+  struct partmap_record_ctx ctx = {
+    .hook = hook,
+    .hook_data = hook_data,
+    .alloc = 4,
+    .stopped = 0,
+    .hook_failed = 0,
+    .failed = 0
+  };
+  grub_disk_addr_t parent_start;
+  struct partmap_cache_entry *e;
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned long generation;
+  unsigned h, i;
+
+  parent_start = disk->partition ? grub_partition_get_start (disk->partition)
+    : 0;
+  h = partmap_cache_hash (disk, parent_start, partmap);
+
+  for (e = partmap_cache[h]; e; e = e->next)
+    if (partmap_cache_match (e, disk, parent_start, partmap))
+      break;
+
+  if (e)
+    {
+      if (e->err)
+	return grub_error (e->err, "no %s partition map found",
+			   partmap->name);
+
+      /* The hook may flush the cache, so pin the entry while replaying.  */
+      e->refcnt++;
+      for (i = 0; i < e->nparts; i++)
+	{
+	  struct grub_partition p = e->parts[i];
+
+	  p.parent = disk->partition;
+	  if (hook (disk, &p, hook_data))
+	    {
+	      err = grub_errno;
+	      break;
+	    }
+	}
+      if (--e->refcnt == 0 && e->dead)
+	grub_free (e);
+      return err;
+    }
+
+  ctx.entry = grub_malloc (sizeof (*ctx.entry)
+			   + ctx.alloc * sizeof (ctx.entry->parts[0]));
+  if (!ctx.entry)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return partmap->iterate (disk, hook, hook_data);
+    }
+  ctx.entry->nparts = 0;
+  generation = partmap_cache_generation;
+
+  err = partmap->iterate (disk, record_iter, &ctx);
+
+  /* A nested probe from the hook may have recorded the same map already.  */
+  for (e = partmap_cache[h]; e; e = e->next)
+    if (partmap_cache_match (e, disk, parent_start, partmap))
+      break;
+
+  /* Only complete runs with a definite answer are worth keeping.  */
+  if (e || ctx.failed || generation != partmap_cache_generation
+      || (err != GRUB_ERR_NONE && err != GRUB_ERR_BAD_PART_TABLE)
+      || (ctx.stopped && err != GRUB_ERR_NONE))
+    grub_free (ctx.entry);
+  else
+    {
+      e = ctx.entry;
+      e->dev_id = disk->dev->id;
+      e->disk_id = disk->id;
+      e->parent_start = parent_start;
+      e->parent_len = disk->partition ? disk->partition->len : 0;
+      e->parent_partmap = disk->partition ? disk->partition->partmap : NULL;
+      e->parent_msdostype = disk->partition ? disk->partition->msdostype : 0;
+      e->partmap = partmap;
+      e->err = err;
+      e->refcnt = 0;
+      e->dead = 0;
+      if (err)
+	e->nparts = 0;
+      e->next = partmap_cache[h];
+      partmap_cache[h] = e;
+    }
+
+  /* HOOK got what it asked for; errors met while recording the rest of
+     the map are not its concern.  */
+  if (ctx.stopped && !ctx.hook_failed)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  return err;
+#endif
+}
+
 /*
  * Checks that disk->partition contains part.  This function assumes that the
  * start of part is relative to the start of disk->partition.  Returns 1 if
@@ -95,7 +337,7 @@ grub_partition_map_probe (const grub_partition_map_t partmap,
     .p = 0
   };
 
-  partmap->iterate (disk, probe_iter, &ctx);
+  partmap_iterate (partmap, disk, probe_iter, &ctx);
   if (grub_errno)
     goto fail;
 
@@ -205,7 +447,7 @@ part_iterate (grub_disk_t dsk, const grub_partition_t partition, void *data)
       FOR_PARTITION_MAPS(partmap)
       {
 	grub_err_t err;
-	err = partmap->iterate (dsk, part_iterate, ctx);
+	err = partmap_iterate (partmap, dsk, part_iterate, ctx);
 	if (err)
 	  grub_errno = GRUB_ERR_NONE;
 	if (ctx->ret)
@@ -230,7 +472,7 @@ grub_partition_iterate (struct grub_disk *disk,
   FOR_PARTITION_MAPS(partmap)
   {
     grub_err_t err;
-    err = partmap->iterate (disk, part_iterate, &ctx);
+    err = partmap_iterate (partmap, disk, part_iterate, &ctx);
     if (err)
       grub_errno = GRUB_ERR_NONE;
     if (ctx.ret)
@@ -217,6 +217,12 @@ grub_crypto_ecb_decrypt (grub_crypto_cipher_handle_t cipher,
     return GPG_ERR_NOT_SUPPORTED;
   if (size % cipher->cipher->blocksize != 0)
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->ecb_decrypt)
+    {
+      cipher->cipher->ecb_decrypt (cipher->ctx, out, in,
+				   size / cipher->cipher->blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += cipher->cipher->blocksize, outptr += cipher->cipher->blocksize)
@@ -234,6 +240,12 @@ grub_crypto_ecb_encrypt (grub_crypto_cipher_handle_t cipher,
     return GPG_ERR_NOT_SUPPORTED;
   if (size % cipher->cipher->blocksize != 0)
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->ecb_encrypt)
+    {
+      cipher->cipher->ecb_encrypt (cipher->ctx, out, in,
+				   size / cipher->cipher->blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += cipher->cipher->blocksize, outptr += cipher->cipher->blocksize)
@@ -252,6 +264,12 @@ grub_crypto_cbc_encrypt (grub_crypto_cipher_handle_t cipher,
     return GPG_ERR_NOT_SUPPORTED;
   if (size % cipher->cipher->blocksize != 0)
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->cbc_encrypt)
+    {
+      cipher->cipher->cbc_encrypt (cipher->ctx, iv_in, out, in,
+				   size / cipher->cipher->blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (grub_uint8_t *) in + size;
   iv = iv_in;
   for (inptr = in, outptr = out; inptr < end;
@@ -277,6 +295,12 @@ grub_crypto_cbc_decrypt (grub_crypto_cipher_handle_t cipher,
     return GPG_ERR_NOT_SUPPORTED;
   if (size % cipher->cipher->blocksize != 0)
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->cbc_decrypt)
+    {
+      cipher->cipher->cbc_decrypt (cipher->ctx, iv, out, in,
+				   size / cipher->cipher->blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += cipher->cipher->blocksize, outptr += cipher->cipher->blocksize)
@@ -289,6 +313,36 @@ grub_crypto_cbc_decrypt (grub_crypto_cipher_handle_t cipher,
   return GPG_ERR_NO_ERROR;
 }
 
+/* XTS is only available from ciphers providing it in bulk; callers
+   fall back to ECB with their own tweaks otherwise.  */
+gcry_err_code_t
+grub_crypto_xts_encrypt (grub_crypto_cipher_handle_t cipher,
+			 void *out, const void *in, grub_size_t size,
+			 void *tweak)
+{
+  if (!cipher->cipher->xts_crypt)
+    return GPG_ERR_NOT_SUPPORTED;
+  if (size % cipher->cipher->blocksize != 0)
+    return GPG_ERR_INV_ARG;
+  cipher->cipher->xts_crypt (cipher->ctx, tweak, out, in,
+			     size / cipher->cipher->blocksize, 1);
+  return GPG_ERR_NO_ERROR;
+}
+
+gcry_err_code_t
+grub_crypto_xts_decrypt (grub_crypto_cipher_handle_t cipher,
+			 void *out, const void *in, grub_size_t size,
+			 void *tweak)
+{
+  if (!cipher->cipher->xts_crypt)
+    return GPG_ERR_NOT_SUPPORTED;
+  if (size % cipher->cipher->blocksize != 0)
+    return GPG_ERR_INV_ARG;
+  cipher->cipher->xts_crypt (cipher->ctx, tweak, out, in,
+			     size / cipher->cipher->blocksize, 0);
+  return GPG_ERR_NO_ERROR;
+}
+
 /* Based on gcry/cipher/md.c.  */
 struct grub_crypto_hmac_handle *
 grub_crypto_hmac_init (const struct gcry_md_spec *md,
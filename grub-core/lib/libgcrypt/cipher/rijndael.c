@@ -60,6 +60,14 @@
 # endif
 #endif /*ENABLE_PADLOCK_SUPPORT*/
 
+/* USE_AESNI indicates whether to compile the AES-NI code.  */
+#undef USE_AESNI
+#ifdef HWF_INTEL_AESNI
+# if (defined (__i386__) || defined (__x86_64__)) && defined (__GNUC__)
+# define USE_AESNI
+# endif
+#endif /*HWF_INTEL_AESNI*/
+
 static const char *selftest(void);
 
 typedef struct 
@@ -70,6 +78,9 @@ typedef struct
   int use_padlock;          /* Padlock shall be used.  */
   /* The key as passed to the padlock engine.  */
   unsigned char padlock_key[16] __attribute__ ((aligned (16)));
+#endif
+#ifdef USE_AESNI
+  int use_aesni;            /* AES-NI shall be used.  */
 #endif
   union
   {
@@ -81,6 +92,9 @@ typedef struct
     PROPERLY_ALIGNED_TYPE dummy;
     byte keyschedule[MAXROUNDS+1][4][4];	
   } u2;
+  /* The key schedule bitsliced for the constant time code, each round
+     key duplicated for the two blocks processed at once.  */
+  u32 ctKeySched[MAXROUNDS+1][8];
 } RIJNDAEL_context;
 
 #define keySched  u1.keyschedule
@@ -90,6 +104,444 @@ typedef struct
 #include "rijndael-tables.h"
 
 
+
+/* Constant time implementation, used when AES-NI isn't available.  Two
+   blocks are processed at once, bitsliced into eight 32-bit words: word
+   I holds bit I of every byte, and the byte in row R and column C of
+   block B sits at bit 8*R + 2*C + B.  No memory access depends on the
+   key or the data, so neither leaks through the cache.  */
+
+/* An upper bound of the stack used by the constant time code, for
+   _gcry_burn_stack.  */
+#define CT_BURN_STACK (160 * sizeof (u32))
+
+/* Apply the S-box to every byte of Q.  This is the circuit of Boyar and
+   Peralta, with 32 S-boxes evaluated in parallel.  */
+static void
+ct_sbox (u32 *q)
+{
+  u32 x0, x1, x2, x3, x4, x5, x6, x7;
+  u32 y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  u32 y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  u32 y20, y21;
+  u32 z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  u32 z10, z11, z12, z13, z14, z15, z16, z17;
+  u32 t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  u32 t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  u32 t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  u32 t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  u32 t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  u32 t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  u32 t60, t61, t62, t63, t64, t65, t66, t67;
+  u32 s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  /* Top linear transformation.  */
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  /* Non-linear section.  */
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  /* Bottom linear transformation.  */
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+/* The inverse of the affine transformation of the S-box, including its
+   constant.  */
+static void
+ct_inv_affine (u32 *q)
+{
+  u32 q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  u32 q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+
+  q[0] = ~(q2 ^ q5 ^ q7);
+  q[1] = q3 ^ q6 ^ q0;
+  q[2] = ~(q4 ^ q7 ^ q1);
+  q[3] = q5 ^ q0 ^ q2;
+  q[4] = q6 ^ q1 ^ q3;
+  q[5] = q7 ^ q2 ^ q4;
+  q[6] = q0 ^ q3 ^ q5;
+  q[7] = q1 ^ q4 ^ q6;
+}
+
+/* Apply the inverse S-box to every byte of Q.  Inverting in GF(2^8) is
+   the S-box with its affine transformation undone on both sides.  */
+static void
+ct_inv_sbox (u32 *q)
+{
+  ct_inv_affine (q);
+  ct_sbox (q);
+  ct_inv_affine (q);
+}
+
+/* Substitute the four bytes of W, as the key schedule does.  */
+static u32
+ct_sub_word (u32 w)
+{
+  u32 q[8], r = 0;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    q[i] = (w >> i) & 0x01010101;
+  ct_sbox (q);
+  for (i = 0; i < 8; i++)
+    r |= (q[i] & 0x01010101) << i;
+  return r;
+}
+
+/* Swap the bits of A selected by MASK << N with those of B selected by
+   MASK.  */
+#define ct_swapmove(a, b, mask, n)                      \
+  do                                                    \
+    {                                                   \
+      u32 tmp_ = ((b) ^ ((a) >> (n))) & (mask);         \
+      (b) ^= tmp_;                                      \
+      (a) ^= tmp_ << (n);                               \
+    }                                                   \
+  while (0)
+
+/* Transpose the 8x8 bit matrix in each byte lane of Q.  This is its
+   own inverse.  */
+static void
+ct_transpose (u32 *q)
+{
+  ct_swapmove (q[0], q[1], 0x55555555, 1);
+  ct_swapmove (q[2], q[3], 0x55555555, 1);
+  ct_swapmove (q[4], q[5], 0x55555555, 1);
+  ct_swapmove (q[6], q[7], 0x55555555, 1);
+  ct_swapmove (q[0], q[2], 0x33333333, 2);
+  ct_swapmove (q[1], q[3], 0x33333333, 2);
+  ct_swapmove (q[4], q[6], 0x33333333, 2);
+  ct_swapmove (q[5], q[7], 0x33333333, 2);
+  ct_swapmove (q[0], q[4], 0x0f0f0f0f, 4);
+  ct_swapmove (q[1], q[5], 0x0f0f0f0f, 4);
+  ct_swapmove (q[2], q[6], 0x0f0f0f0f, 4);
+  ct_swapmove (q[3], q[7], 0x0f0f0f0f, 4);
+}
+
+/* Bitslice NBLOCKS (one or two) blocks from IN into Q.  Word 2*C + B
+   starts out as column C of block B, one row per byte lane, so the
+   transposition puts every byte at bit 8*R + 2*C + B.  */
+static void
+ct_load (u32 *q, const byte *in, int nblocks)
+{
+  int b, c;
+
+  for (c = 0; c < 4; c++)
+    for (b = 0; b < 2; b++)
+      {
+        const byte *p = in + b * BLOCKSIZE + 4 * c;
+
+        q[2 * c + b] = b < nblocks ? (p[0] | (p[1] << 8) | (p[2] << 16)
+                                      | ((u32) p[3] << 24)) : 0;
+      }
+  ct_transpose (q);
+}
+
+/* Store NBLOCKS blocks from Q to OUT.  Q is clobbered.  */
+static void
+ct_store (byte *out, u32 *q, int nblocks)
+{
+  int b, c;
+
+  ct_transpose (q);
+  for (c = 0; c < 4; c++)
+    for (b = 0; b < nblocks; b++)
+      {
+        byte *p = out + b * BLOCKSIZE + 4 * c;
+        u32 w = q[2 * c + b];
+
+        p[0] = w;
+        p[1] = w >> 8;
+        p[2] = w >> 16;
+        p[3] = w >> 24;
+      }
+}
+
+static void
+ct_add_round_key (u32 *q, const u32 *sk)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+    q[i] ^= sk[i];
+}
+
+static void
+ct_shift_rows (u32 *q)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+    {
+      u32 x = q[i];
+
+      q[i] = (x & 0x000000FF)
+        | ((x & 0x0000FC00) >> 2) | ((x & 0x00000300) << 6)
+        | ((x & 0x00F00000) >> 4) | ((x & 0x000F0000) << 4)
+        | ((x & 0xC0000000) >> 6) | ((x & 0x3F000000) << 2);
+    }
+}
+
+static void
+ct_inv_shift_rows (u32 *q)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+    {
+      u32 x = q[i];
+
+      q[i] = (x & 0x000000FF)
+        | ((x & 0x00003F00) << 2) | ((x & 0x0000C000) >> 6)
+        | ((x & 0x00F00000) >> 4) | ((x & 0x000F0000) << 4)
+        | ((x & 0x03000000) << 6) | ((x & 0xFC000000) >> 2);
+    }
+}
+
+/* The bytes of the next row, in the same columns.  */
+#define ct_rotr(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Multiply every byte of A by x in GF(2^8).  */
+static void
+ct_xtime (u32 *r, const u32 *a)
+{
+  r[0] = a[7];
+  r[1] = a[0] ^ a[7];
+  r[2] = a[1];
+  r[3] = a[2] ^ a[7];
+  r[4] = a[3] ^ a[7];
+  r[5] = a[4];
+  r[6] = a[5];
+  r[7] = a[6];
+}
+
+static void
+ct_mix_columns (u32 *q)
+{
+  u32 a[8], r[8];
+  int i;
+
+  /* 2*a0 + 3*a1 + a2 + a3 = 2*(a0 + a1) + a1 + a2 + a3.  */
+  for (i = 0; i < 8; i++)
+    a[i] = q[i] ^ ct_rotr (q[i], 8);
+  ct_xtime (r, a);
+  for (i = 0; i < 8; i++)
+    q[i] = r[i] ^ ct_rotr (q[i], 8) ^ ct_rotr (q[i], 16)
+      ^ ct_rotr (q[i], 24);
+}
+
+static void
+ct_inv_mix_columns (u32 *q)
+{
+  u32 a[8], r[8];
+  int i;
+
+  /* Multiplying by 4*(a0 + a2) first turns the inverse into MixColumns
+     itself.  */
+  for (i = 0; i < 8; i++)
+    a[i] = q[i] ^ ct_rotr (q[i], 16);
+  ct_xtime (r, a);
+  ct_xtime (a, r);
+  for (i = 0; i < 8; i++)
+    q[i] ^= a[i];
+  ct_mix_columns (q);
+}
+
+/* Bitslice the key schedule computed by do_setkey.  */
+static void
+ct_prepare (RIJNDAEL_context *ctx)
+{
+  byte k[2 * BLOCKSIZE];
+  int r;
+
+  for (r = 0; r <= ctx->ROUNDS; r++)
+    {
+      memcpy (k, ctx->keySched[r], BLOCKSIZE);
+      memcpy (k + BLOCKSIZE, ctx->keySched[r], BLOCKSIZE);
+      ct_load (ctx->ctKeySched[r], k, 2);
+    }
+  memset (k, 0, sizeof (k));
+}
+
+/* Encrypt NBLOCKS (one or two) blocks.  A and B may be the same.  */
+static void
+ct_encrypt (const RIJNDAEL_context *ctx, byte *b, const byte *a,
+            int nblocks)
+{
+  u32 q[8];
+  int r;
+
+  ct_load (q, a, nblocks);
+  ct_add_round_key (q, ctx->ctKeySched[0]);
+  for (r = 1; r < ctx->ROUNDS; r++)
+    {
+      ct_sbox (q);
+      ct_shift_rows (q);
+      ct_mix_columns (q);
+      ct_add_round_key (q, ctx->ctKeySched[r]);
+    }
+  ct_sbox (q);
+  ct_shift_rows (q);
+  ct_add_round_key (q, ctx->ctKeySched[ctx->ROUNDS]);
+  ct_store (b, q, nblocks);
+}
+
+/* Decrypt NBLOCKS (one or two) blocks.  A and B may be the same.  */
+static void
+ct_decrypt (const RIJNDAEL_context *ctx, byte *b, const byte *a,
+            int nblocks)
+{
+  u32 q[8];
+  int r;
+
+  ct_load (q, a, nblocks);
+  ct_add_round_key (q, ctx->ctKeySched[ctx->ROUNDS]);
+  for (r = ctx->ROUNDS - 1; r > 0; r--)
+    {
+      ct_inv_shift_rows (q);
+      ct_inv_sbox (q);
+      ct_add_round_key (q, ctx->ctKeySched[r]);
+      ct_inv_mix_columns (q);
+    }
+  ct_inv_shift_rows (q);
+  ct_inv_sbox (q);
+  ct_add_round_key (q, ctx->ctKeySched[0]);
+  ct_store (b, q, nblocks);
+}
+
+
 /* Perform the key setup.  */  
 static gcry_err_code_t
 do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
@@ -99,6 +551,7 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
   int ROUNDS;
   int i,j, r, t, rconpointer = 0;
   int KC;
+  u32 s;
   union
   {
     PROPERLY_ALIGNED_TYPE dummy;
@@ -133,6 +586,9 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
 #ifdef USE_PADLOCK
   ctx->use_padlock = 0;
 #endif
+#ifdef USE_AESNI
+  ctx->use_aesni = 0;
+#endif
 
   if( keylen == 128/8 )
     {
@@ -161,6 +617,12 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
 
   ctx->ROUNDS = ROUNDS;
 
+#ifdef USE_AESNI
+  /* The AES-NI code uses the key schedule computed below.  */
+  if ((_gcry_get_hw_features () & HWF_INTEL_AESNI))
+    ctx->use_aesni = 1;
+#endif
+
 #ifdef USE_PADLOCK
   if (ctx->use_padlock)
     {
@@ -200,10 +662,13 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
         {
           /* While not enough round key material calculated calculate
              new values.  */
-          tk[0][0] ^= S[tk[KC-1][1]];
-          tk[0][1] ^= S[tk[KC-1][2]];
-          tk[0][2] ^= S[tk[KC-1][3]];
-          tk[0][3] ^= S[tk[KC-1][0]];
+          s = ct_sub_word (tk[KC-1][1] | (tk[KC-1][2] << 8)
+                           | (tk[KC-1][3] << 16)
+                           | ((u32) tk[KC-1][0] << 24));
+          tk[0][0] ^= s;
+          tk[0][1] ^= s >> 8;
+          tk[0][2] ^= s >> 16;
+          tk[0][3] ^= s >> 24;
           tk[0][0] ^= rcon[rconpointer++];
           
           if (KC != 8)
@@ -219,10 +684,13 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
                 {
                   *((u32*)tk[j]) ^= *((u32*)tk[j-1]);
                 }
-              tk[KC/2][0] ^= S[tk[KC/2 - 1][0]];
-              tk[KC/2][1] ^= S[tk[KC/2 - 1][1]];
-              tk[KC/2][2] ^= S[tk[KC/2 - 1][2]];
-              tk[KC/2][3] ^= S[tk[KC/2 - 1][3]];
+              s = ct_sub_word (tk[KC/2 - 1][0] | (tk[KC/2 - 1][1] << 8)
+                               | (tk[KC/2 - 1][2] << 16)
+                               | ((u32) tk[KC/2 - 1][3] << 24));
+              tk[KC/2][0] ^= s;
+              tk[KC/2][1] ^= s >> 8;
+              tk[KC/2][2] ^= s >> 16;
+              tk[KC/2][3] ^= s >> 24;
               for (j = KC/2 + 1; j < KC; j++)
                 {
                   *((u32*)tk[j]) ^= *((u32*)tk[j-1]);
@@ -244,6 +712,7 @@ do_setkey (RIJNDAEL_context *ctx, const byte *key, const unsigned keylen)
             }
         }		
 #undef W    
+      ct_prepare (ctx);
     }
 
   return 0;
@@ -258,165 +727,17 @@ rijndael_setkey (void *context, const byte *key, const unsigned keylen)
   RIJNDAEL_context *ctx = context;
 
   int rc = do_setkey (ctx, key, keylen);
-  _gcry_burn_stack ( 100 + 16*sizeof(int));
+  _gcry_burn_stack ( 100 + 16*sizeof(int) + CT_BURN_STACK);
   return rc;
 }
 
 
-/* Make a decryption key from an encryption key. */
-static void
-prepare_decryption( RIJNDAEL_context *ctx )
-{
-  int r;
-  union
-  {
-    PROPERLY_ALIGNED_TYPE dummy;
-    byte *w;
-  } w;
-#define w w.w
-
-  for (r=0; r < MAXROUNDS+1; r++ )
-    {
-      *((u32*)ctx->keySched2[r][0]) = *((u32*)ctx->keySched[r][0]);
-      *((u32*)ctx->keySched2[r][1]) = *((u32*)ctx->keySched[r][1]);
-      *((u32*)ctx->keySched2[r][2]) = *((u32*)ctx->keySched[r][2]);
-      *((u32*)ctx->keySched2[r][3]) = *((u32*)ctx->keySched[r][3]);
-    }
-#define W (ctx->keySched2)
-  for (r = 1; r < ctx->ROUNDS; r++)
-    {
-      w = W[r][0];
-      *((u32*)w) = *((u32*)U1[w[0]]) ^ *((u32*)U2[w[1]])
-        ^ *((u32*)U3[w[2]]) ^ *((u32*)U4[w[3]]);
-       
-      w = W[r][1];
-      *((u32*)w) = *((u32*)U1[w[0]]) ^ *((u32*)U2[w[1]])
-        ^ *((u32*)U3[w[2]]) ^ *((u32*)U4[w[3]]);
-        
-      w = W[r][2];
-      *((u32*)w) = *((u32*)U1[w[0]]) ^ *((u32*)U2[w[1]])
-        ^ *((u32*)U3[w[2]]) ^ *((u32*)U4[w[3]]);
-        
-      w = W[r][3];
-      *((u32*)w) = *((u32*)U1[w[0]]) ^ *((u32*)U2[w[1]])
-        ^ *((u32*)U3[w[2]]) ^ *((u32*)U4[w[3]]);
-    }
-#undef W
-#undef w
-}	
-
-
-
-/* Encrypt one block.  A and B need to be aligned on a 4 byte
-   boundary.  A and B may be the same. */
-static void
-do_encrypt_aligned (const RIJNDAEL_context *ctx, 
-                    unsigned char *b, const unsigned char *a)
-{
-#define rk (ctx->keySched)
-  int ROUNDS = ctx->ROUNDS;
-  int r;
-  union
-  {
-    u32  tempu32[4];  /* Force correct alignment. */
-    byte temp[4][4];
-  } u;
-
-  *((u32*)u.temp[0]) = *((u32*)(a   )) ^ *((u32*)rk[0][0]);
-  *((u32*)u.temp[1]) = *((u32*)(a+ 4)) ^ *((u32*)rk[0][1]);
-  *((u32*)u.temp[2]) = *((u32*)(a+ 8)) ^ *((u32*)rk[0][2]);
-  *((u32*)u.temp[3]) = *((u32*)(a+12)) ^ *((u32*)rk[0][3]);
-  *((u32*)(b    ))   = (*((u32*)T1[u.temp[0][0]])
-                        ^ *((u32*)T2[u.temp[1][1]])
-                        ^ *((u32*)T3[u.temp[2][2]]) 
-                        ^ *((u32*)T4[u.temp[3][3]]));
-  *((u32*)(b + 4))   = (*((u32*)T1[u.temp[1][0]])
-                        ^ *((u32*)T2[u.temp[2][1]])
-                        ^ *((u32*)T3[u.temp[3][2]]) 
-                        ^ *((u32*)T4[u.temp[0][3]]));
-  *((u32*)(b + 8))   = (*((u32*)T1[u.temp[2][0]])
-                        ^ *((u32*)T2[u.temp[3][1]])
-                        ^ *((u32*)T3[u.temp[0][2]]) 
-                        ^ *((u32*)T4[u.temp[1][3]]));
-  *((u32*)(b +12))   = (*((u32*)T1[u.temp[3][0]])
-                        ^ *((u32*)T2[u.temp[0][1]])
-                        ^ *((u32*)T3[u.temp[1][2]]) 
-                        ^ *((u32*)T4[u.temp[2][3]]));
-
-  for (r = 1; r < ROUNDS-1; r++)
-    {
-      *((u32*)u.temp[0]) = *((u32*)(b   )) ^ *((u32*)rk[r][0]);
-      *((u32*)u.temp[1]) = *((u32*)(b+ 4)) ^ *((u32*)rk[r][1]);
-      *((u32*)u.temp[2]) = *((u32*)(b+ 8)) ^ *((u32*)rk[r][2]);
-      *((u32*)u.temp[3]) = *((u32*)(b+12)) ^ *((u32*)rk[r][3]);
-
-      *((u32*)(b    ))   = (*((u32*)T1[u.temp[0][0]])
-                            ^ *((u32*)T2[u.temp[1][1]])
-                            ^ *((u32*)T3[u.temp[2][2]]) 
-                            ^ *((u32*)T4[u.temp[3][3]]));
-      *((u32*)(b + 4))   = (*((u32*)T1[u.temp[1][0]])
-                            ^ *((u32*)T2[u.temp[2][1]])
-                            ^ *((u32*)T3[u.temp[3][2]]) 
-                            ^ *((u32*)T4[u.temp[0][3]]));
-      *((u32*)(b + 8))   = (*((u32*)T1[u.temp[2][0]])
-                            ^ *((u32*)T2[u.temp[3][1]])
-                            ^ *((u32*)T3[u.temp[0][2]]) 
-                            ^ *((u32*)T4[u.temp[1][3]]));
-      *((u32*)(b +12))   = (*((u32*)T1[u.temp[3][0]])
-                            ^ *((u32*)T2[u.temp[0][1]])
-                            ^ *((u32*)T3[u.temp[1][2]]) 
-                            ^ *((u32*)T4[u.temp[2][3]]));
-    }
-
-  /* Last round is special. */   
-  *((u32*)u.temp[0]) = *((u32*)(b   )) ^ *((u32*)rk[ROUNDS-1][0]);
-  *((u32*)u.temp[1]) = *((u32*)(b+ 4)) ^ *((u32*)rk[ROUNDS-1][1]);
-  *((u32*)u.temp[2]) = *((u32*)(b+ 8)) ^ *((u32*)rk[ROUNDS-1][2]);
-  *((u32*)u.temp[3]) = *((u32*)(b+12)) ^ *((u32*)rk[ROUNDS-1][3]);
-  b[ 0] = T1[u.temp[0][0]][1];
-  b[ 1] = T1[u.temp[1][1]][1];
-  b[ 2] = T1[u.temp[2][2]][1];
-  b[ 3] = T1[u.temp[3][3]][1];
-  b[ 4] = T1[u.temp[1][0]][1];
-  b[ 5] = T1[u.temp[2][1]][1];
-  b[ 6] = T1[u.temp[3][2]][1];
-  b[ 7] = T1[u.temp[0][3]][1];
-  b[ 8] = T1[u.temp[2][0]][1];
-  b[ 9] = T1[u.temp[3][1]][1];
-  b[10] = T1[u.temp[0][2]][1];
-  b[11] = T1[u.temp[1][3]][1];
-  b[12] = T1[u.temp[3][0]][1];
-  b[13] = T1[u.temp[0][1]][1];
-  b[14] = T1[u.temp[1][2]][1];
-  b[15] = T1[u.temp[2][3]][1];
-  *((u32*)(b   )) ^= *((u32*)rk[ROUNDS][0]);
-  *((u32*)(b+ 4)) ^= *((u32*)rk[ROUNDS][1]);
-  *((u32*)(b+ 8)) ^= *((u32*)rk[ROUNDS][2]);
-  *((u32*)(b+12)) ^= *((u32*)rk[ROUNDS][3]);
-#undef rk
-}
-
-
+/* Encrypt one block.  AX and BX may be the same.  */
 static void
 do_encrypt (const RIJNDAEL_context *ctx,
             unsigned char *bx, const unsigned char *ax)
 {
-  /* BX and AX are not necessary correctly aligned.  Thus we need to
-     copy them here. */
-  union
-  {
-    u32  dummy[4]; 
-    byte a[16];
-  } a;
-  union
-  {
-    u32  dummy[4]; 
-    byte b[16];
-  } b;
-
-  memcpy (a.a, ax, 16);
-  do_encrypt_aligned (ctx, b.b, a.a);
-  memcpy (bx, b.b, 16);
+  ct_encrypt (ctx, bx, ax, 1);
 }
 
 
@@ -463,11 +784,196 @@ do_padlock (const RIJNDAEL_context *ctx, int decrypt_flag,
 #endif /*USE_PADLOCK*/
 
 
+#ifdef USE_AESNI
+/* The compiler only knows about the SSE registers if it may use them
+   itself; otherwise it never keeps anything there.  */
+#ifdef __SSE__
+# define AESNI_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4"
+#else
+# define AESNI_CLOBBERS "cc", "memory"
+#endif
+
+/* Make the decryption key schedule with AESIMC.  It has the same layout
+   as the one made by prepare_decryption.  */
+static void
+aesni_prepare_decryption (RIJNDAEL_context *ctx)
+{
+  int r;
+
+  memcpy (ctx->keySched2[0], ctx->keySched[0], BLOCKSIZE);
+  for (r = 1; r < ctx->ROUNDS; r++)
+    asm volatile ("movdqu (%[src]), %%xmm0\n\t"
+                  "aesimc %%xmm0, %%xmm0\n\t"
+                  "movdqu %%xmm0, (%[dst])\n\t"
+                  "pxor %%xmm0, %%xmm0\n"
+                  : : [src] "r" (ctx->keySched[r]),
+                    [dst] "r" (ctx->keySched2[r])
+                  : AESNI_CLOBBERS);
+  memcpy (ctx->keySched2[ctx->ROUNDS], ctx->keySched[ctx->ROUNDS],
+          BLOCKSIZE);
+}
+
+/* Encrypt one block using AES-NI.  A and B may be the same and need not
+   be aligned.  */
+static void
+do_aesni_enc (const RIJNDAEL_context *ctx, unsigned char *b,
+              const unsigned char *a)
+{
+  const byte *key = ctx->keySched[0][0];
+  unsigned long n = ctx->ROUNDS - 1;
+
+  asm volatile ("movdqu (%[key]), %%xmm4\n\t"
+                "movdqu (%[src]), %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm0\n"
+                "1:\n\t"
+                "add $16, %[key]\n\t"
+                "movdqu (%[key]), %%xmm4\n\t"
+                "aesenc %%xmm4, %%xmm0\n\t"
+                "dec %[n]\n\t"
+                "jnz 1b\n\t"
+                "movdqu 16(%[key]), %%xmm4\n\t"
+                "aesenclast %%xmm4, %%xmm0\n\t"
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "pxor %%xmm0, %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm4\n"
+                : [key] "+r" (key), [n] "+r" (n)
+                : [src] "r" (a), [dst] "r" (b)
+                : AESNI_CLOBBERS);
+}
+
+/* Decrypt one block using AES-NI.  A and B may be the same and need not
+   be aligned.  */
+static void
+do_aesni_dec (const RIJNDAEL_context *ctx, unsigned char *b,
+              const unsigned char *a)
+{
+  const byte *key = ctx->keySched2[ctx->ROUNDS][0];
+  unsigned long n = ctx->ROUNDS - 1;
+
+  asm volatile ("movdqu (%[key]), %%xmm4\n\t"
+                "movdqu (%[src]), %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm0\n"
+                "1:\n\t"
+                "sub $16, %[key]\n\t"
+                "movdqu (%[key]), %%xmm4\n\t"
+                "aesdec %%xmm4, %%xmm0\n\t"
+                "dec %[n]\n\t"
+                "jnz 1b\n\t"
+                "movdqu -16(%[key]), %%xmm4\n\t"
+                "aesdeclast %%xmm4, %%xmm0\n\t"
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "pxor %%xmm0, %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm4\n"
+                : [key] "+r" (key), [n] "+r" (n)
+                : [src] "r" (a), [dst] "r" (b)
+                : AESNI_CLOBBERS);
+}
+
+/* Encrypt four consecutive blocks using AES-NI.  The blocks go through
+   the rounds together so that the latency of AESENC is hidden.  */
+static void
+do_aesni_enc4 (const RIJNDAEL_context *ctx, unsigned char *b,
+               const unsigned char *a)
+{
+  const byte *key = ctx->keySched[0][0];
+  unsigned long n = ctx->ROUNDS - 1;
+
+  asm volatile ("movdqu (%[key]), %%xmm4\n\t"
+                "movdqu (%[src]), %%xmm0\n\t"
+                "movdqu 16(%[src]), %%xmm1\n\t"
+                "movdqu 32(%[src]), %%xmm2\n\t"
+                "movdqu 48(%[src]), %%xmm3\n\t"
+                "pxor %%xmm4, %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm1\n\t"
+                "pxor %%xmm4, %%xmm2\n\t"
+                "pxor %%xmm4, %%xmm3\n"
+                "1:\n\t"
+                "add $16, %[key]\n\t"
+                "movdqu (%[key]), %%xmm4\n\t"
+                "aesenc %%xmm4, %%xmm0\n\t"
+                "aesenc %%xmm4, %%xmm1\n\t"
+                "aesenc %%xmm4, %%xmm2\n\t"
+                "aesenc %%xmm4, %%xmm3\n\t"
+                "dec %[n]\n\t"
+                "jnz 1b\n\t"
+                "movdqu 16(%[key]), %%xmm4\n\t"
+                "aesenclast %%xmm4, %%xmm0\n\t"
+                "aesenclast %%xmm4, %%xmm1\n\t"
+                "aesenclast %%xmm4, %%xmm2\n\t"
+                "aesenclast %%xmm4, %%xmm3\n\t"
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm1, 16(%[dst])\n\t"
+                "movdqu %%xmm2, 32(%[dst])\n\t"
+                "movdqu %%xmm3, 48(%[dst])\n\t"
+                "pxor %%xmm0, %%xmm0\n\t"
+                "pxor %%xmm1, %%xmm1\n\t"
+                "pxor %%xmm2, %%xmm2\n\t"
+                "pxor %%xmm3, %%xmm3\n\t"
+                "pxor %%xmm4, %%xmm4\n"
+                : [key] "+r" (key), [n] "+r" (n)
+                : [src] "r" (a), [dst] "r" (b)
+                : AESNI_CLOBBERS);
+}
+
+/* Decrypt four consecutive blocks using AES-NI.  */
+static void
+do_aesni_dec4 (const RIJNDAEL_context *ctx, unsigned char *b,
+               const unsigned char *a)
+{
+  const byte *key = ctx->keySched2[ctx->ROUNDS][0];
+  unsigned long n = ctx->ROUNDS - 1;
+
+  asm volatile ("movdqu (%[key]), %%xmm4\n\t"
+                "movdqu (%[src]), %%xmm0\n\t"
+                "movdqu 16(%[src]), %%xmm1\n\t"
+                "movdqu 32(%[src]), %%xmm2\n\t"
+                "movdqu 48(%[src]), %%xmm3\n\t"
+                "pxor %%xmm4, %%xmm0\n\t"
+                "pxor %%xmm4, %%xmm1\n\t"
+                "pxor %%xmm4, %%xmm2\n\t"
+                "pxor %%xmm4, %%xmm3\n"
+                "1:\n\t"
+                "sub $16, %[key]\n\t"
+                "movdqu (%[key]), %%xmm4\n\t"
+                "aesdec %%xmm4, %%xmm0\n\t"
+                "aesdec %%xmm4, %%xmm1\n\t"
+                "aesdec %%xmm4, %%xmm2\n\t"
+                "aesdec %%xmm4, %%xmm3\n\t"
+                "dec %[n]\n\t"
+                "jnz 1b\n\t"
+                "movdqu -16(%[key]), %%xmm4\n\t"
+                "aesdeclast %%xmm4, %%xmm0\n\t"
+                "aesdeclast %%xmm4, %%xmm1\n\t"
+                "aesdeclast %%xmm4, %%xmm2\n\t"
+                "aesdeclast %%xmm4, %%xmm3\n\t"
+                "movdqu %%xmm0, (%[dst])\n\t"
+                "movdqu %%xmm1, 16(%[dst])\n\t"
+                "movdqu %%xmm2, 32(%[dst])\n\t"
+                "movdqu %%xmm3, 48(%[dst])\n\t"
+                "pxor %%xmm0, %%xmm0\n\t"
+                "pxor %%xmm1, %%xmm1\n\t"
+                "pxor %%xmm2, %%xmm2\n\t"
+                "pxor %%xmm3, %%xmm3\n\t"
+                "pxor %%xmm4, %%xmm4\n"
+                : [key] "+r" (key), [n] "+r" (n)
+                : [src] "r" (a), [dst] "r" (b)
+                : AESNI_CLOBBERS);
+}
+#endif /*USE_AESNI*/
+
+
 static void
 rijndael_encrypt (void *context, byte *b, const byte *a)
 {
   RIJNDAEL_context *ctx = context;
 
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    {
+      do_aesni_enc (ctx, b, a);
+      return;
+    }
+#endif /*USE_AESNI*/
 #ifdef USE_PADLOCK
   if (ctx->use_padlock)
     {
@@ -478,7 +984,7 @@ rijndael_encrypt (void *context, byte *b, const byte *a)
 #endif /*USE_PADLOCK*/
     {
       do_encrypt (ctx, b, a);
-      _gcry_burn_stack (48 + 2*sizeof(int));
+      _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
     }
 }
 
@@ -517,14 +1023,14 @@ _gcry_aes_cfb_enc (void *context, unsigned char *iv,
       for ( ;nblocks; nblocks-- )
         {
           /* Encrypt the IV. */
-          do_encrypt_aligned (ctx, iv, iv);
+          do_encrypt (ctx, iv, iv);
           /* XOR the input with the IV and store input into IV.  */
           for (ivp=iv,i=0; i < BLOCKSIZE; i++ )
             *outbuf++ = (*ivp++ ^= *inbuf++);
         }
     }
 
-  _gcry_burn_stack (48 + 2*sizeof(int));
+  _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
 }
 
 
@@ -561,134 +1067,17 @@ _gcry_aes_cbc_enc (void *context, unsigned char *iv,
         outbuf += BLOCKSIZE;
     }
 
-  _gcry_burn_stack (48 + 2*sizeof(int));
+  _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
 }
 
 
 
-/* Decrypt one block.  A and B need to be aligned on a 4 byte boundary
-   and the decryption must have been prepared.  A and B may be the
-   same. */
-static void
-do_decrypt_aligned (RIJNDAEL_context *ctx, 
-                    unsigned char *b, const unsigned char *a)
-{
-#define rk  (ctx->keySched2)
-  int ROUNDS = ctx->ROUNDS; 
-  int r;
-  union 
-  {
-    u32  tempu32[4];  /* Force correct alignment. */
-    byte temp[4][4];
-  } u;
-
-
-  *((u32*)u.temp[0]) = *((u32*)(a   )) ^ *((u32*)rk[ROUNDS][0]);
-  *((u32*)u.temp[1]) = *((u32*)(a+ 4)) ^ *((u32*)rk[ROUNDS][1]);
-  *((u32*)u.temp[2]) = *((u32*)(a+ 8)) ^ *((u32*)rk[ROUNDS][2]);
-  *((u32*)u.temp[3]) = *((u32*)(a+12)) ^ *((u32*)rk[ROUNDS][3]);
-  
-  *((u32*)(b   ))    = (*((u32*)T5[u.temp[0][0]])
-                        ^ *((u32*)T6[u.temp[3][1]])
-                        ^ *((u32*)T7[u.temp[2][2]]) 
-                        ^ *((u32*)T8[u.temp[1][3]]));
-  *((u32*)(b+ 4))    = (*((u32*)T5[u.temp[1][0]])
-                        ^ *((u32*)T6[u.temp[0][1]])
-                        ^ *((u32*)T7[u.temp[3][2]]) 
-                        ^ *((u32*)T8[u.temp[2][3]]));
-  *((u32*)(b+ 8))    = (*((u32*)T5[u.temp[2][0]])
-                        ^ *((u32*)T6[u.temp[1][1]])
-                        ^ *((u32*)T7[u.temp[0][2]]) 
-                        ^ *((u32*)T8[u.temp[3][3]]));
-  *((u32*)(b+12))    = (*((u32*)T5[u.temp[3][0]])
-                        ^ *((u32*)T6[u.temp[2][1]])
-                        ^ *((u32*)T7[u.temp[1][2]]) 
-                        ^ *((u32*)T8[u.temp[0][3]]));
-
-  for (r = ROUNDS-1; r > 1; r--)
-    {
-      *((u32*)u.temp[0]) = *((u32*)(b   )) ^ *((u32*)rk[r][0]);
-      *((u32*)u.temp[1]) = *((u32*)(b+ 4)) ^ *((u32*)rk[r][1]);
-      *((u32*)u.temp[2]) = *((u32*)(b+ 8)) ^ *((u32*)rk[r][2]);
-      *((u32*)u.temp[3]) = *((u32*)(b+12)) ^ *((u32*)rk[r][3]);
-      *((u32*)(b   ))    = (*((u32*)T5[u.temp[0][0]])
-                            ^ *((u32*)T6[u.temp[3][1]])
-                            ^ *((u32*)T7[u.temp[2][2]]) 
-                            ^ *((u32*)T8[u.temp[1][3]]));
-      *((u32*)(b+ 4))    = (*((u32*)T5[u.temp[1][0]])
-                            ^ *((u32*)T6[u.temp[0][1]])
-                            ^ *((u32*)T7[u.temp[3][2]]) 
-                            ^ *((u32*)T8[u.temp[2][3]]));
-      *((u32*)(b+ 8))    = (*((u32*)T5[u.temp[2][0]])
-                            ^ *((u32*)T6[u.temp[1][1]])
-                            ^ *((u32*)T7[u.temp[0][2]]) 
-                            ^ *((u32*)T8[u.temp[3][3]]));
-      *((u32*)(b+12))    = (*((u32*)T5[u.temp[3][0]])
-                            ^ *((u32*)T6[u.temp[2][1]])
-                            ^ *((u32*)T7[u.temp[1][2]]) 
-                            ^ *((u32*)T8[u.temp[0][3]]));
-    }
-
-  /* Last round is special. */   
-  *((u32*)u.temp[0]) = *((u32*)(b   )) ^ *((u32*)rk[1][0]);
-  *((u32*)u.temp[1]) = *((u32*)(b+ 4)) ^ *((u32*)rk[1][1]);
-  *((u32*)u.temp[2]) = *((u32*)(b+ 8)) ^ *((u32*)rk[1][2]);
-  *((u32*)u.temp[3]) = *((u32*)(b+12)) ^ *((u32*)rk[1][3]);
-  b[ 0] = S5[u.temp[0][0]];
-  b[ 1] = S5[u.temp[3][1]];
-  b[ 2] = S5[u.temp[2][2]];
-  b[ 3] = S5[u.temp[1][3]];
-  b[ 4] = S5[u.temp[1][0]];
-  b[ 5] = S5[u.temp[0][1]];
-  b[ 6] = S5[u.temp[3][2]];
-  b[ 7] = S5[u.temp[2][3]];
-  b[ 8] = S5[u.temp[2][0]];
-  b[ 9] = S5[u.temp[1][1]];
-  b[10] = S5[u.temp[0][2]];
-  b[11] = S5[u.temp[3][3]];
-  b[12] = S5[u.temp[3][0]];
-  b[13] = S5[u.temp[2][1]];
-  b[14] = S5[u.temp[1][2]];
-  b[15] = S5[u.temp[0][3]];
-  *((u32*)(b   )) ^= *((u32*)rk[0][0]);
-  *((u32*)(b+ 4)) ^= *((u32*)rk[0][1]);
-  *((u32*)(b+ 8)) ^= *((u32*)rk[0][2]);
-  *((u32*)(b+12)) ^= *((u32*)rk[0][3]);
-#undef rk
-}
-
-
 /* Decrypt one block.  AX and BX may be the same. */
 static void
 do_decrypt (RIJNDAEL_context *ctx, byte *bx, const byte *ax)
 {
-  /* BX and AX are not necessary correctly aligned.  Thus we need to
-     copy them here. */
-  union
-  {
-    u32  dummy[4]; 
-    byte a[16];
-  } a;
-  union
-  {
-    u32  dummy[4]; 
-    byte b[16];
-  } b;
-
-  if ( !ctx->decryption_prepared )
-    {
-      prepare_decryption ( ctx );
-      _gcry_burn_stack (64);
-      ctx->decryption_prepared = 1;
-    }
-
-  memcpy (a.a, ax, 16);
-  do_decrypt_aligned (ctx, b.b, a.a);
-  memcpy (bx, b.b, 16);
-#undef rk
+  ct_decrypt (ctx, bx, ax, 1);
 }
-    
-
 
 
 static void
@@ -696,6 +1085,18 @@ rijndael_decrypt (void *context, byte *b, const byte *a)
 {
   RIJNDAEL_context *ctx = context;
 
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    {
+      if (!ctx->decryption_prepared)
+        {
+          aesni_prepare_decryption (ctx);
+          ctx->decryption_prepared = 1;
+        }
+      do_aesni_dec (ctx, b, a);
+      return;
+    }
+#endif /*USE_AESNI*/
 #ifdef USE_PADLOCK
   if (ctx->use_padlock)
     {
@@ -706,7 +1107,7 @@ rijndael_decrypt (void *context, byte *b, const byte *a)
 #endif /*USE_PADLOCK*/
     {
       do_decrypt (ctx, b, a);
-      _gcry_burn_stack (48+2*sizeof(int));
+      _gcry_burn_stack (48+2*sizeof(int) + CT_BURN_STACK);
     }
 }
 
@@ -747,7 +1148,7 @@ _gcry_aes_cfb_dec (void *context, unsigned char *iv,
     {
       for ( ;nblocks; nblocks-- )
         {
-          do_encrypt_aligned (ctx, iv, iv);
+          do_encrypt (ctx, iv, iv);
           for (ivp=iv,i=0; i < BLOCKSIZE; i++ )
             {
               temp = *inbuf++;
@@ -757,7 +1158,7 @@ _gcry_aes_cfb_dec (void *context, unsigned char *iv,
         }
     }
 
-  _gcry_burn_stack (48 + 2*sizeof(int));
+  _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
 }
 
 
@@ -797,7 +1198,8 @@ _gcry_aes_cbc_dec (void *context, unsigned char *iv,
       outbuf += BLOCKSIZE;
     }
 
-  _gcry_burn_stack (48 + 2*sizeof(int) + BLOCKSIZE + 4*sizeof (char*));
+  _gcry_burn_stack (48 + 2*sizeof(int) + BLOCKSIZE + 4*sizeof (char*)
+                    + CT_BURN_STACK);
 }
 
 
@@ -1171,6 +1573,184 @@ run_selftests (int algo, int extended, selftest_report_func_t report)
 
 
 
+
+/* Encrypt NBLOCKS consecutive blocks in ECB mode.  */
+static void
+rijndael_ecb_encrypt (void *context, byte *outbuf, const byte *inbuf,
+                      size_t nblocks)
+{
+  RIJNDAEL_context *ctx = context;
+
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    for (; nblocks >= 4; nblocks -= 4)
+      {
+        do_aesni_enc4 (ctx, outbuf, inbuf);
+        outbuf += 4 * BLOCKSIZE;
+        inbuf += 4 * BLOCKSIZE;
+      }
+  else
+#endif /*USE_AESNI*/
+#ifdef USE_PADLOCK
+  if (!ctx->use_padlock)
+#endif /*USE_PADLOCK*/
+    {
+      for (; nblocks >= 2; nblocks -= 2)
+        {
+          ct_encrypt (ctx, outbuf, inbuf, 2);
+          outbuf += 2 * BLOCKSIZE;
+          inbuf += 2 * BLOCKSIZE;
+        }
+      _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
+    }
+  for (; nblocks; nblocks--)
+    {
+      rijndael_encrypt (ctx, outbuf, inbuf);
+      outbuf += BLOCKSIZE;
+      inbuf += BLOCKSIZE;
+    }
+}
+
+/* Decrypt NBLOCKS consecutive blocks in ECB mode.  */
+static void
+rijndael_ecb_decrypt (void *context, byte *outbuf, const byte *inbuf,
+                      size_t nblocks)
+{
+  RIJNDAEL_context *ctx = context;
+
+#ifdef USE_AESNI
+  if (ctx->use_aesni)
+    {
+      if (!ctx->decryption_prepared)
+        {
+          aesni_prepare_decryption (ctx);
+          ctx->decryption_prepared = 1;
+        }
+      for (; nblocks >= 4; nblocks -= 4)
+        {
+          do_aesni_dec4 (ctx, outbuf, inbuf);
+          outbuf += 4 * BLOCKSIZE;
+          inbuf += 4 * BLOCKSIZE;
+        }
+    }
+  else
+#endif /*USE_AESNI*/
+#ifdef USE_PADLOCK
+  if (!ctx->use_padlock)
+#endif /*USE_PADLOCK*/
+    {
+      for (; nblocks >= 2; nblocks -= 2)
+        {
+          ct_decrypt (ctx, outbuf, inbuf, 2);
+          outbuf += 2 * BLOCKSIZE;
+          inbuf += 2 * BLOCKSIZE;
+        }
+      _gcry_burn_stack (48 + 2*sizeof(int) + CT_BURN_STACK);
+    }
+  for (; nblocks; nblocks--)
+    {
+      rijndael_decrypt (ctx, outbuf, inbuf);
+      outbuf += BLOCKSIZE;
+      inbuf += BLOCKSIZE;
+    }
+}
+
+/* Blocks handed to the ECB functions at once by the CBC and XTS
+   functions.  */
+#define BULK_BLOCKS 8
+
+/* Encrypt NBLOCKS blocks in CBC mode, chaining from IV and leaving the
+   last ciphertext block in IV.  OUTBUF and INBUF may be the same.  */
+static void
+rijndael_cbc_encrypt (void *context, byte *iv, byte *outbuf,
+                      const byte *inbuf, size_t nblocks)
+{
+  RIJNDAEL_context *ctx = context;
+  int i;
+
+  for (; nblocks; nblocks--)
+    {
+      for (i = 0; i < BLOCKSIZE; i++)
+        outbuf[i] = inbuf[i] ^ iv[i];
+      rijndael_encrypt (ctx, outbuf, outbuf);
+      memcpy (iv, outbuf, BLOCKSIZE);
+      outbuf += BLOCKSIZE;
+      inbuf += BLOCKSIZE;
+    }
+}
+
+/* Decrypt NBLOCKS blocks in CBC mode.  Unlike encryption the blocks
+   are independent, so they go through the ECB function BULK_BLOCKS at
+   a time.  OUTBUF and INBUF may be the same.  */
+static void
+rijndael_cbc_decrypt (void *context, byte *iv, byte *outbuf,
+                      const byte *inbuf, size_t nblocks)
+{
+  byte savebuf[BULK_BLOCKS * BLOCKSIZE];
+  size_t n, i;
+
+  for (; nblocks; nblocks -= n)
+    {
+      n = nblocks < BULK_BLOCKS ? nblocks : BULK_BLOCKS;
+      /* INBUF may be identical to OUTBUF.  */
+      memcpy (savebuf, inbuf, n * BLOCKSIZE);
+      rijndael_ecb_decrypt (context, outbuf, inbuf, n);
+      for (i = 0; i < BLOCKSIZE; i++)
+        outbuf[i] ^= iv[i];
+      for (i = BLOCKSIZE; i < n * BLOCKSIZE; i++)
+        outbuf[i] ^= savebuf[i - BLOCKSIZE];
+      memcpy (iv, savebuf + (n - 1) * BLOCKSIZE, BLOCKSIZE);
+      outbuf += n * BLOCKSIZE;
+      inbuf += n * BLOCKSIZE;
+    }
+  memset (savebuf, 0, sizeof (savebuf));
+}
+
+/* Multiply the XTS tweak T by x in GF(2^128), without branching on
+   its bits.  */
+static void
+xts_mul_x (byte *t)
+{
+  byte carry = t[BLOCKSIZE - 1] >> 7;
+  int i;
+
+  for (i = BLOCKSIZE - 1; i > 0; i--)
+    t[i] = (t[i] << 1) | (t[i - 1] >> 7);
+  t[0] = (t[0] << 1) ^ (0x87 & -carry);
+}
+
+/* Encrypt, or decrypt if ENCRYPT is 0, NBLOCKS blocks in XTS mode.
+   TWEAK is the already encrypted tweak of the first block and is
+   advanced past the last one.  OUTBUF and INBUF may be the same.  */
+static void
+rijndael_xts_crypt (void *context, byte *tweak, byte *outbuf,
+                    const byte *inbuf, size_t nblocks, int encrypt)
+{
+  byte tweaks[BULK_BLOCKS * BLOCKSIZE];
+  size_t n, i;
+
+  for (; nblocks; nblocks -= n)
+    {
+      n = nblocks < BULK_BLOCKS ? nblocks : BULK_BLOCKS;
+      for (i = 0; i < n; i++)
+        {
+          memcpy (tweaks + i * BLOCKSIZE, tweak, BLOCKSIZE);
+          xts_mul_x (tweak);
+        }
+      for (i = 0; i < n * BLOCKSIZE; i++)
+        outbuf[i] = inbuf[i] ^ tweaks[i];
+      if (encrypt)
+        rijndael_ecb_encrypt (context, outbuf, outbuf, n);
+      else
+        rijndael_ecb_decrypt (context, outbuf, outbuf, n);
+      for (i = 0; i < n * BLOCKSIZE; i++)
+        outbuf[i] ^= tweaks[i];
+      outbuf += n * BLOCKSIZE;
+      inbuf += n * BLOCKSIZE;
+    }
+  memset (tweaks, 0, sizeof (tweaks));
+}
+
 static const char *rijndael_names[] =
   {
     "RIJNDAEL",
@@ -1191,7 +1771,9 @@ static gcry_cipher_oid_spec_t rijndael_oids[] =
 gcry_cipher_spec_t _gcry_cipher_spec_aes =
   {
     "AES", rijndael_names, rijndael_oids, 16, 128, sizeof (RIJNDAEL_context),
-    rijndael_setkey, rijndael_encrypt, rijndael_decrypt
+    rijndael_setkey, rijndael_encrypt, rijndael_decrypt,
+    NULL, NULL, rijndael_ecb_encrypt, rijndael_ecb_decrypt,
+    rijndael_cbc_encrypt, rijndael_cbc_decrypt, rijndael_xts_crypt
   };
 cipher_extra_spec_t _gcry_cipher_extraspec_aes = 
   {
@@ -1217,7 +1799,9 @@ static gcry_cipher_oid_spec_t rijndael192_oids[] =
 gcry_cipher_spec_t _gcry_cipher_spec_aes192 =
   {
     "AES192", rijndael192_names, rijndael192_oids, 16, 192, sizeof (RIJNDAEL_context),
-    rijndael_setkey, rijndael_encrypt, rijndael_decrypt
+    rijndael_setkey, rijndael_encrypt, rijndael_decrypt,
+    NULL, NULL, rijndael_ecb_encrypt, rijndael_ecb_decrypt,
+    rijndael_cbc_encrypt, rijndael_cbc_decrypt, rijndael_xts_crypt
   };
 cipher_extra_spec_t _gcry_cipher_extraspec_aes192 = 
   {
@@ -1244,7 +1828,9 @@ gcry_cipher_spec_t _gcry_cipher_spec_aes256 =
   {
     "AES256", rijndael256_names, rijndael256_oids, 16, 256,
     sizeof (RIJNDAEL_context),
-    rijndael_setkey, rijndael_encrypt, rijndael_decrypt
+    rijndael_setkey, rijndael_encrypt, rijndael_decrypt,
+    NULL, NULL, rijndael_ecb_encrypt, rijndael_ecb_decrypt,
+    rijndael_cbc_encrypt, rijndael_cbc_decrypt, rijndael_xts_crypt
   };
 
 cipher_extra_spec_t _gcry_cipher_extraspec_aes256 = 
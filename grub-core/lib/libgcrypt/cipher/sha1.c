@@ -53,6 +53,15 @@
 
 #define TRANSFORM(x,d,n) transform ((x), (d), (n))
 
+/* USE_SHAEXT indicates whether to compile the Intel SHA extensions
+   code.  */
+#undef USE_SHAEXT
+#ifdef HWF_INTEL_SHAEXT
+# if (defined (__i386__) || defined (__x86_64__)) && defined (__GNUC__)
+# define USE_SHAEXT
+# endif
+#endif /*HWF_INTEL_SHAEXT*/
+
 
 typedef struct 
 {
@@ -60,6 +69,9 @@ typedef struct
   u32           nblocks;
   unsigned char buf[64];
   int           count;
+#ifdef USE_SHAEXT
+  int           use_shaext;
+#endif
 } SHA1_CONTEXT;
 
 
@@ -76,6 +88,9 @@ sha1_init (void *context)
   hd->h4 = 0xc3d2e1f0;
   hd->nblocks = 0;
   hd->count = 0;
+#ifdef USE_SHAEXT
+  hd->use_shaext = !!(_gcry_get_hw_features () & HWF_INTEL_SHAEXT);
+#endif
 }
 
 
@@ -101,6 +116,121 @@ sha1_init (void *context)
 			       } while(0)
 
 
+#ifdef USE_SHAEXT
+/* The compiler only knows about the SSE registers if it may use them
+   itself; otherwise it never keeps anything there.  */
+#ifdef __SSE__
+# define SHAEXT_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+# define SHAEXT_CLOBBERS "cc", "memory"
+#endif
+
+static const unsigned char shaext_bswap_mask[16] __attribute__ ((aligned (16)))
+  = { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+
+/* %xmm0 holds ABCD, %xmm1 and %xmm2 alternately the next E plus message
+   words, %xmm3 to %xmm6 the message schedule.  */
+#define SHAEXT_LOAD(i, m)                               \
+  "movdqu " #i "*16(%[data]), %%xmm" #m "\n\t"         \
+  "pshufb %[mask], %%xmm" #m "\n\t"
+#define SHAEXT_FIRST(m)                                 \
+  "paddd %%xmm" #m ", %%xmm1\n\t"
+#define SHAEXT_NEXTE(m, e)                              \
+  "sha1nexte %%xmm" #m ", %%xmm" #e "\n\t"
+#define SHAEXT_SAVE(e)                                  \
+  "movdqa %%xmm0, %%xmm" #e "\n\t"
+#define SHAEXT_RNDS(f, e)                               \
+  "sha1rnds4 $" #f ", %%xmm" #e ", %%xmm0\n\t"
+#define SHAEXT_MSG1(c, p)                               \
+  "sha1msg1 %%xmm" #c ", %%xmm" #p "\n\t"
+#define SHAEXT_MSG2(c, n)                               \
+  "sha1msg2 %%xmm" #c ", %%xmm" #n "\n\t"
+#define SHAEXT_XOR(c, p)                                \
+  "pxor %%xmm" #c ", %%xmm" #p "\n\t"
+
+static void
+transform_shaext (SHA1_CONTEXT *hd, const unsigned char *data)
+{
+  asm volatile
+    ("movdqu (%[state]), %%xmm0\n\t"
+     "pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+     "pxor %%xmm1, %%xmm1\n\t"
+     "pinsrd $3, 16(%[state]), %%xmm1\n\t"
+
+     SHAEXT_LOAD (0, 3) SHAEXT_FIRST (3) SHAEXT_SAVE (2) SHAEXT_RNDS (0, 1)
+     SHAEXT_LOAD (1, 4) SHAEXT_NEXTE (4, 2) SHAEXT_SAVE (1)
+     SHAEXT_RNDS (0, 2) SHAEXT_MSG1 (4, 3)
+     SHAEXT_LOAD (2, 5) SHAEXT_NEXTE (5, 1) SHAEXT_SAVE (2) SHAEXT_RNDS (0, 1)
+     SHAEXT_MSG1 (5, 4) SHAEXT_XOR (5, 3)
+     SHAEXT_LOAD (3, 6) SHAEXT_NEXTE (6, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (6, 3)
+     SHAEXT_RNDS (0, 2) SHAEXT_MSG1 (6, 5) SHAEXT_XOR (6, 4)
+     SHAEXT_NEXTE (3, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (3, 4) SHAEXT_RNDS (0, 1)
+     SHAEXT_MSG1 (3, 6) SHAEXT_XOR (3, 5)
+     SHAEXT_NEXTE (4, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (4, 5) SHAEXT_RNDS (1, 2)
+     SHAEXT_MSG1 (4, 3) SHAEXT_XOR (4, 6)
+     SHAEXT_NEXTE (5, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (5, 6) SHAEXT_RNDS (1, 1)
+     SHAEXT_MSG1 (5, 4) SHAEXT_XOR (5, 3)
+     SHAEXT_NEXTE (6, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (6, 3) SHAEXT_RNDS (1, 2)
+     SHAEXT_MSG1 (6, 5) SHAEXT_XOR (6, 4)
+     SHAEXT_NEXTE (3, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (3, 4) SHAEXT_RNDS (1, 1)
+     SHAEXT_MSG1 (3, 6) SHAEXT_XOR (3, 5)
+     SHAEXT_NEXTE (4, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (4, 5) SHAEXT_RNDS (1, 2)
+     SHAEXT_MSG1 (4, 3) SHAEXT_XOR (4, 6)
+     SHAEXT_NEXTE (5, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (5, 6) SHAEXT_RNDS (2, 1)
+     SHAEXT_MSG1 (5, 4) SHAEXT_XOR (5, 3)
+     SHAEXT_NEXTE (6, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (6, 3) SHAEXT_RNDS (2, 2)
+     SHAEXT_MSG1 (6, 5) SHAEXT_XOR (6, 4)
+     SHAEXT_NEXTE (3, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (3, 4) SHAEXT_RNDS (2, 1)
+     SHAEXT_MSG1 (3, 6) SHAEXT_XOR (3, 5)
+     SHAEXT_NEXTE (4, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (4, 5) SHAEXT_RNDS (2, 2)
+     SHAEXT_MSG1 (4, 3) SHAEXT_XOR (4, 6)
+     SHAEXT_NEXTE (5, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (5, 6) SHAEXT_RNDS (2, 1)
+     SHAEXT_MSG1 (5, 4) SHAEXT_XOR (5, 3)
+     SHAEXT_NEXTE (6, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (6, 3) SHAEXT_RNDS (3, 2)
+     SHAEXT_MSG1 (6, 5) SHAEXT_XOR (6, 4)
+     SHAEXT_NEXTE (3, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (3, 4) SHAEXT_RNDS (3, 1)
+     SHAEXT_MSG1 (3, 6) SHAEXT_XOR (3, 5)
+     SHAEXT_NEXTE (4, 2) SHAEXT_SAVE (1) SHAEXT_MSG2 (4, 5)
+     SHAEXT_RNDS (3, 2) SHAEXT_XOR (4, 6)
+     SHAEXT_NEXTE (5, 1) SHAEXT_SAVE (2) SHAEXT_MSG2 (5, 6) SHAEXT_RNDS (3, 1)
+     SHAEXT_NEXTE (6, 2) SHAEXT_SAVE (1) SHAEXT_RNDS (3, 2)
+
+     /* Add the previous state.  */
+     "pxor %%xmm7, %%xmm7\n\t"
+     "pinsrd $3, 16(%[state]), %%xmm7\n\t"
+     "sha1nexte %%xmm7, %%xmm1\n\t"
+     "movdqu (%[state]), %%xmm7\n\t"
+     "pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+     "paddd %%xmm7, %%xmm0\n\t"
+     "movdqu %%xmm0, (%[state])\n\t"
+     "pextrd $3, %%xmm1, 16(%[state])\n\t"
+
+     "pxor %%xmm0, %%xmm0\n\t"
+     "pxor %%xmm1, %%xmm1\n\t"
+     "pxor %%xmm2, %%xmm2\n\t"
+     "pxor %%xmm3, %%xmm3\n\t"
+     "pxor %%xmm4, %%xmm4\n\t"
+     "pxor %%xmm5, %%xmm5\n\t"
+     "pxor %%xmm6, %%xmm6\n\t"
+     "pxor %%xmm7, %%xmm7\n\t"
+     :
+     : [state] "r" (&hd->h0), [data] "r" (data),
+       [mask] "m" (shaext_bswap_mask)
+     : SHAEXT_CLOBBERS);
+}
+
+#undef SHAEXT_LOAD
+#undef SHAEXT_FIRST
+#undef SHAEXT_NEXTE
+#undef SHAEXT_SAVE
+#undef SHAEXT_RNDS
+#undef SHAEXT_MSG1
+#undef SHAEXT_MSG2
+#undef SHAEXT_XOR
+#endif /*USE_SHAEXT*/
+
+
 /*
  * Transform NBLOCKS of each 64 bytes (16 32-bit words) at DATA.
  */
@@ -110,7 +240,16 @@ transform (SHA1_CONTEXT *hd, const unsigned char *data, size_t nblocks)
   register u32 a, b, c, d, e; /* Local copies of the chaining variables.  */
   register u32 tm;            /* Helper.  */
   u32 x[16];                  /* The array we work on. */
-  
+
+#ifdef USE_SHAEXT
+  if (hd->use_shaext)
+    {
+      for ( ;nblocks; nblocks--, data += 64)
+        transform_shaext (hd, data);
+      return;
+    }
+#endif
+
   /* Loop over all blocks.  */
   for ( ;nblocks; nblocks--)
     {
@@ -120,15 +259,10 @@ transform (SHA1_CONTEXT *hd, const unsigned char *data, size_t nblocks)
 #else
       {
         int i;
-        unsigned char *p;
-
-        for(i=0, p=(unsigned char*)x; i < 16; i++, p += 4 )
-          {
-            p[3] = *data++;
-            p[2] = *data++;
-            p[1] = *data++;
-            p[0] = *data++;
-          }
+
+        for (i = 0; i < 16; i++, data += 4)
+          x[i] = ((u32) data[0] << 24 | (u32) data[1] << 16
+                  | (u32) data[2] << 8 | data[3]);
       }
 #endif
       /* Get the values of the chaining variables. */
@@ -45,11 +45,23 @@
 #include "cipher.h"
 #include "hash-common.h"
 
+/* USE_SHAEXT indicates whether to compile the Intel SHA extensions
+   code.  */
+#undef USE_SHAEXT
+#ifdef HWF_INTEL_SHAEXT
+# if (defined (__i386__) || defined (__x86_64__)) && defined (__GNUC__)
+# define USE_SHAEXT
+# endif
+#endif /*HWF_INTEL_SHAEXT*/
+
 typedef struct {
   u32  h0,h1,h2,h3,h4,h5,h6,h7;
   u32  nblocks;
   byte buf[64];
   int  count;
+#ifdef USE_SHAEXT
+  int  use_shaext;
+#endif
 } SHA256_CONTEXT;
 
 
@@ -69,6 +81,9 @@ sha256_init (void *context)
 
   hd->nblocks = 0;
   hd->count = 0;
+#ifdef USE_SHAEXT
+  hd->use_shaext = !!(_gcry_get_hw_features () & HWF_INTEL_SHAEXT);
+#endif
 }
 
 
@@ -88,26 +103,48 @@ sha224_init (void *context)
 
   hd->nblocks = 0;
   hd->count = 0;
+#ifdef USE_SHAEXT
+  hd->use_shaext = !!(_gcry_get_hw_features () & HWF_INTEL_SHAEXT);
+#endif
 }
 
 
+static const u32 K[64] __attribute__ ((aligned (16))) = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 /*
   Transform the message X which consists of 16 32-bit-words. See FIPS
   180-2 for details.  */
 #define S0(x) (ror ((x), 7) ^ ror ((x), 18) ^ ((x) >> 3))       /* (4.6) */
 #define S1(x) (ror ((x), 17) ^ ror ((x), 19) ^ ((x) >> 10))     /* (4.7) */
+/* The message schedule is kept in a 16-word ring.  */
+#define W(i) (w[(i) & 0x0f] += S1 (w[((i) - 2) & 0x0f])       \
+                               + w[((i) - 7) & 0x0f]          \
+                               + S0 (w[((i) - 15) & 0x0f]))
+/* The callers rotate the roles of the variables instead of moving
+   them.  */
 #define R(a,b,c,d,e,f,g,h,k,w) do                                 \
           {                                                       \
             t1 = (h) + Sum1((e)) + Cho((e),(f),(g)) + (k) + (w);  \
             t2 = Sum0((a)) + Maj((a),(b),(c));                    \
-            h = g;                                                \
-            g = f;                                                \
-            f = e;                                                \
-            e = d + t1;                                           \
-            d = c;                                                \
-            c = b;                                                \
-            b = a;                                                \
-            a = t1 + t2;                                          \
+            d += t1;                                              \
+            h = t1 + t2;                                          \
           } while (0)
 
 /* (4.2) same as SHA-1's F1.  */
@@ -138,34 +175,135 @@ Sum1 (u32 x)
   return (ror (x, 6) ^ ror (x, 11) ^ ror (x, 25));
 }
 
+#ifdef USE_SHAEXT
+/* The compiler only knows about the SSE registers if it may use them
+   itself; otherwise it never keeps anything there.  */
+#ifdef __SSE__
+# define SHAEXT_CLOBBERS "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm4", "xmm5", "xmm6", "xmm7"
+#else
+# define SHAEXT_CLOBBERS "cc", "memory"
+#endif
+
+static const byte shaext_bswap_mask[16] __attribute__ ((aligned (16))) =
+  { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+
+/* %xmm0 holds the message words plus constants and is the implicit
+   operand of sha256rnds2, %xmm1 and %xmm2 the ABEF and CDGH halves of
+   the state, %xmm3 to %xmm6 the message schedule.  */
+#define SHAEXT_LOAD(i, m)                               \
+  "movdqu " #i "*16(%[data]), %%xmm0\n\t"              \
+  "pshufb %[mask], %%xmm0\n\t"                         \
+  "movdqa %%xmm0, %%xmm" #m "\n\t"
+#define SHAEXT_MOV(m)                                   \
+  "movdqa %%xmm" #m ", %%xmm0\n\t"
+#define SHAEXT_RND1(i)                                  \
+  "paddd " #i "*16(%[k]), %%xmm0\n\t"                  \
+  "sha256rnds2 %%xmm1, %%xmm2\n\t"
+#define SHAEXT_RND2                                     \
+  "pshufd $0x0e, %%xmm0, %%xmm0\n\t"                   \
+  "sha256rnds2 %%xmm2, %%xmm1\n\t"
+#define SHAEXT_MSG1(c, p)                               \
+  "sha256msg1 %%xmm" #c ", %%xmm" #p "\n\t"
+#define SHAEXT_MSG2(c, p, n)                            \
+  "movdqa %%xmm" #c ", %%xmm7\n\t"                     \
+  "palignr $4, %%xmm" #p ", %%xmm7\n\t"                \
+  "paddd %%xmm7, %%xmm" #n "\n\t"                      \
+  "sha256msg2 %%xmm" #c ", %%xmm" #n "\n\t"
+
+static void
+transform_shaext (SHA256_CONTEXT *hd, const unsigned char *data)
+{
+  asm volatile
+    (/* DCBA, HGFE -> ABEF, CDGH.  */
+     "movdqu (%[state]), %%xmm1\n\t"
+     "movdqu 16(%[state]), %%xmm2\n\t"
+     "pshufd $0xb1, %%xmm1, %%xmm1\n\t"
+     "pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+     "movdqa %%xmm1, %%xmm7\n\t"
+     "palignr $8, %%xmm2, %%xmm1\n\t"
+     "pblendw $0xf0, %%xmm7, %%xmm2\n\t"
+
+     SHAEXT_LOAD (0, 3) SHAEXT_RND1 (0) SHAEXT_RND2
+     SHAEXT_LOAD (1, 4) SHAEXT_RND1 (1) SHAEXT_RND2 SHAEXT_MSG1 (4, 3)
+     SHAEXT_LOAD (2, 5) SHAEXT_RND1 (2) SHAEXT_RND2 SHAEXT_MSG1 (5, 4)
+     SHAEXT_LOAD (3, 6) SHAEXT_RND1 (3) SHAEXT_MSG2 (6, 5, 3)
+     SHAEXT_RND2 SHAEXT_MSG1 (6, 5)
+     SHAEXT_MOV (3) SHAEXT_RND1 (4) SHAEXT_MSG2 (3, 6, 4)
+     SHAEXT_RND2 SHAEXT_MSG1 (3, 6)
+     SHAEXT_MOV (4) SHAEXT_RND1 (5) SHAEXT_MSG2 (4, 3, 5)
+     SHAEXT_RND2 SHAEXT_MSG1 (4, 3)
+     SHAEXT_MOV (5) SHAEXT_RND1 (6) SHAEXT_MSG2 (5, 4, 6)
+     SHAEXT_RND2 SHAEXT_MSG1 (5, 4)
+     SHAEXT_MOV (6) SHAEXT_RND1 (7) SHAEXT_MSG2 (6, 5, 3)
+     SHAEXT_RND2 SHAEXT_MSG1 (6, 5)
+     SHAEXT_MOV (3) SHAEXT_RND1 (8) SHAEXT_MSG2 (3, 6, 4)
+     SHAEXT_RND2 SHAEXT_MSG1 (3, 6)
+     SHAEXT_MOV (4) SHAEXT_RND1 (9) SHAEXT_MSG2 (4, 3, 5)
+     SHAEXT_RND2 SHAEXT_MSG1 (4, 3)
+     SHAEXT_MOV (5) SHAEXT_RND1 (10) SHAEXT_MSG2 (5, 4, 6)
+     SHAEXT_RND2 SHAEXT_MSG1 (5, 4)
+     SHAEXT_MOV (6) SHAEXT_RND1 (11) SHAEXT_MSG2 (6, 5, 3)
+     SHAEXT_RND2 SHAEXT_MSG1 (6, 5)
+     SHAEXT_MOV (3) SHAEXT_RND1 (12) SHAEXT_MSG2 (3, 6, 4)
+     SHAEXT_RND2 SHAEXT_MSG1 (3, 6)
+     SHAEXT_MOV (4) SHAEXT_RND1 (13) SHAEXT_MSG2 (4, 3, 5)
+     SHAEXT_RND2
+     SHAEXT_MOV (5) SHAEXT_RND1 (14) SHAEXT_MSG2 (5, 4, 6)
+     SHAEXT_RND2
+     SHAEXT_MOV (6) SHAEXT_RND1 (15)
+     SHAEXT_RND2
+
+     /* ABEF, CDGH -> DCBA, HGFE and add the previous state.  */
+     "pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+     "pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+     "movdqa %%xmm1, %%xmm7\n\t"
+     "pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+     "palignr $8, %%xmm7, %%xmm2\n\t"
+     "movdqu (%[state]), %%xmm3\n\t"
+     "movdqu 16(%[state]), %%xmm4\n\t"
+     "paddd %%xmm3, %%xmm1\n\t"
+     "paddd %%xmm4, %%xmm2\n\t"
+     "movdqu %%xmm1, (%[state])\n\t"
+     "movdqu %%xmm2, 16(%[state])\n\t"
+
+     "pxor %%xmm0, %%xmm0\n\t"
+     "pxor %%xmm1, %%xmm1\n\t"
+     "pxor %%xmm2, %%xmm2\n\t"
+     "pxor %%xmm3, %%xmm3\n\t"
+     "pxor %%xmm4, %%xmm4\n\t"
+     "pxor %%xmm5, %%xmm5\n\t"
+     "pxor %%xmm6, %%xmm6\n\t"
+     "pxor %%xmm7, %%xmm7\n\t"
+     :
+     : [state] "r" (&hd->h0), [data] "r" (data), [k] "r" (K),
+       [mask] "m" (shaext_bswap_mask)
+     : SHAEXT_CLOBBERS);
+}
+
+#undef SHAEXT_LOAD
+#undef SHAEXT_MOV
+#undef SHAEXT_RND1
+#undef SHAEXT_RND2
+#undef SHAEXT_MSG1
+#undef SHAEXT_MSG2
+#endif /*USE_SHAEXT*/
+
  
 static void
 transform (SHA256_CONTEXT *hd, const unsigned char *data)
 {
-  static const u32 K[64] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-  };
-
   u32 a,b,c,d,e,f,g,h,t1,t2;
-  u32 x[16];
-  u32 w[64];
-  int i;
-  
+  u32 w[16];
+
+#ifdef USE_SHAEXT
+  if (hd->use_shaext)
+    {
+      transform_shaext (hd, data);
+      return;
+    }
+#endif
+
   a = hd->h0;
   b = hd->h1;
   c = hd->h2;
@@ -176,75 +314,81 @@ transform (SHA256_CONTEXT *hd, const unsigned char *data)
   h = hd->h7;
   
 #ifdef WORDS_BIGENDIAN
-  memcpy (x, data, 64);
+  memcpy (w, data, 64);
 #else
   { 
-    byte *p2;
-  
-    for (i=0, p2=(byte*)x; i < 16; i++, p2 += 4 ) 
-      {
-        p2[3] = *data++;
-        p2[2] = *data++;
-        p2[1] = *data++;
-        p2[0] = *data++;
-      }
+    int i;
+
+    for (i = 0; i < 16; i++, data += 4)
+      w[i] = ((u32) data[0] << 24 | (u32) data[1] << 16
+              | (u32) data[2] << 8 | data[3]);
   }
 #endif
 
-  for (i=0; i < 16; i++)
-    w[i] = x[i];
-  for (; i < 64; i++)
-    w[i] = S1(w[i-2]) + w[i-7] + S0(w[i-15]) + w[i-16];
-
-  for (i=0; i < 64;)
-    {
-#if 0
-      R(a,b,c,d,e,f,g,h,K[i],w[i]);
-      i++;
-#else
-      t1 = h + Sum1 (e) + Cho (e, f, g) + K[i] + w[i];   
-      t2 = Sum0 (a) + Maj (a, b, c);
-      d += t1;
-      h  = t1 + t2;
-
-      t1 = g + Sum1 (d) + Cho (d, e, f) + K[i+1] + w[i+1];
-      t2 = Sum0 (h) + Maj (h, a, b);
-      c += t1;
-      g  = t1 + t2;
-
-      t1 = f + Sum1 (c) + Cho (c, d, e) + K[i+2] + w[i+2];
-      t2 = Sum0 (g) + Maj (g, h, a);
-      b += t1;
-      f  = t1 + t2;
-
-      t1 = e + Sum1 (b) + Cho (b, c, d) + K[i+3] + w[i+3];
-      t2 = Sum0 (f) + Maj (f, g, h);
-      a += t1;
-      e  = t1 + t2;
-
-      t1 = d + Sum1 (a) + Cho (a, b, c) + K[i+4] + w[i+4];
-      t2 = Sum0 (e) + Maj (e, f, g);
-      h += t1;
-      d  = t1 + t2;
-
-      t1 = c + Sum1 (h) + Cho (h, a, b) + K[i+5] + w[i+5];
-      t2 = Sum0 (d) + Maj (d, e, f);
-      g += t1;
-      c  = t1 + t2;
-
-      t1 = b + Sum1 (g) + Cho (g, h, a) + K[i+6] + w[i+6];
-      t2 = Sum0 (c) + Maj (c, d, e);
-      f += t1;
-      b  = t1 + t2;
-
-      t1 = a + Sum1 (f) + Cho (f, g, h) + K[i+7] + w[i+7];
-      t2 = Sum0 (b) + Maj (b, c, d);
-      e += t1;
-      a  = t1 + t2;
-
-      i += 8;
-#endif
-    }
+  R(a, b, c, d, e, f, g, h, K[ 0], w[ 0]);
+  R(h, a, b, c, d, e, f, g, K[ 1], w[ 1]);
+  R(g, h, a, b, c, d, e, f, K[ 2], w[ 2]);
+  R(f, g, h, a, b, c, d, e, K[ 3], w[ 3]);
+  R(e, f, g, h, a, b, c, d, K[ 4], w[ 4]);
+  R(d, e, f, g, h, a, b, c, K[ 5], w[ 5]);
+  R(c, d, e, f, g, h, a, b, K[ 6], w[ 6]);
+  R(b, c, d, e, f, g, h, a, K[ 7], w[ 7]);
+  R(a, b, c, d, e, f, g, h, K[ 8], w[ 8]);
+  R(h, a, b, c, d, e, f, g, K[ 9], w[ 9]);
+  R(g, h, a, b, c, d, e, f, K[10], w[10]);
+  R(f, g, h, a, b, c, d, e, K[11], w[11]);
+  R(e, f, g, h, a, b, c, d, K[12], w[12]);
+  R(d, e, f, g, h, a, b, c, K[13], w[13]);
+  R(c, d, e, f, g, h, a, b, K[14], w[14]);
+  R(b, c, d, e, f, g, h, a, K[15], w[15]);
+  R(a, b, c, d, e, f, g, h, K[16], W(16));
+  R(h, a, b, c, d, e, f, g, K[17], W(17));
+  R(g, h, a, b, c, d, e, f, K[18], W(18));
+  R(f, g, h, a, b, c, d, e, K[19], W(19));
+  R(e, f, g, h, a, b, c, d, K[20], W(20));
+  R(d, e, f, g, h, a, b, c, K[21], W(21));
+  R(c, d, e, f, g, h, a, b, K[22], W(22));
+  R(b, c, d, e, f, g, h, a, K[23], W(23));
+  R(a, b, c, d, e, f, g, h, K[24], W(24));
+  R(h, a, b, c, d, e, f, g, K[25], W(25));
+  R(g, h, a, b, c, d, e, f, K[26], W(26));
+  R(f, g, h, a, b, c, d, e, K[27], W(27));
+  R(e, f, g, h, a, b, c, d, K[28], W(28));
+  R(d, e, f, g, h, a, b, c, K[29], W(29));
+  R(c, d, e, f, g, h, a, b, K[30], W(30));
+  R(b, c, d, e, f, g, h, a, K[31], W(31));
+  R(a, b, c, d, e, f, g, h, K[32], W(32));
+  R(h, a, b, c, d, e, f, g, K[33], W(33));
+  R(g, h, a, b, c, d, e, f, K[34], W(34));
+  R(f, g, h, a, b, c, d, e, K[35], W(35));
+  R(e, f, g, h, a, b, c, d, K[36], W(36));
+  R(d, e, f, g, h, a, b, c, K[37], W(37));
+  R(c, d, e, f, g, h, a, b, K[38], W(38));
+  R(b, c, d, e, f, g, h, a, K[39], W(39));
+  R(a, b, c, d, e, f, g, h, K[40], W(40));
+  R(h, a, b, c, d, e, f, g, K[41], W(41));
+  R(g, h, a, b, c, d, e, f, K[42], W(42));
+  R(f, g, h, a, b, c, d, e, K[43], W(43));
+  R(e, f, g, h, a, b, c, d, K[44], W(44));
+  R(d, e, f, g, h, a, b, c, K[45], W(45));
+  R(c, d, e, f, g, h, a, b, K[46], W(46));
+  R(b, c, d, e, f, g, h, a, K[47], W(47));
+  R(a, b, c, d, e, f, g, h, K[48], W(48));
+  R(h, a, b, c, d, e, f, g, K[49], W(49));
+  R(g, h, a, b, c, d, e, f, K[50], W(50));
+  R(f, g, h, a, b, c, d, e, K[51], W(51));
+  R(e, f, g, h, a, b, c, d, K[52], W(52));
+  R(d, e, f, g, h, a, b, c, K[53], W(53));
+  R(c, d, e, f, g, h, a, b, K[54], W(54));
+  R(b, c, d, e, f, g, h, a, K[55], W(55));
+  R(a, b, c, d, e, f, g, h, K[56], W(56));
+  R(h, a, b, c, d, e, f, g, K[57], W(57));
+  R(g, h, a, b, c, d, e, f, K[58], W(58));
+  R(f, g, h, a, b, c, d, e, K[59], W(59));
+  R(e, f, g, h, a, b, c, d, K[60], W(60));
+  R(d, e, f, g, h, a, b, c, K[61], W(61));
+  R(c, d, e, f, g, h, a, b, K[62], W(62));
+  R(b, c, d, e, f, g, h, a, K[63], W(63));
 
   hd->h0 += a;
   hd->h1 += b;
@@ -257,6 +401,7 @@ transform (SHA256_CONTEXT *hd, const unsigned char *data)
 }
 #undef S0
 #undef S1
+#undef W
 #undef R
 
 
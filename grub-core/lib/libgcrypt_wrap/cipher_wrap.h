@@ -51,6 +51,29 @@ fips_mode (void)
   return 0;
 }
 
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+
+#define HWF_INTEL_AESNI 256
+#define HWF_INTEL_SHAEXT 512
+
+static inline unsigned int
+_gcry_get_hw_features (void)
+{
+  unsigned int sse = grub_cpu_sse_features ();
+  unsigned int features = 0;
+
+  if (sse & GRUB_CPU_AESNI)
+    features |= HWF_INTEL_AESNI;
+  /* The SHA code also uses SSSE3 and SSE4.1 instructions.  */
+  if ((sse & GRUB_CPU_SHA) && (sse & GRUB_CPU_SSSE3)
+      && (sse & GRUB_CPU_SSE4_1))
+    features |= HWF_INTEL_SHAEXT;
+
+  return features;
+}
+#endif
+
 #ifdef GRUB_UTIL
 #pragma GCC diagnostic ignored "-Wshadow"
 
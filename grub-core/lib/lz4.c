@@ -0,0 +1,107 @@
+/* lz4.c - decompressor for raw LZ4 blocks.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2013  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MIN_MATCH 4
+
+/* Read a length continued by 255-valued bytes.  */
+static int
+read_length (const grub_uint8_t **ip, const grub_uint8_t *iend,
+	     grub_size_t *len)
+{
+  grub_uint8_t b;
+
+  do
+    {
+      if (*ip >= iend)
+	return 0;
+      b = *(*ip)++;
+      *len += b;
+    }
+  while (b == 255);
+  return 1;
+}
+
+grub_ssize_t
+grub_lz4_decompress (const void *inbuf, grub_size_t insize,
+		     void *outbuf, grub_size_t outsize)
+{
+  const grub_uint8_t *ip = inbuf;
+  const grub_uint8_t *iend = ip + insize;
+  grub_uint8_t *op = outbuf;
+  grub_uint8_t *oend = op + outsize;
+
+  while (ip < iend)
+    {
+      grub_uint8_t token = *ip++;
+      grub_size_t len = token >> 4;
+      grub_size_t offset;
+      const grub_uint8_t *match;
+
+      if (len == 15 && !read_length (&ip, iend, &len))
+	goto fail;
+      if (len > (grub_size_t) (iend - ip) || len > (grub_size_t) (oend - op))
+	goto fail;
+      grub_memcpy (op, ip, len);
+      op += len;
+      ip += len;
+
+      /* The last sequence has only literals.  */
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	goto fail;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (grub_size_t) (op - (grub_uint8_t *) outbuf))
+	goto fail;
+
+      len = token & 0xf;
+      if (len == 15 && !read_length (&ip, iend, &len))
+	goto fail;
+      len += LZ4_MIN_MATCH;
+      if (len > (grub_size_t) (oend - op))
+	goto fail;
+
+      match = op - offset;
+      if (offset >= len)
+	{
+	  grub_memcpy (op, match, len);
+	  op += len;
+	}
+      else
+	/* Overlapping copy repeats the last OFFSET bytes.  */
+	while (len--)
+	  *op++ = *match++;
+    }
+
+  return op - (grub_uint8_t *) outbuf;
+
+ fail:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 block");
+  return -1;
+}
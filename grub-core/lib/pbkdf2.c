@@ -25,6 +25,26 @@
 
 GRUB_MOD_LICENSE ("GPLv2+");
 
+/* Compute one HMAC with the key already absorbed into INNER and OUTER,
+   which hold the hash state after the inner and outer pads.  This
+   saves hashing the two pad blocks on every iteration.  */
+static void
+hmac_precomputed (const struct gcry_md_spec *md, void *ctx,
+		  const void *inner, const void *outer,
+		  const grub_uint8_t *in, grub_size_t inlen,
+		  grub_uint8_t *out)
+{
+  grub_memcpy (ctx, inner, md->contextsize);
+  md->write (ctx, in, inlen);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), md->mdlen);
+
+  grub_memcpy (ctx, outer, md->contextsize);
+  md->write (ctx, out, md->mdlen);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), md->mdlen);
+}
+
 /* Implement PKCS#5 PBKDF2 as per RFC 2898.  The PRF to use is HMAC variant
    of digest supplied by MD.  Inputs are the password P of length PLEN,
    the salt S of length SLEN, the iteration counter C (> 0), and the
@@ -48,9 +68,10 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   unsigned int r;
   unsigned int i;
   unsigned int k;
-  gcry_err_code_t rc;
   grub_uint8_t *tmp;
   grub_size_t tmplen = Slen + 4;
+  grub_uint8_t *ctxs, *inner, *outer, *ctx;
+  grub_uint8_t *pad;
 
   if (c == 0)
     return GPG_ERR_INV_ARG;
@@ -61,6 +82,9 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   if (dkLen > 4294967295U)
     return GPG_ERR_INV_ARG;
 
+  if (md->mdlen > md->blocksize)
+    return GPG_ERR_INV_ARG;
+
   l = ((dkLen - 1) / hLen) + 1;
   r = dkLen - (l - 1) * hLen;
 
@@ -68,31 +92,48 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   if (tmp == NULL)
     return GPG_ERR_OUT_OF_MEMORY;
 
+  ctxs = grub_malloc (3 * md->contextsize + md->blocksize);
+  if (ctxs == NULL)
+    {
+      grub_free (tmp);
+      return GPG_ERR_OUT_OF_MEMORY;
+    }
+  inner = ctxs;
+  outer = inner + md->contextsize;
+  ctx = outer + md->contextsize;
+  pad = ctx + md->contextsize;
+
+  /* Hash the key into the inner and outer states once.  */
+  grub_memset (pad, 0, md->blocksize);
+  if (Plen > md->blocksize)
+    grub_crypto_hash (md, pad, P, Plen);
+  else
+    grub_memcpy (pad, P, Plen);
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36;
+  md->init (inner);
+  md->write (inner, pad, md->blocksize);
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36 ^ 0x5c;
+  md->init (outer);
+  md->write (outer, pad, md->blocksize);
+  grub_memset (pad, 0, md->blocksize);
+
   grub_memcpy (tmp, S, Slen);
 
   for (i = 1; i - 1 < l; i++)
     {
-      grub_memset (T, 0, hLen);
+      tmp[Slen + 0] = (i & 0xff000000) >> 24;
+      tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
+      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
+      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
+
+      hmac_precomputed (md, ctx, inner, outer, tmp, tmplen, U);
+      grub_memcpy (T, U, hLen);
 
-      for (u = 0; u < c; u++)
+      for (u = 1; u < c; u++)
 	{
-	  if (u == 0)
-	    {
-	      tmp[Slen + 0] = (i & 0xff000000) >> 24;
-	      tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
-	      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
-	      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
-
-	      rc = grub_crypto_hmac_buffer (md, P, Plen, tmp, tmplen, U);
-	    }
-	  else
-	    rc = grub_crypto_hmac_buffer (md, P, Plen, U, hLen, U);
-
-	  if (rc != GPG_ERR_NO_ERROR)
-	    {
-	      grub_free (tmp);
-	      return rc;
-	    }
+	  hmac_precomputed (md, ctx, inner, outer, U, hLen, U);
 
 	  for (k = 0; k < hLen; k++)
 	    T[k] ^= U[k];
@@ -101,6 +142,10 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
       grub_memcpy (DK + (i - 1) * hLen, T, i == l ? r : hLen);
     }
 
+  grub_memset (ctxs, 0, 3 * md->contextsize);
+  grub_memset (U, 0, hLen);
+  grub_memset (T, 0, hLen);
+  grub_free (ctxs);
   grub_free (tmp);
 
   return GPG_ERR_NO_ERROR;
@@ -0,0 +1,982 @@
+/* zstd.c - decompressor for Zstandard frames (RFC 8878).  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2013  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Only what is needed to read data in memory is supported: frames using
+   dictionaries are rejected and content checksums aren't verified.  */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_MAGIC 0xfd2fb528
+#define ZSTD_SKIPPABLE_MAGIC 0x184d2a50
+#define ZSTD_SKIPPABLE_MASK 0xfffffff0
+
+#define ZSTD_BLOCK_MAX (128 * 1024)
+
+enum
+  {
+    ZSTD_BLOCK_RAW = 0,
+    ZSTD_BLOCK_RLE = 1,
+    ZSTD_BLOCK_COMPRESSED = 2
+  };
+
+enum
+  {
+    ZSTD_LITERALS_RAW = 0,
+    ZSTD_LITERALS_RLE = 1,
+    ZSTD_LITERALS_COMPRESSED = 2,
+    ZSTD_LITERALS_TREELESS = 3
+  };
+
+enum
+  {
+    ZSTD_MODE_PREDEFINED = 0,
+    ZSTD_MODE_RLE = 1,
+    ZSTD_MODE_FSE = 2,
+    ZSTD_MODE_REPEAT = 3
+  };
+
+#define FSE_MAX_LOG 9
+#define FSE_MAX_SYMBOLS 256
+#define HUF_MAX_LOG 11
+#define HUF_MAX_SYMBOLS 256
+
+#define LL_MAX_LOG 9
+#define ML_MAX_LOG 9
+#define OF_MAX_LOG 8
+#define LL_MAX_CODE 35
+#define ML_MAX_CODE 52
+#define OF_MAX_CODE 31
+
+struct fse_table
+{
+  unsigned log;
+  grub_uint8_t symbol[1 << FSE_MAX_LOG];
+  grub_uint8_t nbits[1 << FSE_MAX_LOG];
+  grub_uint16_t base[1 << FSE_MAX_LOG];
+};
+
+struct huf_table
+{
+  unsigned log;
+  grub_uint8_t symbol[1 << HUF_MAX_LOG];
+  grub_uint8_t nbits[1 << HUF_MAX_LOG];
+};
+
+/* State kept between the blocks of a frame.  */
+struct zstd_ctx
+{
+  struct fse_table ll, of, ml;
+  int have_ll, have_of, have_ml;
+  struct huf_table huf;
+  int have_huf;
+  grub_size_t rep[3];
+  grub_uint8_t literals[ZSTD_BLOCK_MAX];
+};
+
+static const grub_int16_t ll_default[LL_MAX_CODE + 1] =
+  {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+  };
+
+static const grub_int16_t ml_default[ML_MAX_CODE + 1] =
+  {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+  };
+
+static const grub_int16_t of_default[29] =
+  {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+  };
+
+static const grub_uint32_t ll_base[LL_MAX_CODE + 1] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+  };
+
+static const grub_uint8_t ll_bits[LL_MAX_CODE + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+  };
+
+static const grub_uint32_t ml_base[ML_MAX_CODE + 1] =
+  {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+  };
+
+static const grub_uint8_t ml_bits[ML_MAX_CODE + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+  };
+
+static int
+highest_bit (grub_uint32_t v)
+{
+  int r = -1;
+
+  while (v)
+    {
+      v >>= 1;
+      r++;
+    }
+  return r;
+}
+
+static grub_uint32_t
+get_le (const grub_uint8_t *p, unsigned n)
+{
+  grub_uint32_t v = 0;
+  unsigned i;
+
+  for (i = 0; i < n; i++)
+    v |= (grub_uint32_t) p[i] << (8 * i);
+  return v;
+}
+
+/* Return NBITS (at most 32) bits starting at bit POS of BUF.  The caller
+   ensures they are inside the buffer.  */
+static grub_uint32_t
+peek_bits (const grub_uint8_t *buf, grub_size_t pos, unsigned nbits)
+{
+  const grub_uint8_t *p = buf + (pos >> 3);
+  unsigned shift = pos & 7;
+  unsigned nbytes = (shift + nbits + 7) >> 3;
+  grub_uint64_t v = 0;
+  unsigned i;
+
+  if (!nbits)
+    return 0;
+  for (i = 0; i < nbytes; i++)
+    v |= (grub_uint64_t) p[i] << (8 * i);
+  return (v >> shift) & ((1ULL << nbits) - 1);
+}
+
+/* Backward bit stream as used by FSE and Huffman coded data.  It's read
+   from the last bit towards the first, bits before the start of the
+   stream read as zero.  */
+struct bitstream
+{
+  const grub_uint8_t *buf;
+  grub_int64_t pos;
+};
+
+static int
+bitstream_init (struct bitstream *bs, const grub_uint8_t *buf,
+		grub_size_t size)
+{
+  if (size == 0 || buf[size - 1] == 0)
+    return 0;
+  bs->buf = buf;
+  /* The last byte is padded with zeros followed by a 1.  */
+  bs->pos = (grub_int64_t) size * 8 - 8 + highest_bit (buf[size - 1]);
+  return 1;
+}
+
+static grub_uint32_t
+bitstream_read (struct bitstream *bs, unsigned nbits)
+{
+  grub_int64_t start;
+  unsigned shift = 0;
+
+  if (!nbits)
+    return 0;
+  bs->pos -= nbits;
+  start = bs->pos;
+  if (start < 0)
+    {
+      if (-start >= nbits)
+	return 0;
+      shift = -start;
+      nbits -= shift;
+      start = 0;
+    }
+  return peek_bits (bs->buf, start, nbits) << shift;
+}
+
+/* Build the decoding table from normalized counts.  */
+static int
+fse_build (struct fse_table *t, const grub_int16_t *norm, unsigned nsym,
+	   unsigned log)
+{
+  grub_uint16_t next[FSE_MAX_SYMBOLS];
+  unsigned size = 1 << log;
+  unsigned high = size;
+  unsigned step = (size >> 1) + (size >> 3) + 3;
+  unsigned pos = 0;
+  unsigned s, i;
+
+  t->log = log;
+  for (s = 0; s < nsym; s++)
+    if (norm[s] == -1)
+      {
+	t->symbol[--high] = s;
+	next[s] = 1;
+      }
+
+  for (s = 0; s < nsym; s++)
+    {
+      if (norm[s] <= 0)
+	continue;
+      next[s] = norm[s];
+      for (i = 0; i < (unsigned) norm[s]; i++)
+	{
+	  t->symbol[pos] = s;
+	  do
+	    pos = (pos + step) & (size - 1);
+	  while (pos >= high);
+	}
+    }
+  if (pos != 0)
+    return 0;
+
+  for (i = 0; i < size; i++)
+    {
+      grub_uint16_t n = next[t->symbol[i]]++;
+      t->nbits[i] = log - highest_bit (n);
+      t->base[i] = (n << t->nbits[i]) - size;
+    }
+  return 1;
+}
+
+static void
+fse_build_rle (struct fse_table *t, grub_uint8_t symbol)
+{
+  t->log = 0;
+  t->symbol[0] = symbol;
+  t->nbits[0] = 0;
+  t->base[0] = 0;
+}
+
+/* Read an FSE table description.  Returns the number of bytes used or
+   0 on corruption.  */
+static grub_size_t
+fse_read_table (struct fse_table *t, const grub_uint8_t *buf,
+		grub_size_t size, unsigned max_log, unsigned max_symbol)
+{
+  grub_int16_t norm[FSE_MAX_SYMBOLS];
+  grub_size_t pos = 0, limit = size * 8;
+  grub_int32_t remaining;
+  unsigned log;
+  unsigned sym = 0;
+
+  if (limit < 4)
+    return 0;
+  log = peek_bits (buf, 0, 4) + 5;
+  pos = 4;
+  if (log > max_log)
+    return 0;
+  remaining = 1 << log;
+
+  while (remaining > 0 && sym <= max_symbol)
+    {
+      unsigned nbits = highest_bit (remaining + 1) + 1;
+      grub_uint32_t low_mask = (1U << (nbits - 1)) - 1;
+      grub_uint32_t threshold = (1U << nbits) - 1 - (remaining + 1);
+      grub_uint32_t val;
+      grub_int16_t prob;
+
+      if (pos + nbits > limit)
+	return 0;
+      val = peek_bits (buf, pos, nbits);
+      if ((val & low_mask) < threshold)
+	{
+	  val &= low_mask;
+	  pos += nbits - 1;
+	}
+      else
+	{
+	  if (val > low_mask)
+	    val -= threshold;
+	  pos += nbits;
+	}
+      prob = (grub_int16_t) val - 1;
+      remaining -= prob < 0 ? -prob : prob;
+      norm[sym++] = prob;
+
+      if (prob == 0)
+	{
+	  grub_uint32_t repeat;
+	  do
+	    {
+	      unsigned i;
+	      if (pos + 2 > limit)
+		return 0;
+	      repeat = peek_bits (buf, pos, 2);
+	      pos += 2;
+	      for (i = 0; i < repeat && sym <= max_symbol; i++)
+		norm[sym++] = 0;
+	    }
+	  while (repeat == 3);
+	}
+    }
+  if (remaining != 0)
+    return 0;
+
+  if (!fse_build (t, norm, sym, log))
+    return 0;
+  return (pos + 7) >> 3;
+}
+
+static grub_uint16_t
+fse_init_state (const struct fse_table *t, struct bitstream *bs)
+{
+  return bitstream_read (bs, t->log);
+}
+
+static grub_uint8_t
+fse_decode (const struct fse_table *t, grub_uint16_t *state,
+	    struct bitstream *bs)
+{
+  grub_uint8_t symbol = t->symbol[*state];
+  *state = t->base[*state] + bitstream_read (bs, t->nbits[*state]);
+  return symbol;
+}
+
+static int
+huf_build (struct huf_table *t, const grub_uint8_t *weights, unsigned n)
+{
+  grub_uint32_t sum = 0, left;
+  grub_uint32_t rank_count[HUF_MAX_LOG + 1];
+  grub_uint32_t rank_idx[HUF_MAX_LOG + 1];
+  grub_uint8_t nbits[HUF_MAX_SYMBOLS];
+  unsigned log, i;
+  int last;
+
+  if (n == 0 || n >= HUF_MAX_SYMBOLS)
+    return 0;
+  for (i = 0; i < n; i++)
+    {
+      if (weights[i] > HUF_MAX_LOG)
+	return 0;
+      if (weights[i])
+	sum += 1U << (weights[i] - 1);
+    }
+  if (sum == 0)
+    return 0;
+  log = highest_bit (sum) + 1;
+  if (log > HUF_MAX_LOG)
+    return 0;
+  /* The weight of the last symbol completes the sum to a power of 2.  */
+  left = (1U << log) - sum;
+  if (left & (left - 1))
+    return 0;
+  last = highest_bit (left) + 1;
+
+  grub_memset (rank_count, 0, sizeof (rank_count));
+  for (i = 0; i <= n; i++)
+    {
+      unsigned w = i < n ? weights[i] : (unsigned) last;
+      nbits[i] = w ? log + 1 - w : 0;
+      rank_count[nbits[i]]++;
+    }
+
+  t->log = log;
+  rank_idx[log] = 0;
+  for (i = log; i >= 1; i--)
+    {
+      rank_idx[i - 1] = rank_idx[i] + rank_count[i] * (1U << (log - i));
+      if (rank_idx[i - 1] > (1U << log))
+	return 0;
+      grub_memset (&t->nbits[rank_idx[i]], i, rank_idx[i - 1] - rank_idx[i]);
+    }
+  if (rank_idx[0] != (1U << log))
+    return 0;
+
+  for (i = 0; i <= n; i++)
+    if (nbits[i])
+      {
+	grub_uint32_t len = 1U << (log - nbits[i]);
+	grub_memset (&t->symbol[rank_idx[nbits[i]]], i, len);
+	rank_idx[nbits[i]] += len;
+      }
+  return 1;
+}
+
+/* Read a Huffman tree description.  Returns the number of bytes used or
+   0 on corruption.  */
+static grub_size_t
+huf_read_table (struct huf_table *t, const grub_uint8_t *buf,
+		grub_size_t size)
+{
+  grub_uint8_t weights[HUF_MAX_SYMBOLS];
+  unsigned n = 0;
+  grub_size_t used;
+  unsigned header;
+
+  if (size < 1)
+    return 0;
+  header = buf[0];
+
+  if (header >= 128)
+    {
+      unsigned i;
+
+      n = header - 127;
+      used = 1 + (n + 1) / 2;
+      if (used > size)
+	return 0;
+      for (i = 0; i < n; i++)
+	weights[i] = (i & 1) ? (buf[1 + i / 2] & 0xf) : (buf[1 + i / 2] >> 4);
+    }
+  else
+    {
+      /* Weights are FSE compressed with two interleaved states.  */
+      struct fse_table *ft;
+      struct bitstream bs;
+      grub_size_t tsize;
+      grub_uint16_t state1, state2;
+
+      used = 1 + header;
+      if (used > size)
+	return 0;
+      ft = grub_malloc (sizeof (*ft));
+      if (!ft)
+	return 0;
+      tsize = fse_read_table (ft, buf + 1, header, 6, 255);
+      if (!tsize || !bitstream_init (&bs, buf + 1 + tsize, header - tsize))
+	{
+	  grub_free (ft);
+	  return 0;
+	}
+      state1 = fse_init_state (ft, &bs);
+      state2 = fse_init_state (ft, &bs);
+      while (1)
+	{
+	  if (n + 2 > HUF_MAX_SYMBOLS)
+	    {
+	      grub_free (ft);
+	      return 0;
+	    }
+	  weights[n++] = fse_decode (ft, &state1, &bs);
+	  if (bs.pos < 0)
+	    {
+	      weights[n++] = ft->symbol[state2];
+	      break;
+	    }
+	  weights[n++] = fse_decode (ft, &state2, &bs);
+	  if (bs.pos < 0)
+	    {
+	      weights[n++] = ft->symbol[state1];
+	      break;
+	    }
+	}
+      grub_free (ft);
+    }
+
+  if (!huf_build (t, weights, n))
+    return 0;
+  return used;
+}
+
+static int
+huf_decode_stream (const struct huf_table *t, const grub_uint8_t *buf,
+		   grub_size_t size, grub_uint8_t *out, grub_size_t outsize)
+{
+  struct bitstream bs;
+  grub_uint32_t state;
+  grub_uint32_t mask = (1U << t->log) - 1;
+  grub_size_t i;
+
+  if (!bitstream_init (&bs, buf, size))
+    return 0;
+  state = bitstream_read (&bs, t->log);
+  for (i = 0; i < outsize; i++)
+    {
+      unsigned nb = t->nbits[state];
+      out[i] = t->symbol[state];
+      state = ((state << nb) | bitstream_read (&bs, nb)) & mask;
+    }
+  /* The stream must be consumed exactly.  */
+  return bs.pos == -(grub_int64_t) t->log;
+}
+
+/* Decode the literals section of a block into CTX->literals.  Returns
+   the number of bytes of the section or 0 on corruption.  */
+static grub_size_t
+decode_literals (struct zstd_ctx *ctx, const grub_uint8_t *buf,
+		 grub_size_t size, grub_size_t *nlit)
+{
+  unsigned type, format;
+  grub_size_t regen, csize, hsize;
+
+  if (size < 1)
+    return 0;
+  type = buf[0] & 3;
+  format = (buf[0] >> 2) & 3;
+
+  if (type == ZSTD_LITERALS_RAW || type == ZSTD_LITERALS_RLE)
+    {
+      switch (format)
+	{
+	case 1:
+	  hsize = 2;
+	  break;
+	case 3:
+	  hsize = 3;
+	  break;
+	default:
+	  hsize = 1;
+	}
+      if (size < hsize)
+	return 0;
+      if (hsize == 1)
+	regen = buf[0] >> 3;
+      else
+	regen = get_le (buf, hsize) >> 4;
+      if (regen > ZSTD_BLOCK_MAX)
+	return 0;
+      *nlit = regen;
+      if (type == ZSTD_LITERALS_RAW)
+	{
+	  if (size - hsize < regen)
+	    return 0;
+	  grub_memcpy (ctx->literals, buf + hsize, regen);
+	  return hsize + regen;
+	}
+      if (size - hsize < 1)
+	return 0;
+      grub_memset (ctx->literals, buf[hsize], regen);
+      return hsize + 1;
+    }
+
+  {
+    int four_streams = (format != 0);
+    grub_size_t used = 0;
+
+    switch (format)
+      {
+      case 0:
+      case 1:
+	hsize = 3;
+	if (size < hsize)
+	  return 0;
+	regen = (get_le (buf, 3) >> 4) & 0x3ff;
+	csize = get_le (buf, 3) >> 14;
+	break;
+      case 2:
+	hsize = 4;
+	if (size < hsize)
+	  return 0;
+	regen = (get_le (buf, 4) >> 4) & 0x3fff;
+	csize = get_le (buf, 4) >> 18;
+	break;
+      default:
+	hsize = 5;
+	if (size < hsize)
+	  return 0;
+	regen = (get_le (buf, 4) >> 4) & 0x3ffff;
+	csize = (get_le (buf + 2, 3) >> 6) & 0x3ffff;
+	break;
+      }
+    if (regen > ZSTD_BLOCK_MAX || csize > size - hsize)
+      return 0;
+    *nlit = regen;
+    buf += hsize;
+
+    if (type == ZSTD_LITERALS_COMPRESSED)
+      {
+	used = huf_read_table (&ctx->huf, buf, csize);
+	if (!used)
+	  return 0;
+	ctx->have_huf = 1;
+      }
+    else if (!ctx->have_huf)
+      return 0;
+
+    if (!four_streams)
+      {
+	if (!huf_decode_stream (&ctx->huf, buf + used, csize - used,
+				ctx->literals, regen))
+	  return 0;
+      }
+    else
+      {
+	grub_size_t ssize[4];
+	grub_size_t seg = (regen + 3) / 4;
+	const grub_uint8_t *p;
+	unsigned i;
+
+	if (csize - used < 6)
+	  return 0;
+	p = buf + used;
+	ssize[0] = get_le (p, 2);
+	ssize[1] = get_le (p + 2, 2);
+	ssize[2] = get_le (p + 4, 2);
+	if (ssize[0] + ssize[1] + ssize[2] > csize - used - 6
+	    || seg * 3 > regen)
+	  return 0;
+	ssize[3] = csize - used - 6 - ssize[0] - ssize[1] - ssize[2];
+	p += 6;
+	for (i = 0; i < 4; i++)
+	  {
+	    if (!huf_decode_stream (&ctx->huf, p, ssize[i],
+				    ctx->literals + i * seg,
+				    i < 3 ? seg : regen - 3 * seg))
+	      return 0;
+	    p += ssize[i];
+	  }
+      }
+    return hsize + csize;
+  }
+}
+
+/* Set up the table for one sequence symbol type according to MODE.
+   Returns the number of bytes of table description used or -1.  */
+static grub_ssize_t
+read_seq_table (struct fse_table *t, int *have, unsigned mode,
+		const grub_uint8_t *buf, grub_size_t size,
+		const grub_int16_t *def, unsigned ndef, unsigned deflog,
+		unsigned max_log, unsigned max_code)
+{
+  grub_size_t used;
+
+  switch (mode)
+    {
+    case ZSTD_MODE_PREDEFINED:
+      if (!fse_build (t, def, ndef, deflog))
+	return -1;
+      *have = 1;
+      return 0;
+    case ZSTD_MODE_RLE:
+      if (size < 1 || buf[0] > max_code)
+	return -1;
+      fse_build_rle (t, buf[0]);
+      *have = 1;
+      return 1;
+    case ZSTD_MODE_FSE:
+      used = fse_read_table (t, buf, size, max_log, max_code);
+      if (!used)
+	return -1;
+      *have = 1;
+      return used;
+    default:
+      return *have ? 0 : -1;
+    }
+}
+
+static int
+decode_block (struct zstd_ctx *ctx, const grub_uint8_t *buf, grub_size_t size,
+	      grub_uint8_t *frame_start, grub_uint8_t **op, grub_uint8_t *oend)
+{
+  grub_size_t nlit, used, nseq, litpos = 0;
+  grub_ssize_t r;
+  unsigned modes;
+  struct bitstream bs;
+  grub_uint16_t ll_state, of_state, ml_state;
+  grub_uint8_t *out = *op;
+
+  used = decode_literals (ctx, buf, size, &nlit);
+  if (!used)
+    return 0;
+  buf += used;
+  size -= used;
+
+  if (size < 1)
+    return 0;
+  if (buf[0] < 128)
+    {
+      nseq = buf[0];
+      used = 1;
+    }
+  else if (buf[0] < 255)
+    {
+      if (size < 2)
+	return 0;
+      nseq = ((buf[0] - 128) << 8) + buf[1];
+      used = 2;
+    }
+  else
+    {
+      if (size < 3)
+	return 0;
+      nseq = buf[1] + (buf[2] << 8) + 0x7f00;
+      used = 3;
+    }
+  buf += used;
+  size -= used;
+
+  if (nseq == 0)
+    {
+      if (size != 0 || nlit > (grub_size_t) (oend - out))
+	return 0;
+      grub_memcpy (out, ctx->literals, nlit);
+      *op = out + nlit;
+      return 1;
+    }
+
+  if (size < 1)
+    return 0;
+  modes = buf[0];
+  if (modes & 3)
+    return 0;
+  buf++;
+  size--;
+
+  r = read_seq_table (&ctx->ll, &ctx->have_ll, modes >> 6, buf, size,
+		      ll_default, ARRAY_SIZE (ll_default), 6,
+		      LL_MAX_LOG, LL_MAX_CODE);
+  if (r < 0)
+    return 0;
+  buf += r;
+  size -= r;
+  r = read_seq_table (&ctx->of, &ctx->have_of, (modes >> 4) & 3, buf, size,
+		      of_default, ARRAY_SIZE (of_default), 5,
+		      OF_MAX_LOG, OF_MAX_CODE);
+  if (r < 0)
+    return 0;
+  buf += r;
+  size -= r;
+  r = read_seq_table (&ctx->ml, &ctx->have_ml, (modes >> 2) & 3, buf, size,
+		      ml_default, ARRAY_SIZE (ml_default), 6,
+		      ML_MAX_LOG, ML_MAX_CODE);
+  if (r < 0)
+    return 0;
+  buf += r;
+  size -= r;
+
+  if (!bitstream_init (&bs, buf, size))
+    return 0;
+  ll_state = fse_init_state (&ctx->ll, &bs);
+  of_state = fse_init_state (&ctx->of, &bs);
+  ml_state = fse_init_state (&ctx->ml, &bs);
+
+  while (nseq--)
+    {
+      unsigned ll_code = ctx->ll.symbol[ll_state];
+      unsigned of_code = ctx->of.symbol[of_state];
+      unsigned ml_code = ctx->ml.symbol[ml_state];
+      grub_size_t offset, ll, ml;
+      const grub_uint8_t *match;
+
+      if (ll_code > LL_MAX_CODE || ml_code > ML_MAX_CODE
+	  || of_code > OF_MAX_CODE)
+	return 0;
+
+      offset = ((grub_size_t) 1 << of_code) + bitstream_read (&bs, of_code);
+      ml = ml_base[ml_code] + bitstream_read (&bs, ml_bits[ml_code]);
+      ll = ll_base[ll_code] + bitstream_read (&bs, ll_bits[ll_code]);
+
+      if (offset > 3)
+	{
+	  offset -= 3;
+	  ctx->rep[2] = ctx->rep[1];
+	  ctx->rep[1] = ctx->rep[0];
+	  ctx->rep[0] = offset;
+	}
+      else
+	{
+	  unsigned idx = offset - 1 + (ll == 0);
+
+	  if (idx == 0)
+	    offset = ctx->rep[0];
+	  else
+	    {
+	      offset = idx < 3 ? ctx->rep[idx] : ctx->rep[0] - 1;
+	      if (idx > 1)
+		ctx->rep[2] = ctx->rep[1];
+	      ctx->rep[1] = ctx->rep[0];
+	      ctx->rep[0] = offset;
+	    }
+	}
+
+      if (nseq)
+	{
+	  fse_decode (&ctx->ll, &ll_state, &bs);
+	  fse_decode (&ctx->ml, &ml_state, &bs);
+	  fse_decode (&ctx->of, &of_state, &bs);
+	}
+
+      if (ll > nlit - litpos || ll > (grub_size_t) (oend - out))
+	return 0;
+      grub_memcpy (out, ctx->literals + litpos, ll);
+      out += ll;
+      litpos += ll;
+
+      if (offset == 0 || offset > (grub_size_t) (out - frame_start)
+	  || ml > (grub_size_t) (oend - out))
+	return 0;
+      match = out - offset;
+      if (offset >= ml)
+	{
+	  grub_memcpy (out, match, ml);
+	  out += ml;
+	}
+      else
+	while (ml--)
+	  *out++ = *match++;
+    }
+
+  if (bs.pos != 0)
+    return 0;
+
+  if (nlit - litpos > (grub_size_t) (oend - out))
+    return 0;
+  grub_memcpy (out, ctx->literals + litpos, nlit - litpos);
+  out += nlit - litpos;
+  *op = out;
+  return 1;
+}
+
+grub_ssize_t
+grub_zstd_decompress (const void *inbuf, grub_size_t insize,
+		      void *outbuf, grub_size_t outsize)
+{
+  const grub_uint8_t *ip = inbuf;
+  const grub_uint8_t *iend = ip + insize;
+  grub_uint8_t *op = outbuf;
+  grub_uint8_t *oend = op + outsize;
+  struct zstd_ctx *ctx;
+
+  ctx = grub_malloc (sizeof (*ctx));
+  if (!ctx)
+    return -1;
+
+  while (ip < iend)
+    {
+      grub_uint32_t magic;
+      grub_uint8_t fhd;
+      unsigned fcs_size, did_size;
+      grub_uint8_t *frame_start = op;
+      int last;
+
+      if (iend - ip < 4)
+	goto fail;
+      magic = get_le (ip, 4);
+      ip += 4;
+
+      if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC)
+	{
+	  grub_uint32_t len;
+	  if (iend - ip < 4)
+	    goto fail;
+	  len = get_le (ip, 4);
+	  ip += 4;
+	  if (len > (grub_size_t) (iend - ip))
+	    goto fail;
+	  ip += len;
+	  continue;
+	}
+      if (magic != ZSTD_MAGIC || ip >= iend)
+	goto fail;
+
+      fhd = *ip++;
+      if (fhd & 0x08)
+	goto fail;
+      did_size = (fhd & 3) ? (1 << ((fhd & 3) - 1)) : 0;
+      fcs_size = (fhd >> 6) ? (1 << (fhd >> 6)) : ((fhd & 0x20) ? 1 : 0);
+      /* Window descriptor, absent for single segment frames.  */
+      if (!(fhd & 0x20))
+	ip++;
+      if (ip > iend || (grub_size_t) (iend - ip) < did_size + fcs_size)
+	goto fail;
+      if (did_size && get_le (ip, did_size) != 0)
+	{
+	  grub_free (ctx);
+	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		      "zstd dictionaries aren't supported");
+	  return -1;
+	}
+      ip += did_size + fcs_size;
+
+      ctx->have_ll = ctx->have_of = ctx->have_ml = 0;
+      ctx->have_huf = 0;
+      ctx->rep[0] = 1;
+      ctx->rep[1] = 4;
+      ctx->rep[2] = 8;
+
+      do
+	{
+	  grub_uint32_t bh;
+	  grub_size_t bsize;
+
+	  if (iend - ip < 3)
+	    goto fail;
+	  bh = get_le (ip, 3);
+	  ip += 3;
+	  last = bh & 1;
+	  bsize = bh >> 3;
+
+	  switch ((bh >> 1) & 3)
+	    {
+	    case ZSTD_BLOCK_RAW:
+	      if (bsize > (grub_size_t) (iend - ip)
+		  || bsize > (grub_size_t) (oend - op))
+		goto fail;
+	      grub_memcpy (op, ip, bsize);
+	      op += bsize;
+	      ip += bsize;
+	      break;
+	    case ZSTD_BLOCK_RLE:
+	      if (ip >= iend || bsize > (grub_size_t) (oend - op))
+		goto fail;
+	      grub_memset (op, *ip, bsize);
+	      op += bsize;
+	      ip++;
+	      break;
+	    case ZSTD_BLOCK_COMPRESSED:
+	      if (bsize > (grub_size_t) (iend - ip) || bsize > ZSTD_BLOCK_MAX
+		  || !decode_block (ctx, ip, bsize, frame_start, &op, oend))
+		goto fail;
+	      ip += bsize;
+	      break;
+	    default:
+	      goto fail;
+	    }
+	}
+      while (!last);
+
+      /* Content checksum.  */
+      if (fhd & 0x04)
+	{
+	  if (iend - ip < 4)
+	    goto fail;
+	  ip += 4;
+	}
+    }
+
+  grub_free (ctx);
+  return op - (grub_uint8_t *) outbuf;
+
+ fail:
+  grub_free (ctx);
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid zstd data");
+  return -1;
+}
@@ -46,6 +46,117 @@ static struct grub_partition_map grub_gpt_partition_map;
 
 
 
+/* Upper bound on the size of the partition entry array.  The specification
+   requires at least 16 KiB; anything beyond 1 MiB is a corrupt header.  */
+#define GPT_MAX_ENTRIES_SIZE (1 << 20)
+
+/* Entry array of the last GPT read, reused as long as the header still
+   describes the same array.  */
+static struct
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t parent_start;
+  grub_uint64_t entries;
+  grub_uint32_t maxpart;
+  grub_uint32_t partentry_size;
+  grub_uint32_t partentry_crc32;
+  grub_uint8_t *data;
+} gpt_cache;
+
+static grub_uint32_t crc32_table[256];
+
+static void
+init_crc32_table (void)
+{
+  grub_uint32_t c;
+  int i, j;
+
+  for (i = 0; i < 256; i++)
+    {
+      c = i;
+      for (j = 0; j < 8; j++)
+	c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+      crc32_table[i] = c;
+    }
+}
+
+/* IEEE 802.3 CRC-32 as used by the GPT header and entry array.  */
+static grub_uint32_t
+gpt_crc32 (const void *buf, grub_size_t size)
+{
+  const grub_uint8_t *data = buf;
+  grub_uint32_t crc = 0xffffffff;
+
+  if (! crc32_table[1])
+    init_crc32_table ();
+
+  while (size--)
+    crc = (crc >> 8) ^ crc32_table[(crc ^ *data++) & 0xff];
+
+  return crc ^ 0xffffffff;
+}
+
+/* Return the entry array described by GPT, either from the cache or read
+   from DISK in a single request.  The caller owns the returned buffer.  */
+static grub_uint8_t *
+gpt_read_entries (grub_disk_t disk, const struct grub_gpt_header *gpt,
+		  grub_uint64_t entries, grub_size_t size, int *cacheable)
+{
+  grub_disk_addr_t parent_start = 0;
+  grub_uint8_t *data;
+
+  if (disk->partition)
+    parent_start = grub_partition_get_start (disk->partition);
+
+  if (gpt_cache.data
+      && gpt_cache.dev_id == disk->dev->id
+      && gpt_cache.disk_id == disk->id
+      && gpt_cache.parent_start == parent_start
+      && gpt_cache.entries == entries
+      && gpt_cache.maxpart == gpt->maxpart
+      && gpt_cache.partentry_size == gpt->partentry_size
+      && gpt_cache.partentry_crc32 == gpt->partentry_crc32)
+    {
+      /* Detach the buffer so that nested iterations from the hook can't
+	 free it under us.  */
+      data = gpt_cache.data;
+      gpt_cache.data = NULL;
+      *cacheable = 1;
+      return data;
+    }
+
+  data = grub_malloc (size);
+  if (! data)
+    return NULL;
+
+  if (grub_disk_read (disk, entries, 0, size, data))
+    {
+      grub_free (data);
+      return NULL;
+    }
+
+  *cacheable = (gpt_crc32 (data, size)
+		== grub_le_to_cpu32 (gpt->partentry_crc32));
+  if (! *cacheable)
+    {
+      grub_dprintf ("gpt", "GPT entry array CRC mismatch\n");
+      return data;
+    }
+
+  grub_free (gpt_cache.data);
+  gpt_cache.data = NULL;
+  gpt_cache.dev_id = disk->dev->id;
+  gpt_cache.disk_id = disk->id;
+  gpt_cache.parent_start = parent_start;
+  gpt_cache.entries = entries;
+  gpt_cache.maxpart = gpt->maxpart;
+  gpt_cache.partentry_size = gpt->partentry_size;
+  gpt_cache.partentry_crc32 = gpt->partentry_crc32;
+
+  return data;
+}
+
 grub_err_t
 grub_gpt_partition_map_iterate (grub_disk_t disk,
 				grub_partition_iterate_hook_t hook,
@@ -56,8 +167,11 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
   struct grub_gpt_partentry entry;
   struct grub_msdos_partition_mbr mbr;
   grub_uint64_t entries;
-  unsigned int i;
-  int last_offset = 0;
+  grub_uint8_t *data;
+  grub_size_t size, entry_size, offset;
+  unsigned int i, maxpart;
+  grub_err_t err = GRUB_ERR_NONE;
+  int cacheable = 0;
   int sector_log = 0;
 
   /* Read the protective MBR.  */
@@ -89,12 +203,23 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 
   grub_dprintf ("gpt", "Read a valid GPT header\n");
 
+  maxpart = grub_le_to_cpu32 (gpt.maxpart);
+  entry_size = grub_le_to_cpu32 (gpt.partentry_size);
+  if (entry_size < sizeof (entry)
+      || maxpart > GPT_MAX_ENTRIES_SIZE / entry_size)
+    return grub_error (GRUB_ERR_BAD_PART_TABLE, "invalid GPT entry array");
+  size = maxpart * entry_size;
+  if (size == 0)
+    return GRUB_ERR_NONE;
+
   entries = grub_le_to_cpu64 (gpt.partitions) << sector_log;
-  for (i = 0; i < grub_le_to_cpu32 (gpt.maxpart); i++)
+  data = gpt_read_entries (disk, &gpt, entries, size, &cacheable);
+  if (! data)
+    return grub_errno;
+
+  for (i = 0, offset = 0; i < maxpart; i++, offset += entry_size)
     {
-      if (grub_disk_read (disk, entries, last_offset,
-			  sizeof (entry), &entry))
-	return grub_errno;
+      grub_memcpy (&entry, data + offset, sizeof (entry));
 
       if (grub_memcmp (&grub_gpt_partition_type_empty, &entry.type,
 		       sizeof (grub_gpt_partition_type_empty)))
@@ -103,9 +228,9 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 	  part.start = grub_le_to_cpu64 (entry.start) << sector_log;
 	  part.len = (grub_le_to_cpu64 (entry.end)
 		      - grub_le_to_cpu64 (entry.start) + 1)  << sector_log;
-	  part.offset = entries;
+	  part.offset = entries + (offset >> GRUB_DISK_SECTOR_BITS);
 	  part.number = i;
-	  part.index = last_offset;
+	  part.index = offset & (GRUB_DISK_SECTOR_SIZE - 1);
 	  part.partmap = &grub_gpt_partition_map;
 	  part.parent = disk->partition;
 
@@ -114,18 +239,21 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 			(unsigned long long) part.len);
 
 	  if (hook (disk, &part, hook_data))
-	    return grub_errno;
-	}
-
-      last_offset += grub_le_to_cpu32 (gpt.partentry_size);
-      if (last_offset == GRUB_DISK_SECTOR_SIZE)
-	{
-	  last_offset = 0;
-	  entries++;
+	    {
+	      err = grub_errno;
+	      break;
+	    }
 	}
     }
 
-  return GRUB_ERR_NONE;
+  /* Hand the array back to the cache unless a nested iteration refilled
+     it meanwhile.  */
+  if (cacheable && ! gpt_cache.data)
+    gpt_cache.data = data;
+  else
+    grub_free (data);
+
+  return err;
 }
 
 #ifdef GRUB_UTIL
@@ -228,4 +356,6 @@ GRUB_MOD_INIT(part_gpt)
 GRUB_MOD_FINI(part_gpt)
 {
   grub_partition_map_unregister (&grub_gpt_partition_map);
+  grub_free (gpt_cache.data);
+  gpt_cache.data = NULL;
 }
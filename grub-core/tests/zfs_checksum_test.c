@@ -0,0 +1,98 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2013 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/zfs/zfs.h>
+#include <grub/zfs/zio.h>
+#include <grub/zfs/zio_checksum.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+struct checksum_vector
+{
+  const char *name;
+  void (*func) (const void *, grub_uint64_t, grub_zfs_endian_t,
+		zio_cksum_t *);
+  grub_size_t size;
+  grub_zfs_endian_t endian;
+  grub_uint64_t expected[4];
+};
+
+/* Over the bytes (i * 7 + 3) & 0xff.  */
+static const struct checksum_vector vectors[] =
+  {
+    { "fletcher4 le", fletcher_4, 4096, GRUB_ZFS_LITTLE_ENDIAN,
+      { 0x000001f9fe020400ULL, 0x0003f3511b235e00ULL,
+	0x0545fd1458c93000ULL, 0x48df841dc7fb3700ULL } },
+    { "fletcher4 be", fletcher_4, 4096, GRUB_ZFS_BIG_ENDIAN,
+      { 0x0000020601fdf800ULL, 0x00040b5f15095800ULL,
+	0x05660bfc3628dc00ULL, 0x68f2a45a3479bc00ULL } },
+    /* Not a multiple of the four words summed at once.  */
+    { "fletcher4 le tail", fletcher_4, 4100, GRUB_ZFS_LITTLE_ENDIAN,
+      { 0x000001fa16130e03ULL, 0x0003f54b31366c03ULL,
+	0x0549f25f89ff9c03ULL, 0x4e29767d51fad303ULL } },
+    { "fletcher4 be tail", fletcher_4, 4100, GRUB_ZFS_BIG_ENDIAN,
+      { 0x0000020605080918ULL, 0x00040d651a116118ULL,
+	0x056a1961503a3d18ULL, 0x6e5cbdbb84b3f918ULL } },
+    { "sha256", zio_checksum_SHA256, 4096, GRUB_ZFS_BIG_ENDIAN,
+      { 0x7486da8f1e13943fULL, 0xae21a0b043f1e996ULL,
+	0x40d7d8ebafb25266ULL, 0x478b5cddae1272b5ULL } },
+  };
+
+static void
+check (const char *name, const zio_cksum_t *zc, grub_zfs_endian_t endian,
+       const grub_uint64_t *expected)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    grub_test_assert (grub_zfs_to_cpu64 (zc->zc_word[i], endian)
+		      == expected[i],
+		      "%s: word %d is 0x%llx instead of 0x%llx", name, i,
+		      (unsigned long long) grub_zfs_to_cpu64 (zc->zc_word[i],
+							      endian),
+		      (unsigned long long) expected[i]);
+}
+
+static void
+zfs_checksum_test (void)
+{
+  static const grub_uint64_t sha256_abc[4] =
+    { 0xba7816bf8f01cfeaULL, 0x414140de5dae2223ULL,
+      0xb00361a396177a9cULL, 0xb410ff61f20015adULL };
+  static grub_uint8_t buf[4100];
+  zio_cksum_t zc;
+  unsigned i;
+
+  for (i = 0; i < sizeof (buf); i++)
+    buf[i] = i * 7 + 3;
+
+  for (i = 0; i < ARRAY_SIZE (vectors); i++)
+    {
+      vectors[i].func (buf, vectors[i].size, vectors[i].endian, &zc);
+      check (vectors[i].name, &zc, vectors[i].endian, vectors[i].expected);
+    }
+
+  zio_checksum_SHA256 ("abc", 3, GRUB_ZFS_BIG_ENDIAN, &zc);
+  check ("sha256 abc", &zc, GRUB_ZFS_BIG_ENDIAN, sha256_abc);
+}
+
+/* Register zfs_checksum_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (zfs_checksum_test, zfs_checksum_test);
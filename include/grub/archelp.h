@@ -47,6 +47,19 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Optional.  With these the entries of the archive are indexed once
+     and later lookups go straight to the right header.  TELL returns
+     the position of the header find_file will read next, SEEK makes
+     find_file continue from such a position.  */
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t hofs);
+
+  grub_disk_t
+  (*get_disk) (struct grub_archelp_data *data);
 };
 
 grub_err_t
@@ -111,6 +111,28 @@ typedef void (*gcry_cipher_stdecrypt_t) (void *c,
 					 const unsigned char *inbuf,
 					 unsigned int n);
 
+/* Type for the optional functions processing NBLOCKS consecutive blocks
+   in ECB mode.  */
+typedef void (*gcry_cipher_ecb_t) (void *c,
+				   unsigned char *outbuf,
+				   const unsigned char *inbuf,
+				   grub_size_t nblocks);
+
+/* Type for the optional functions processing NBLOCKS consecutive blocks
+   in CBC mode.  IV is updated for the next call.  */
+typedef void (*gcry_cipher_cbc_t) (void *c, unsigned char *iv,
+				   unsigned char *outbuf,
+				   const unsigned char *inbuf,
+				   grub_size_t nblocks);
+
+/* Type for the optional function processing NBLOCKS consecutive blocks
+   in XTS mode.  TWEAK is the encrypted tweak of the first block and is
+   updated for the next call.  */
+typedef void (*gcry_cipher_xts_t) (void *c, unsigned char *tweak,
+				   unsigned char *outbuf,
+				   const unsigned char *inbuf,
+				   grub_size_t nblocks, int encrypt);
+
 typedef struct gcry_cipher_oid_spec
 {
   const char *oid;
@@ -131,6 +153,11 @@ typedef struct gcry_cipher_spec
   gcry_cipher_decrypt_t decrypt;
   gcry_cipher_stencrypt_t stencrypt;
   gcry_cipher_stdecrypt_t stdecrypt;
+  gcry_cipher_ecb_t ecb_encrypt;
+  gcry_cipher_ecb_t ecb_decrypt;
+  gcry_cipher_cbc_t cbc_encrypt;
+  gcry_cipher_cbc_t cbc_decrypt;
+  gcry_cipher_xts_t xts_crypt;
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
@@ -320,6 +347,14 @@ gcry_err_code_t
 grub_crypto_cbc_decrypt (grub_crypto_cipher_handle_t cipher,
 			 void *out, const void *in, grub_size_t size,
 			 void *iv);
+gcry_err_code_t
+grub_crypto_xts_encrypt (grub_crypto_cipher_handle_t cipher,
+			 void *out, const void *in, grub_size_t size,
+			 void *tweak);
+gcry_err_code_t
+grub_crypto_xts_decrypt (grub_crypto_cipher_handle_t cipher,
+			 void *out, const void *in, grub_size_t size,
+			 void *tweak);
 void 
 grub_cipher_register (gcry_cipher_spec_t *cipher);
 void
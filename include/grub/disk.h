@@ -170,6 +170,18 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 /* This is called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
 
+/* Called for every read with the absolute sector, offset and size.  */
+typedef void (*grub_disk_read_record_hook_t) (grub_disk_t disk,
+					      grub_disk_addr_t sector,
+					      grub_off_t offset,
+					      grub_size_t size);
+extern grub_disk_read_record_hook_t EXPORT_VAR(grub_disk_read_record_hook);
+
+/* Bumped whenever disks may have appeared or changed what they hold
+   under the same name: a disk driver or partition map was registered or
+   a loopback device was rebound.  */
+extern unsigned int EXPORT_VAR(grub_disk_generation);
+
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
 static inline int
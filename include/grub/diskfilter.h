@@ -128,6 +128,9 @@ struct grub_diskfilter_node {
   char *name;
   struct grub_diskfilter_pv *pv;
   struct grub_diskfilter_lv *lv;
+  /* Sector following the last read from this mirror.  Only a hint for
+     spreading mirror reads.  */
+  grub_disk_addr_t next_read;
 };
 
 struct grub_diskfilter_vg *
@@ -147,11 +150,16 @@ struct grub_diskfilter
 typedef struct grub_diskfilter *grub_diskfilter_t;
 
 extern grub_diskfilter_t grub_diskfilter_list;
+/* Bumped whenever a diskfilter is registered, so that disks already
+   scanned get probed again by the new one.  */
+extern unsigned int grub_diskfilter_generation;
+
 static inline void
 grub_diskfilter_register_front (grub_diskfilter_t diskfilter)
 {
   grub_list_push (GRUB_AS_LIST_P (&grub_diskfilter_list),
 		  GRUB_AS_LIST (diskfilter));
+  grub_diskfilter_generation++;
 }
 
 static inline void
@@ -162,6 +170,7 @@ grub_diskfilter_register_back (grub_diskfilter_t diskfilter)
   diskfilter->next = NULL;
   diskfilter->prev = q;
   *q = diskfilter;
+  grub_diskfilter_generation++;
 }
 static inline void
 grub_diskfilter_unregister (grub_diskfilter_t diskfilter)
@@ -38,13 +38,24 @@ struct grub_dirhook_info
   unsigned dir:1;
   unsigned mtimeset:1;
   unsigned case_insensitive:1;
+  unsigned sizeset:1;
   grub_int32_t mtime;
+  /* Size of a regular file, if sizeset.  */
+  grub_uint64_t size;
 };
 
 typedef int (*grub_fs_dir_hook_t) (const char *filename,
 				   const struct grub_dirhook_info *info,
 				   void *data);
 
+/* LEN bytes of MAGIC found at byte OFFSET of the device.  */
+struct grub_fs_signature
+{
+  grub_disk_addr_t offset;
+  grub_size_t len;
+  const char *magic;
+};
+
 /* Filesystem descriptor.  */
 struct grub_fs
 {
@@ -81,6 +92,11 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* If set, the filesystem can only be on a device which has one of
+     these signatures.  grub_fs_probe doesn't try to mount it
+     otherwise.  The list is terminated by an entry with LEN 0.  */
+  const struct grub_fs_signature *signatures;
+
 #ifdef GRUB_UTIL
   /* Determine sectors available for embedding.  */
   grub_err_t (*embed) (grub_device_t device, unsigned int *nsectors,
@@ -125,5 +141,6 @@ grub_fs_unregister (grub_fs_t fs)
 #define FOR_FILESYSTEMS(var) FOR_LIST_ELEMENTS((var), (grub_fs_list))
 
 grub_fs_t EXPORT_FUNC(grub_fs_probe) (grub_device_t device);
+void EXPORT_FUNC(grub_fs_probe_invalidate) (void);
 
 #endif /* ! GRUB_FS_HEADER */
@@ -44,6 +44,14 @@ typedef int (*grub_fshelp_iterate_dir_hook_t) (const char *filename,
 					       grub_fshelp_node_t node,
 					       void *data);
 
+/* Look up NAME in the directory DIR.  If found, store a new malloc'ed
+   node in *FOUNDNODE and its type in *FOUNDTYPE, otherwise leave
+   *FOUNDNODE NULL.  */
+typedef grub_err_t (*grub_fshelp_lookup_file_t) (grub_fshelp_node_t dir,
+						 const char *name,
+						 grub_fshelp_node_t *foundnode,
+						 enum grub_fshelp_filetype *foundtype);
+
 /* Lookup the node PATH.  The node ROOTNODE describes the root of the
    directory tree.  The node found is returned in FOUNDNODE, which is
    either a ROOTNODE or a new malloc'ed node.  ITERATE_DIR is used to
@@ -61,6 +69,16 @@ EXPORT_FUNC(grub_fshelp_find_file) (const char *path,
 				    char *(*read_symlink) (grub_fshelp_node_t node),
 				    enum grub_fshelp_filetype expect);
 
+/* Like grub_fshelp_find_file but LOOKUP_FILE is used to find a single
+   name in a directory instead of iterating over all of its entries.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   grub_fshelp_lookup_file_t lookup_file,
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect);
+
 
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
@@ -70,6 +70,39 @@ struct grub_hfsplus_btree
   struct grub_hfsplus_file file;
 };
 
+#define GRUB_HFSPLUS_BTNODE_CACHE_SIZE 16
+
+/* A B-tree node kept in memory.  */
+struct grub_hfsplus_btnode_cache
+{
+  grub_uint32_t fileid;
+  grub_uint32_t nodeno;
+  /* Time of the last use, 0 if the entry is empty.  */
+  grub_uint32_t stamp;
+  grub_size_t size;
+  char *buf;
+};
+
+/* A run of consecutive blocks of a file.  */
+struct grub_hfsplus_extent_run
+{
+  grub_uint32_t fileblock;
+  grub_uint32_t start;
+  grub_uint32_t count;
+};
+
+/* All extents of a fork, including those in the extent overflow
+   file, sorted by FILEBLOCK.  */
+struct grub_hfsplus_extent_list
+{
+  struct grub_hfsplus_extent_list *next;
+  grub_uint32_t fileid;
+  grub_uint8_t type;
+  unsigned num_runs;
+  unsigned alloc_runs;
+  struct grub_hfsplus_extent_run *runs;
+};
+
 /* Information about a "mounted" HFS+ filesystem.  */
 struct grub_hfsplus_data
 {
@@ -89,6 +122,10 @@ struct grub_hfsplus_data
      filesystem (one inside a plain HFS wrapper).  */
   grub_disk_addr_t embedded_offset;
   int case_sensitive;
+
+  struct grub_hfsplus_btnode_cache btnode_cache[GRUB_HFSPLUS_BTNODE_CACHE_SIZE];
+  grub_uint32_t btnode_cache_stamp;
+  struct grub_hfsplus_extent_list *extent_lists;
 };
 
 /* Internal representation of a catalog key.  */
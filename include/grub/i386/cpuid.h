@@ -19,6 +19,78 @@
 #ifndef GRUB_CPU_CPUID_HEADER
 #define GRUB_CPU_CPUID_HEADER 1
 
+#include <grub/types.h>
+#include <grub/i386/tsc.h>
+
 extern unsigned char grub_cpuid_has_longmode;
 
+#ifdef __x86_64__
+#define grub_cpuid(num,a,b,c,d) \
+  asm volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) \
+		: "0" (num), "2" (0))
+#else
+#define grub_cpuid(num,a,b,c,d) \
+  asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1" \
+		: "=a" (a), "=r" (b), "=c" (c), "=d" (d)  \
+		: "0" (num), "2" (0))
+#endif
+
+/* Bits returned by grub_cpu_sse_features.  */
+#define GRUB_CPU_SSE2		(1 << 0)
+#define GRUB_CPU_SSSE3		(1 << 1)
+#define GRUB_CPU_SSE4_1		(1 << 2)
+#define GRUB_CPU_AESNI		(1 << 3)
+#define GRUB_CPU_SHA		(1 << 4)
+
+/* Return the SSE extensions that can be used, from inline assembly
+   only since GRUB is built with -mno-sse.  Besides the CPUID bits SSE
+   has to be enabled in CR4.  The OS does it for the utilities, as does
+   EFI; GRUB itself leaves CR4 as the firmware set it.  */
+static inline unsigned int
+grub_cpu_sse_features (void)
+{
+  static int features = -1;
+  grub_uint32_t max, eax, ebx, ecx, edx;
+
+  if (features != -1)
+    return features;
+  features = 0;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return features;
+  grub_cpuid (0, max, ebx, ecx, edx);
+  if (max < 1)
+    return features;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(edx & (1 << 26)))
+    return features;
+
+#if !defined (GRUB_UTIL) && !defined (GRUB_MACHINE_EMU)
+  {
+    unsigned long cr4;
+
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    /* CR4.OSFXSR.  */
+    if (!(cr4 & (1 << 9)))
+      return features;
+  }
+#endif
+
+  features |= GRUB_CPU_SSE2;
+  if (ecx & (1 << 9))
+    features |= GRUB_CPU_SSSE3;
+  if (ecx & (1 << 19))
+    features |= GRUB_CPU_SSE4_1;
+  if (ecx & (1 << 25))
+    features |= GRUB_CPU_AESNI;
+  if (max >= 7)
+    {
+      grub_cpuid (7, eax, ebx, ecx, edx);
+      if (ebx & (1 << 29))
+	features |= GRUB_CPU_SHA;
+    }
+
+  return features;
+}
+
 #endif
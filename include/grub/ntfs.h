@@ -84,6 +84,9 @@ enum
 #define GRUB_NTFS_MAX_MFT		(4096 >> GRUB_NTFS_BLK_SHR)
 #define GRUB_NTFS_MAX_IDX		(16384 >> GRUB_NTFS_BLK_SHR)
 
+/* Number of MFT records kept per mount.  */
+#define GRUB_NTFS_MFT_CACHE_SIZE	16
+
 #define GRUB_NTFS_COM_LEN		4096
 #define GRUB_NTFS_COM_LOG_LEN	12
 #define GRUB_NTFS_COM_SEC		(GRUB_NTFS_COM_LEN >> GRUB_NTFS_BLK_SHR)
@@ -129,6 +132,13 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } __attribute__ ((packed));
 
+/* A decoded data run, VCN to NEXT_VCN - 1 is stored from LCN on.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn, next_vcn, lcn;
+  int sparse;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -137,6 +147,10 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+  /* Runs decoded so far for attribute type RUNS_TYPE, sorted by VCN.  */
+  struct grub_ntfs_run *runs;
+  grub_size_t num_runs, alloc_runs;
+  grub_uint8_t runs_type;
 };
 
 struct grub_ntfs_file
@@ -150,6 +164,14 @@ struct grub_ntfs_file
   struct grub_ntfs_attr attr;
 };
 
+struct grub_ntfs_mft_cache
+{
+  grub_uint32_t mftno;
+  /* Time of the last use, 0 if the entry is empty.  */
+  grub_uint32_t stamp;
+  grub_uint8_t *buf;
+};
+
 struct grub_ntfs_data
 {
   struct grub_ntfs_file cmft;
@@ -160,6 +182,9 @@ struct grub_ntfs_data
   int log_spc;
   grub_uint64_t mft_start;
   grub_uint64_t uuid;
+  /* Fixed up MFT records, least recently used one is replaced.  */
+  struct grub_ntfs_mft_cache mft_cache[GRUB_NTFS_MFT_CACHE_SIZE];
+  grub_uint32_t mft_cache_stamp;
 };
 
 struct grub_ntfs_comp_table_element
@@ -40,6 +40,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "progname.h"
 #include "argp.h"
@@ -54,6 +58,15 @@ static int fuse_argc = 0;
 static int num_disks = 0;
 static int mount_crypt = 0;
 
+/* FUSE runs the callbacks below from several threads.  The disk cache,
+   grub_errno and the filesystem drivers keep global state, so only one
+   thread may be inside GRUB at a time.  Reads of file data GRUB already
+   located in the image bypass GRUB and run without the lock.  */
+static pthread_mutex_t grub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Descriptors of the images behind loop0, loop1, ..., or -1.  */
+static int *image_fds = NULL;
+
 static grub_err_t
 execute_command (const char *name, int n, char **args)
 {
@@ -116,6 +129,107 @@ translate_error (void)
   return ret;
 }
 
+/* Attributes of the paths looked up so far.  The image is read-only, so
+   entries never go stale; the cache is simply emptied once it holds
+   ATTR_CACHE_MAX entries.  */
+#define ATTR_CACHE_BUCKETS 4096
+#define ATTR_CACHE_MAX 65536
+
+struct attr_cache_entry
+{
+  struct attr_cache_entry *next;
+  char *path;
+  struct stat st;
+};
+
+static struct attr_cache_entry *attr_cache[ATTR_CACHE_BUCKETS];
+static unsigned attr_cache_count;
+
+static unsigned
+attr_cache_hash (const char *path)
+{
+  unsigned h = 0;
+
+  for (; *path; path++)
+    h = h * 31 + (unsigned char) *path;
+  return h % ATTR_CACHE_BUCKETS;
+}
+
+static int
+attr_cache_get (const char *path, struct stat *st)
+{
+  struct attr_cache_entry *e;
+
+  for (e = attr_cache[attr_cache_hash (path)]; e; e = e->next)
+    if (strcmp (e->path, path) == 0)
+      {
+	*st = e->st;
+	return 1;
+      }
+  return 0;
+}
+
+static void
+attr_cache_put (const char *path, const struct stat *st)
+{
+  struct attr_cache_entry *e;
+  unsigned h = attr_cache_hash (path);
+
+  for (e = attr_cache[h]; e; e = e->next)
+    if (strcmp (e->path, path) == 0)
+      return;
+
+  if (attr_cache_count == ATTR_CACHE_MAX)
+    {
+      unsigned i;
+
+      for (i = 0; i < ATTR_CACHE_BUCKETS; i++)
+	while (attr_cache[i])
+	  {
+	    e = attr_cache[i];
+	    attr_cache[i] = e->next;
+	    free (e->path);
+	    free (e);
+	  }
+      attr_cache_count = 0;
+    }
+
+  e = xmalloc (sizeof (*e));
+  e->path = xstrdup (path);
+  e->st = *st;
+  e->next = attr_cache[h];
+  attr_cache[h] = e;
+  attr_cache_count++;
+}
+
+/* Fill ST for PATH from the directory entry INFO.  Files are only opened
+   when the driver doesn't report their size.  */
+static int
+fill_stat (const char *path, const struct grub_dirhook_info *info,
+	   struct stat *st)
+{
+  memset (st, 0, sizeof (*st));
+  st->st_mode = info->dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
+  if (info->dir)
+    st->st_size = 0;
+  else if (info->sizeset)
+    st->st_size = info->size;
+  else
+    {
+      grub_file_t file;
+      file = grub_file_open (path);
+      if (! file)
+	return translate_error ();
+      st->st_size = file->size;
+      grub_file_close (file);
+    }
+  st->st_blksize = 512;
+  st->st_blocks = (st->st_size + 511) >> 9;
+  st->st_atime = st->st_mtime = st->st_ctime
+    = info->mtimeset ? info->mtime : 0;
+  return 0;
+}
+
 /* Context for fuse_getattr.  */
 struct fuse_getattr_ctx
 {
@@ -147,6 +261,7 @@ fuse_getattr (const char *path, struct stat *st)
   struct fuse_getattr_ctx ctx;
   char *pathname, *path2;
   const char *pathname_t;
+  int ret;
   
   if (path[0] == '/' && path[1] == 0)
     {
@@ -163,6 +278,9 @@ fuse_getattr (const char *path, struct stat *st)
       return 0;
     }
 
+  if (attr_cache_get (path, st))
+    return 0;
+
   ctx.file_exists = 0;
 
   pathname_t = grub_strchr (path, ')');
@@ -194,32 +312,16 @@ fuse_getattr (const char *path, struct stat *st)
   (fs->dir) (dev, path2, fuse_getattr_find_file, &ctx);
 
   grub_free (path2);
+  free (pathname);
   if (!ctx.file_exists)
     {
       grub_errno = GRUB_ERR_NONE;
       return -ENOENT;
     }
-  st->st_dev = 0;
-  st->st_ino = 0;
-  st->st_mode = ctx.file_info.dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  if (!ctx.file_info.dir)
-    {
-      grub_file_t file;
-      file = grub_file_open (path);
-      if (! file)
-	return translate_error ();
-      st->st_size = file->size;
-      grub_file_close (file);
-    }
-  else
-    st->st_size = 0;
-  st->st_blksize = 512;
-  st->st_blocks = (st->st_size + 511) >> 9;
-  st->st_atime = st->st_mtime = st->st_ctime = ctx.file_info.mtimeset
-    ? ctx.file_info.mtime : 0;
+  ret = fill_stat (path, &ctx.file_info, st);
+  if (ret)
+    return ret;
+  attr_cache_put (path, st);
   grub_errno = GRUB_ERR_NONE;
   return 0;
 }
@@ -230,20 +332,283 @@ fuse_opendir (const char *path, struct fuse_file_info *fi)
   return 0;
 }
 
-/* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
+/* Upper bound on the number of extents remembered per open file.  */
+#define MOUNT_MAX_EXTENTS 1024
+#define MOUNT_MAX_RUNS 64
+
+/* A run of file bytes stored contiguously in the image.  */
+struct mount_extent
+{
+  grub_off_t offset;
+  grub_off_t image_offset;
+  grub_off_t length;
+};
+
+/* An open file.  LOCK guards the extents, which are learned under
+   grub_lock and used without it.  */
+struct mount_file
+{
+  grub_file_t file;
+  /* Image the file lives in, or -1 if its data can't be read directly.  */
+  int fd;
+  pthread_mutex_t lock;
+  struct mount_extent *extents;
+  unsigned num_extents;
+};
+
+/* Return the extent of MF containing OFFSET, if any.  */
+static struct mount_extent *
+find_extent (struct mount_file *mf, grub_off_t offset)
+{
+  unsigned lo = 0, hi = mf->num_extents;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      struct mount_extent *e = &mf->extents[mid];
+
+      if (offset < e->offset)
+	hi = mid;
+      else if (offset >= e->offset + e->length)
+	lo = mid + 1;
+      else
+	return e;
+    }
+  return 0;
+}
+
+/* Remember that file bytes [OFFSET, OFFSET + LENGTH) live at
+   IMAGE_OFFSET, merging with neighbouring extents where possible.  */
+static void
+add_extent (struct mount_file *mf, grub_off_t offset,
+	    grub_off_t image_offset, grub_off_t length)
+{
+  struct mount_extent *e;
+  unsigned i, j;
+
+  if (!mf->extents)
+    {
+      mf->extents = malloc (MOUNT_MAX_EXTENTS * sizeof (mf->extents[0]));
+      if (!mf->extents)
+	return;
+    }
+
+  for (i = 0; i < mf->num_extents && mf->extents[i].offset < offset; i++);
+
+  /* Extend the previous extent.  */
+  if (i > 0)
+    {
+      e = &mf->extents[i - 1];
+      if (e->offset + e->length >= offset
+	  && e->image_offset - e->offset == image_offset - offset)
+	{
+	  if (e->offset + e->length < offset + length)
+	    e->length = offset + length - e->offset;
+	  i--;
+	  goto absorb;
+	}
+    }
+
+  if (mf->num_extents == MOUNT_MAX_EXTENTS)
+    return;
+  memmove (&mf->extents[i + 1], &mf->extents[i],
+	   (mf->num_extents - i) * sizeof (mf->extents[0]));
+  mf->num_extents++;
+  e = &mf->extents[i];
+  e->offset = offset;
+  e->image_offset = image_offset;
+  e->length = length;
+
+ absorb:
+  /* Swallow the following extents that the new one now reaches.  */
+  e = &mf->extents[i];
+  for (j = i + 1; j < mf->num_extents
+	 && mf->extents[j].offset <= e->offset + e->length
+	 && (mf->extents[j].image_offset - mf->extents[j].offset
+	     == e->image_offset - e->offset); j++)
+    if (e->offset + e->length < mf->extents[j].offset + mf->extents[j].length)
+      e->length = mf->extents[j].offset + mf->extents[j].length - e->offset;
+  if (j > i + 1)
+    {
+      memmove (&mf->extents[i + 1], &mf->extents[j],
+	       (mf->num_extents - j) * sizeof (mf->extents[0]));
+      mf->num_extents -= j - i - 1;
+    }
+}
+
+/* Context for fuse_read.  */
+struct learn_ctx
+{
+  /* Number of file bytes accounted for so far.  */
+  grub_size_t nbytes;
+  unsigned nruns;
+  struct
+  {
+    grub_size_t offset;
+    grub_off_t image_offset;
+    grub_size_t length;
+  } runs[MOUNT_MAX_RUNS];
+  int failed;
+};
+
+/* Helper for fuse_read.  */
+static void
+learn_run (grub_disk_addr_t sector, unsigned offset, unsigned length,
+	   void *data)
+{
+  struct learn_ctx *ctx = data;
+  grub_off_t pos = (sector << GRUB_DISK_SECTOR_BITS) + offset;
+
+  if (ctx->failed)
+    return;
+
+  if (ctx->nruns
+      && (ctx->runs[ctx->nruns - 1].image_offset
+	  + ctx->runs[ctx->nruns - 1].length) == pos)
+    ctx->runs[ctx->nruns - 1].length += length;
+  else if (ctx->nruns == MOUNT_MAX_RUNS)
+    ctx->failed = 1;
+  else
+    {
+      ctx->runs[ctx->nruns].offset = ctx->nbytes;
+      ctx->runs[ctx->nruns].image_offset = pos;
+      ctx->runs[ctx->nruns].length = length;
+      ctx->nruns++;
+    }
+  ctx->nbytes += length;
+}
+
+/* Check that the runs in CTX really hold the SIZE bytes in BUF and
+   remember them as extents starting at file offset OFF.  */
+static void
+learn_extents (struct mount_file *mf, grub_off_t off, grub_size_t size,
+	       const char *buf, struct learn_ctx *ctx)
+{
+  char *tmp;
+  unsigned i;
+
+  /* Compressed, encrypted or inline data don't show up as reads of the
+     same bytes.  */
+  if (ctx->failed || ctx->nbytes != size)
+    return;
+
+  tmp = malloc (size);
+  if (!tmp)
+    return;
+  for (i = 0; i < ctx->nruns; i++)
+    if (pread (mf->fd, tmp + ctx->runs[i].offset, ctx->runs[i].length,
+	       ctx->runs[i].image_offset) != (ssize_t) ctx->runs[i].length)
+      {
+	free (tmp);
+	return;
+      }
+
+  if (memcmp (tmp, buf, size) == 0)
+    {
+      pthread_mutex_lock (&mf->lock);
+      for (i = 0; i < ctx->nruns; i++)
+	add_extent (mf, off + ctx->runs[i].offset, ctx->runs[i].image_offset,
+		    ctx->runs[i].length);
+      pthread_mutex_unlock (&mf->lock);
+    }
+  free (tmp);
+}
+
+/* Read SZ bytes at OFF of MF straight from the image.  Return -1 if not
+   all of them are known to be there.  */
+static int
+read_direct (struct mount_file *mf, char *buf, size_t sz, off_t off)
+{
+  struct
+  {
+    grub_off_t image_offset;
+    grub_size_t length;
+  } pieces[16];
+  unsigned n = 0, i;
+  grub_off_t pos = off;
+  size_t done = 0;
+
+  if (mf->fd < 0 || off < 0 || (grub_off_t) off > mf->file->size)
+    return -1;
+  if (sz > mf->file->size - off)
+    sz = mf->file->size - off;
+
+  pthread_mutex_lock (&mf->lock);
+  while (pos < (grub_off_t) off + sz)
+    {
+      struct mount_extent *e = find_extent (mf, pos);
+      grub_off_t len;
+
+      if (!e || n == ARRAY_SIZE (pieces))
+	{
+	  pthread_mutex_unlock (&mf->lock);
+	  return -1;
+	}
+      len = e->offset + e->length - pos;
+      if (len > (grub_off_t) off + sz - pos)
+	len = (grub_off_t) off + sz - pos;
+      pieces[n].image_offset = e->image_offset + (pos - e->offset);
+      pieces[n].length = len;
+      n++;
+      pos += len;
+    }
+  pthread_mutex_unlock (&mf->lock);
+
+  for (i = 0; i < n; i++)
+    {
+      if (pread (mf->fd, buf + done, pieces[i].length,
+		 pieces[i].image_offset) != (ssize_t) pieces[i].length)
+	return -1;
+      done += pieces[i].length;
+    }
+  return done;
+}
+
+/* Return the descriptor of the image FILE is read from directly, or
+   -1.  */
+static int
+file_image_fd (grub_file_t file)
+{
+  grub_disk_t disk = file->device->disk;
+  unsigned long i;
+  char *end;
+
+  if (!disk || !image_fds || disk->dev->id != GRUB_DISK_DEVICE_LOOPBACK_ID
+      || grub_strncmp (disk->name, "loop", sizeof ("loop") - 1) != 0)
+    return -1;
+  i = grub_strtoul (disk->name + sizeof ("loop") - 1, &end, 10);
+  if (grub_errno || *end || i >= (unsigned long) num_disks)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return -1;
+    }
+  return image_fds[i];
+}
 
 static int 
-fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
+fuse_open (const char *path, struct fuse_file_info *fi)
 {
   grub_file_t file;
+  struct mount_file *mf;
+
   file = grub_file_open (path);
   if (! file)
     return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
+  mf = malloc (sizeof (*mf));
+  if (!mf)
+    {
+      grub_file_close (file);
+      grub_errno = GRUB_ERR_NONE;
+      return -ENOMEM;
+    }
+  mf->file = file;
+  mf->fd = file_image_fd (file);
+  pthread_mutex_init (&mf->lock, NULL);
+  mf->extents = NULL;
+  mf->num_extents = 0;
+  fi->fh = (uintptr_t) mf;
+  /* The image doesn't change under us.  */
+  fi->keep_cache = 1;
   grub_errno = GRUB_ERR_NONE;
   return 0;
 } 
@@ -252,29 +617,44 @@ static int
 fuse_read (const char *path, char *buf, size_t sz, off_t off,
 	   struct fuse_file_info *fi)
 {
-  grub_file_t file = files[fi->fh];
+  struct mount_file *mf = (struct mount_file *) (uintptr_t) fi->fh;
+  grub_file_t file = mf->file;
   grub_ssize_t size;
+  struct learn_ctx ctx;
 
   if (off > file->size)
     return -EINVAL;
 
   file->offset = off;
-  
+
+  if (mf->fd >= 0)
+    {
+      ctx.nbytes = 0;
+      ctx.nruns = 0;
+      ctx.failed = 0;
+      file->read_hook = learn_run;
+      file->read_hook_data = &ctx;
+    }
   size = grub_file_read (file, buf, sz);
+  file->read_hook = 0;
+  file->read_hook_data = 0;
   if (size < 0)
     return translate_error ();
-  else
-    {
-      grub_errno = GRUB_ERR_NONE;
-      return size;
-    }
+  if (mf->fd >= 0)
+    learn_extents (mf, off, size, buf, &ctx);
+  grub_errno = GRUB_ERR_NONE;
+  return size;
 } 
 
 static int 
 fuse_release (const char *path, struct fuse_file_info *fi)
 {
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
+  struct mount_file *mf = (struct mount_file *) (uintptr_t) fi->fh;
+
+  grub_file_close (mf->file);
+  pthread_mutex_destroy (&mf->lock);
+  free (mf->extents);
+  free (mf);
   grub_errno = GRUB_ERR_NONE;
   return 0;
 }
@@ -294,25 +674,28 @@ fuse_readdir_call_fill (const char *filename,
 {
   struct fuse_readdir_ctx *ctx = data;
   struct stat st;
+  char *tmp;
+  int ret;
 
-  grub_memset (&st, 0, sizeof (st));
-  st.st_mode = info->dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
-  if (!info->dir)
+  if (strcmp (filename, ".") == 0 || strcmp (filename, "..") == 0)
+    {
+      memset (&st, 0, sizeof (st));
+      st.st_mode = 0555 | S_IFDIR;
+      ctx->fill (ctx->buf, filename, &st, 0);
+      return 0;
+    }
+
+  tmp = xasprintf ("%s%s%s", ctx->path,
+		   ctx->path[strlen (ctx->path) - 1] == '/' ? "" : "/",
+		   filename);
+  ret = fill_stat (tmp, info, &st);
+  if (ret)
     {
-      grub_file_t file;
-      char *tmp;
-      tmp = xasprintf ("%s/%s", ctx->path, filename);
-      file = grub_file_open (tmp);
       free (tmp);
-      if (! file)
-	return translate_error ();
-      st.st_size = file->size;
-      grub_file_close (file);
+      return ret;
     }
-  st.st_blksize = 512;
-  st.st_blocks = (st.st_size + 511) >> 9;
-  st.st_atime = st.st_mtime = st.st_ctime
-    = info->mtimeset ? info->mtime : 0;
+  attr_cache_put (tmp, &st);
+  free (tmp);
   ctx->fill (ctx->buf, filename, &st, 0);
   return 0;
 }
@@ -341,13 +724,75 @@ fuse_readdir (const char *path, void *buf,
   return 0;
 }
 
+static int
+fuse_getattr_locked (const char *path, struct stat *st)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_getattr (path, st);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
+static int
+fuse_open_locked (const char *path, struct fuse_file_info *fi)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_open (path, fi);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
+static int
+fuse_read_locked (const char *path, char *buf, size_t sz, off_t off,
+		  struct fuse_file_info *fi)
+{
+  int ret;
+
+  ret = read_direct ((struct mount_file *) (uintptr_t) fi->fh, buf, sz, off);
+  if (ret >= 0)
+    return ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_read (path, buf, sz, off, fi);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
+static int
+fuse_release_locked (const char *path, struct fuse_file_info *fi)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_release (path, fi);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
+static int
+fuse_readdir_locked (const char *path, void *buf,
+		     fuse_fill_dir_t fill, off_t off,
+		     struct fuse_file_info *fi)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_readdir (path, buf, fill, off, fi);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
 struct fuse_operations grub_opers = {
-  .getattr = fuse_getattr,
-  .open = fuse_open,
-  .release = fuse_release,
+  .getattr = fuse_getattr_locked,
+  .open = fuse_open_locked,
+  .release = fuse_release_locked,
   .opendir = fuse_opendir,
-  .readdir = fuse_readdir,
-  .read = fuse_read
+  .readdir = fuse_readdir_locked,
+  .read = fuse_read_locked
 };
 
 static grub_err_t
@@ -355,11 +800,19 @@ fuse_init (void)
 {
   int i;
 
+  image_fds = xmalloc (num_disks * sizeof (image_fds[0]));
   for (i = 0; i < num_disks; i++)
     {
       char *argv[2];
       char *host_file;
       char *loop_name;
+
+      /* Without the descriptor reads just go through GRUB.  */
+      image_fds[i] = open (images[i], O_RDONLY);
+      if (image_fds[i] < 0)
+	grub_util_warn (_("cannot open `%s': %s"), images[i],
+			strerror (errno));
+
       loop_name = grub_xasprintf ("loop%d", i);
       if (!loop_name)
 	grub_util_error ("%s", grub_errmsg);
@@ -426,6 +879,9 @@ fuse_init (void)
 
       grub_free (argv[0]);
       grub_free (loop_name);
+
+      if (image_fds[i] >= 0)
+	close (image_fds[i]);
     }
 
   return grub_errno;
@@ -545,11 +1001,16 @@ main (int argc, char *argv[])
 
   grub_util_init_nls ();
 
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 3) * sizeof (fuse_args[0]));
   fuse_args[fuse_argc] = xstrdup (argv[0]);
   fuse_argc++;
-  /* Run single-threaded.  */
-  fuse_args[fuse_argc] = xstrdup ("-s");
+  /* The mount is read-only, so let the kernel cache attributes, lookups
+     and file contents.  Options given on the command line come later
+     and override these.  */
+  fuse_args[fuse_argc] = xstrdup ("-o");
+  fuse_argc++;
+  fuse_args[fuse_argc] = xstrdup ("ro,kernel_cache,entry_timeout=3600,"
+				  "attr_timeout=3600,negative_timeout=3600");
   fuse_argc++;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);